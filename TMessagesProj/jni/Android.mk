@@ -104,26 +104,45 @@ LOCAL_CPPFLAGS := -Wall -std=c++11 -DANDROID -frtti -DHAVE_PTHREAD -finline-func
 LOCAL_C_INCLUDES += ./jni/boringssl/include/
 LOCAL_ARM_MODE := arm
 LOCAL_MODULE := tgnet
-LOCAL_STATIC_LIBRARIES := crypto
+LOCAL_STATIC_LIBRARIES := crypto cpufeatures
+
+ifeq ($(TARGET_ARCH_ABI),arm64-v8a)
+    LOCAL_CPPFLAGS += -march=armv8-a+crypto
+else ifeq ($(TARGET_ARCH_ABI),x86)
+    LOCAL_CPPFLAGS += -maes
+else ifeq ($(TARGET_ARCH_ABI),x86_64)
+    LOCAL_CPPFLAGS += -maes
+endif
 
 LOCAL_SRC_FILES := \
+./tgnet/AesIge.cpp \
 ./tgnet/ApiScheme.cpp \
+./tgnet/BandwidthEstimator.cpp \
 ./tgnet/BuffersStorage.cpp \
 ./tgnet/ByteArray.cpp \
 ./tgnet/ByteStream.cpp \
+./tgnet/CompressionPolicy.cpp \
 ./tgnet/Connection.cpp \
 ./tgnet/ConnectionSession.cpp \
 ./tgnet/ConnectionsManager.cpp \
 ./tgnet/ConnectionSocket.cpp \
+./tgnet/CryptoWorkerPool.cpp \
 ./tgnet/Datacenter.cpp \
+./tgnet/DownloadScheduler.cpp \
 ./tgnet/EventObject.cpp \
+./tgnet/FileIoWorker.cpp \
 ./tgnet/FileLog.cpp \
 ./tgnet/MTProtoScheme.cpp \
 ./tgnet/NativeByteBuffer.cpp \
+./tgnet/NetworkReactor.cpp \
 ./tgnet/Request.cpp \
+./tgnet/SlabAllocator.cpp \
+./tgnet/TaskQueue.cpp \
 ./tgnet/Timer.cpp \
+./tgnet/TimerWheel.cpp \
 ./tgnet/TLObject.cpp \
 ./tgnet/FileLoadOperation.cpp \
+./tgnet/FileUploadOperation.cpp \
 ./tgnet/ProxyCheckInfo.cpp \
 ./tgnet/Handshake.cpp \
 ./tgnet/Config.cpp
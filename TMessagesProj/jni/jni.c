@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #include "image.h"
 #include "libtgvoip/client/android/tg_voip_jni.h"
 
@@ -123,6 +124,124 @@ JNIEXPORT void Java_org_paathshala_commsys_Utilities_aesCtrDecryptionByteArray(J
     (*env)->ReleaseByteArrayElements(env, buffer, bufferBuff, 0);
 }
 
+#define AES_CTR_PARALLEL_MIN_SIZE (256 * 1024)
+#define AES_CTR_MAX_THREADS 4
+
+typedef struct AesCtrContext {
+    AES_KEY key;
+    uint8_t iv[16];
+} AesCtrContext;
+
+typedef struct AesCtrRange {
+    AesCtrContext *context;
+    uint8_t *data;
+    uint32_t length;
+    uint64_t fileOffset;
+} AesCtrRange;
+
+static void aesCtrDecryptRange(AesCtrContext *context, uint8_t *data, uint32_t length, uint64_t fileOffset) {
+    uint8_t iv[16];
+    uint8_t count[16];
+    memcpy(iv, context->iv, 16);
+    unsigned int num = (unsigned int) (fileOffset % 16);
+    uint32_t o = (uint32_t) (fileOffset / 16);
+    if (num != 0) {
+        iv[15] = (uint8_t) (o & 0xff);
+        iv[14] = (uint8_t) ((o >> 8) & 0xff);
+        iv[13] = (uint8_t) ((o >> 16) & 0xff);
+        iv[12] = (uint8_t) ((o >> 24) & 0xff);
+        AES_encrypt(iv, count, &context->key);
+        o++;
+    }
+    iv[15] = (uint8_t) (o & 0xff);
+    iv[14] = (uint8_t) ((o >> 8) & 0xff);
+    iv[13] = (uint8_t) ((o >> 16) & 0xff);
+    iv[12] = (uint8_t) ((o >> 24) & 0xff);
+    AES_ctr128_encrypt(data, data, length, &context->key, iv, count, &num);
+}
+
+static void *aesCtrDecryptRangeThread(void *data) {
+    AesCtrRange *range = (AesCtrRange *) data;
+    aesCtrDecryptRange(range->context, range->data, range->length, range->fileOffset);
+    return NULL;
+}
+
+JNIEXPORT jlong Java_org_paathshala_commsys_Utilities_aesCtrCreateContext(JNIEnv *env, jclass class, jbyteArray key, jbyteArray iv) {
+    AesCtrContext *context = (AesCtrContext *) malloc(sizeof(AesCtrContext));
+    if (context == NULL) {
+        return 0;
+    }
+    unsigned char *keyBuff = (unsigned char *) (*env)->GetByteArrayElements(env, key, NULL);
+    AES_set_encrypt_key(keyBuff, 32 * 8, &context->key);
+    (*env)->ReleaseByteArrayElements(env, key, keyBuff, JNI_ABORT);
+    (*env)->GetByteArrayRegion(env, iv, 0, 16, (jbyte *) context->iv);
+    return (jlong) (intptr_t) context;
+}
+
+JNIEXPORT void Java_org_paathshala_commsys_Utilities_aesCtrDestroyContext(JNIEnv *env, jclass class, jlong contextPtr) {
+    AesCtrContext *context = (AesCtrContext *) (intptr_t) contextPtr;
+    if (context != NULL) {
+        memset(context, 0, sizeof(AesCtrContext));
+        free(context);
+    }
+}
+
+JNIEXPORT void Java_org_paathshala_commsys_Utilities_aesCtrDecryptionContext(JNIEnv *env, jclass class, jlong contextPtr, jobject buffer, jint offset, jint length, jlong fileOffset) {
+    AesCtrContext *context = (AesCtrContext *) (intptr_t) contextPtr;
+    uint8_t *what = (*env)->GetDirectBufferAddress(env, buffer);
+    if (context == NULL || what == NULL || length <= 0) {
+        return;
+    }
+    what += offset;
+
+    uint32_t threadsCount = 1;
+    if (length >= AES_CTR_PARALLEL_MIN_SIZE) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threadsCount = (uint32_t) (length / (AES_CTR_PARALLEL_MIN_SIZE / 2));
+        if (threadsCount > AES_CTR_MAX_THREADS) {
+            threadsCount = AES_CTR_MAX_THREADS;
+        }
+        if (cpus > 0 && threadsCount > (uint32_t) cpus) {
+            threadsCount = (uint32_t) cpus;
+        }
+    }
+    if (threadsCount <= 1) {
+        aesCtrDecryptRange(context, what, (uint32_t) length, (uint64_t) fileOffset);
+        return;
+    }
+
+    AesCtrRange ranges[AES_CTR_MAX_THREADS];
+    pthread_t threads[AES_CTR_MAX_THREADS];
+    uint32_t started[AES_CTR_MAX_THREADS];
+    uint32_t part = ((uint32_t) length / threadsCount + 15) & ~15u;
+    uint32_t position = 0;
+    uint32_t count = 0;
+    while (position < (uint32_t) length && count < threadsCount) {
+        uint32_t partLength = (uint32_t) length - position;
+        if (count != threadsCount - 1 && partLength > part) {
+            partLength = part;
+        }
+        ranges[count].context = context;
+        ranges[count].data = what + position;
+        ranges[count].length = partLength;
+        ranges[count].fileOffset = (uint64_t) fileOffset + position;
+        position += partLength;
+        count++;
+    }
+    for (uint32_t a = 1; a < count; a++) {
+        started[a] = pthread_create(&threads[a], NULL, aesCtrDecryptRangeThread, &ranges[a]) == 0;
+        if (!started[a]) {
+            aesCtrDecryptRangeThread(&ranges[a]);
+        }
+    }
+    aesCtrDecryptRangeThread(&ranges[0]);
+    for (uint32_t a = 1; a < count; a++) {
+        if (started[a]) {
+            pthread_join(threads[a], NULL);
+        }
+    }
+}
+
 JNIEXPORT void Java_org_paathshala_commsys_Utilities_aesCbcEncryptionByteArray(JNIEnv *env, jclass class, jbyteArray buffer, jbyteArray key, jbyteArray iv, jint offset, jint length, jint fileOffset, jint encrypt) {
     unsigned char *bufferBuff = (unsigned char *) (*env)->GetByteArrayElements(env, buffer, NULL);
     unsigned char *keyBuff = (unsigned char *) (*env)->GetByteArrayElements(env, key, NULL);
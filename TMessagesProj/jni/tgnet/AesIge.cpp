@@ -0,0 +1,280 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <openssl/aes.h>
+#include "AesIge.h"
+
+#if defined(__AES__) && (defined(__x86_64__) || defined(__i386__))
+#define AES_IGE_X86
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#elif defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#define AES_IGE_ARM64
+#include <arm_neon.h>
+#endif
+
+#ifdef ANDROID
+#include <cpu-features.h>
+#endif
+
+#if defined(AES_IGE_X86) || defined(AES_IGE_ARM64)
+
+static const uint8_t sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+static void expandKey(const uint8_t *key, uint8_t *roundKeys) {
+    memcpy(roundKeys, key, 32);
+    uint8_t rcon = 1;
+    for (uint32_t a = 32; a < 240; a += 4) {
+        uint8_t t[4];
+        memcpy(t, roundKeys + a - 4, 4);
+        if (a % 32 == 0) {
+            uint8_t first = t[0];
+            t[0] = sbox[t[1]] ^ rcon;
+            t[1] = sbox[t[2]];
+            t[2] = sbox[t[3]];
+            t[3] = sbox[first];
+            rcon = (uint8_t) ((rcon << 1) ^ ((rcon & 0x80) ? 0x1b : 0));
+        } else if (a % 32 == 16) {
+            for (uint32_t b = 0; b < 4; b++) {
+                t[b] = sbox[t[b]];
+            }
+        }
+        for (uint32_t b = 0; b < 4; b++) {
+            roundKeys[a + b] = roundKeys[a - 32 + b] ^ t[b];
+        }
+    }
+}
+
+#endif
+
+#ifdef AES_IGE_X86
+
+typedef __m128i AesBlock;
+
+static inline AesBlock loadBlock(const uint8_t *data) {
+    return _mm_loadu_si128((const __m128i *) data);
+}
+
+static inline void storeBlock(uint8_t *data, AesBlock block) {
+    _mm_storeu_si128((__m128i *) data, block);
+}
+
+static inline AesBlock xorBlock(AesBlock a, AesBlock b) {
+    return _mm_xor_si128(a, b);
+}
+
+static inline AesBlock invertMixColumns(AesBlock block) {
+    return _mm_aesimc_si128(block);
+}
+
+static inline void processRounds(AesBlock *state, AesBlock (*keys)[15], uint32_t lanes, bool encrypt) {
+    for (uint32_t l = 0; l < lanes; l++) {
+        state[l] = _mm_xor_si128(state[l], keys[l][0]);
+    }
+    if (encrypt) {
+        for (uint32_t r = 1; r < 14; r++) {
+            for (uint32_t l = 0; l < lanes; l++) {
+                state[l] = _mm_aesenc_si128(state[l], keys[l][r]);
+            }
+        }
+        for (uint32_t l = 0; l < lanes; l++) {
+            state[l] = _mm_aesenclast_si128(state[l], keys[l][14]);
+        }
+    } else {
+        for (uint32_t r = 1; r < 14; r++) {
+            for (uint32_t l = 0; l < lanes; l++) {
+                state[l] = _mm_aesdec_si128(state[l], keys[l][r]);
+            }
+        }
+        for (uint32_t l = 0; l < lanes; l++) {
+            state[l] = _mm_aesdeclast_si128(state[l], keys[l][14]);
+        }
+    }
+}
+
+#elif defined(AES_IGE_ARM64)
+
+typedef uint8x16_t AesBlock;
+
+static inline AesBlock loadBlock(const uint8_t *data) {
+    return vld1q_u8(data);
+}
+
+static inline void storeBlock(uint8_t *data, AesBlock block) {
+    vst1q_u8(data, block);
+}
+
+static inline AesBlock xorBlock(AesBlock a, AesBlock b) {
+    return veorq_u8(a, b);
+}
+
+static inline AesBlock invertMixColumns(AesBlock block) {
+    return vaesimcq_u8(block);
+}
+
+static inline void processRounds(AesBlock *state, AesBlock (*keys)[15], uint32_t lanes, bool encrypt) {
+    if (encrypt) {
+        for (uint32_t r = 0; r < 13; r++) {
+            for (uint32_t l = 0; l < lanes; l++) {
+                state[l] = vaesmcq_u8(vaeseq_u8(state[l], keys[l][r]));
+            }
+        }
+        for (uint32_t l = 0; l < lanes; l++) {
+            state[l] = veorq_u8(vaeseq_u8(state[l], keys[l][13]), keys[l][14]);
+        }
+    } else {
+        for (uint32_t r = 0; r < 13; r++) {
+            for (uint32_t l = 0; l < lanes; l++) {
+                state[l] = vaesimcq_u8(vaesdq_u8(state[l], keys[l][r]));
+            }
+        }
+        for (uint32_t l = 0; l < lanes; l++) {
+            state[l] = veorq_u8(vaesdq_u8(state[l], keys[l][13]), keys[l][14]);
+        }
+    }
+}
+
+#endif
+
+bool AesIge::isHardwareAccelerated() {
+#if defined(AES_IGE_X86) || defined(AES_IGE_ARM64)
+#ifdef ANDROID
+    static const bool supported = (android_getCpuFeatures() & (android_getCpuFamily() == ANDROID_CPU_FAMILY_ARM64 ? ANDROID_CPU_ARM64_FEATURE_AES : ANDROID_CPU_X86_FEATURE_AES_NI)) != 0;
+#elif defined(AES_IGE_X86)
+    static const bool supported = __builtin_cpu_supports("aes") != 0;
+#else
+    static const bool supported = true;
+#endif
+    return supported;
+#else
+    return false;
+#endif
+}
+
+void AesIge::process(AesIgeStream *streams, uint32_t count, bool encrypt) {
+    if (count == 0) {
+        return;
+    }
+    if (!isHardwareAccelerated()) {
+        for (uint32_t a = 0; a < count; a++) {
+            processSoftware(&streams[a], encrypt);
+        }
+        return;
+    }
+    for (uint32_t a = 0; a < count; a += AES_IGE_MAX_STREAMS) {
+        processHardware(streams + a, std::min(count - a, (uint32_t) AES_IGE_MAX_STREAMS), encrypt);
+    }
+}
+
+void AesIge::processSoftware(AesIgeStream *stream, bool encrypt) {
+    uint8_t ivBytes[32];
+    memcpy(ivBytes, stream->iv, 32);
+    AES_KEY akey;
+    if (encrypt) {
+        AES_set_encrypt_key(stream->key, 32 * 8, &akey);
+        AES_ige_encrypt(stream->buffer, stream->buffer, stream->length, &akey, ivBytes, AES_ENCRYPT);
+    } else {
+        AES_set_decrypt_key(stream->key, 32 * 8, &akey);
+        AES_ige_encrypt(stream->buffer, stream->buffer, stream->length, &akey, ivBytes, AES_DECRYPT);
+    }
+    if (stream->changeIv) {
+        memcpy(stream->iv, ivBytes, 32);
+    }
+}
+
+void AesIge::processHardware(AesIgeStream *streams, uint32_t count, bool encrypt) {
+#if defined(AES_IGE_X86) || defined(AES_IGE_ARM64)
+    AesIgeStream *lanes[AES_IGE_MAX_STREAMS];
+    for (uint32_t l = 0; l < count; l++) {
+        lanes[l] = &streams[l];
+    }
+    std::sort(lanes, lanes + count, [](AesIgeStream *a, AesIgeStream *b) {
+        return a->length > b->length;
+    });
+
+    AesBlock keys[AES_IGE_MAX_STREAMS][15];
+    AesBlock prevCipher[AES_IGE_MAX_STREAMS];
+    AesBlock prevPlain[AES_IGE_MAX_STREAMS];
+    AesBlock input[AES_IGE_MAX_STREAMS];
+    AesBlock state[AES_IGE_MAX_STREAMS];
+    uint8_t roundKeys[240];
+    for (uint32_t l = 0; l < count; l++) {
+        expandKey(lanes[l]->key, roundKeys);
+        if (encrypt) {
+            for (uint32_t r = 0; r < 15; r++) {
+                keys[l][r] = loadBlock(roundKeys + r * 16);
+            }
+        } else {
+            keys[l][0] = loadBlock(roundKeys + 14 * 16);
+            for (uint32_t r = 1; r < 14; r++) {
+                keys[l][r] = invertMixColumns(loadBlock(roundKeys + (14 - r) * 16));
+            }
+            keys[l][14] = loadBlock(roundKeys);
+        }
+        prevCipher[l] = loadBlock(lanes[l]->iv);
+        prevPlain[l] = loadBlock(lanes[l]->iv + 16);
+    }
+    memset(roundKeys, 0, sizeof(roundKeys));
+
+    uint32_t active = count;
+    for (uint32_t offset = 0; ; offset += 16) {
+        while (active > 0 && lanes[active - 1]->length < offset + 16) {
+            active--;
+        }
+        if (active == 0) {
+            break;
+        }
+        for (uint32_t l = 0; l < active; l++) {
+            input[l] = loadBlock(lanes[l]->buffer + offset);
+            state[l] = xorBlock(input[l], encrypt ? prevCipher[l] : prevPlain[l]);
+        }
+        processRounds(state, keys, active, encrypt);
+        for (uint32_t l = 0; l < active; l++) {
+            if (encrypt) {
+                prevCipher[l] = xorBlock(state[l], prevPlain[l]);
+                prevPlain[l] = input[l];
+                storeBlock(lanes[l]->buffer + offset, prevCipher[l]);
+            } else {
+                prevPlain[l] = xorBlock(state[l], prevCipher[l]);
+                prevCipher[l] = input[l];
+                storeBlock(lanes[l]->buffer + offset, prevPlain[l]);
+            }
+        }
+    }
+
+    for (uint32_t l = 0; l < count; l++) {
+        if (lanes[l]->changeIv) {
+            storeBlock(lanes[l]->iv, prevCipher[l]);
+            storeBlock(lanes[l]->iv + 16, prevPlain[l]);
+        }
+    }
+#else
+    for (uint32_t a = 0; a < count; a++) {
+        processSoftware(&streams[a], encrypt);
+    }
+#endif
+}
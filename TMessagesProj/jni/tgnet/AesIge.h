@@ -0,0 +1,35 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#ifndef AESIGE_H
+#define AESIGE_H
+
+#include <stdint.h>
+
+#define AES_IGE_MAX_STREAMS 8
+
+typedef struct AesIgeStream {
+    uint8_t *buffer = nullptr;
+    uint8_t *key = nullptr;
+    uint8_t *iv = nullptr;
+    uint32_t length = 0;
+    bool changeIv = false;
+} AesIgeStream;
+
+class AesIge {
+
+public:
+    static void process(AesIgeStream *streams, uint32_t count, bool encrypt);
+    static bool isHardwareAccelerated();
+
+private:
+    static void processHardware(AesIgeStream *streams, uint32_t count, bool encrypt);
+    static void processSoftware(AesIgeStream *stream, bool encrypt);
+};
+
+#endif
@@ -163,6 +163,7 @@ TL_config *TL_config::TLdeserialize(NativeByteBuffer *stream, uint32_t construct
 }
 
 void TL_config::readParams(NativeByteBuffer *stream, int32_t instanceNum, bool &error) {
+    uint32_t startPosition = stream->position();
     flags = stream->readInt32(&error);
     date = stream->readInt32(&error);
     expires = stream->readInt32(&error);
@@ -238,6 +239,16 @@ void TL_config::readParams(NativeByteBuffer *stream, int32_t instanceNum, bool &
     if ((flags & 4) != 0) {
         base_lang_pack_version = stream->readInt32(&error);
     }
+    if (!error) {
+        objectSize = 4 + stream->position() - startPosition;
+    }
+}
+
+uint32_t TL_config::getObjectSize() {
+    if (objectSize == 0) {
+        objectSize = TLObject::getObjectSize();
+    }
+    return objectSize;
 }
 
 void TL_config::serializeToStream(NativeByteBuffer *stream) {
@@ -916,6 +927,22 @@ bool TL_upload_saveFilePart::isNeedLayer() {
     return true;
 }
 
+TLObject *TL_upload_saveBigFilePart::deserializeResponse(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error) {
+    return Bool::TLdeserialize(stream, constructor, instanceNum, error);
+}
+
+void TL_upload_saveBigFilePart::serializeToStream(NativeByteBuffer *stream) {
+    stream->writeInt32(constructor);
+    stream->writeInt64(file_id);
+    stream->writeInt32(file_part);
+    stream->writeInt32(file_total_parts);
+    stream->writeByteArray(bytes.get());
+}
+
+bool TL_upload_saveBigFilePart::isNeedLayer() {
+    return true;
+}
+
 TLObject *TL_upload_getFile::deserializeResponse(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error) {
     return TL_upload_file::TLdeserialize(stream, constructor, instanceNum, error);
 }
@@ -148,6 +148,10 @@ public:
     static TL_config *TLdeserialize(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error);
     void readParams(NativeByteBuffer *stream, int32_t instanceNum, bool &error);
     void serializeToStream(NativeByteBuffer *stream);
+    uint32_t getObjectSize();
+
+private:
+    uint32_t objectSize = 0;
 };
 
 class TL_help_getConfig : public TLObject {
@@ -580,6 +584,21 @@ public:
     void serializeToStream(NativeByteBuffer *stream);
 };
 
+class TL_upload_saveBigFilePart : public TLObject {
+
+public:
+    static const uint32_t constructor = 0xde7b673d;
+
+    int64_t file_id;
+    int32_t file_part;
+    int32_t file_total_parts;
+    std::unique_ptr<ByteArray> bytes;
+
+    bool isNeedLayer();
+    TLObject *deserializeResponse(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error);
+    void serializeToStream(NativeByteBuffer *stream);
+};
+
 class TL_upload_file : public TLObject {
 
 public:
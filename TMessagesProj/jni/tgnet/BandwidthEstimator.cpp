@@ -0,0 +1,69 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#include <algorithm>
+#include "BandwidthEstimator.h"
+#include "Request.h"
+
+void BandwidthEstimator::onRequestStarted(Request *request) {
+    request->deliveredBytesAtStart = delivered;
+}
+
+void BandwidthEstimator::onRequestCompleted(Request *request, uint32_t bytes, int64_t now) {
+    delivered += bytes;
+    deliveredBytes.store(delivered, std::memory_order_relaxed);
+    if (request->startTimeMillis == 0 || now <= request->startTimeMillis) {
+        return;
+    }
+    int64_t rtt = now - request->startTimeMillis;
+    int64_t rate = (int64_t) (delivered - request->deliveredBytesAtStart) * 1000 / rtt;
+
+    rateSamples[nextSample].time = now;
+    rateSamples[nextSample].value = rate;
+    int64_t maxBandwidth = getBandwidth(now);
+    int64_t transferTime = maxBandwidth > 0 ? (int64_t) bytes * 1000 / maxBandwidth : 0;
+    rttSamples[nextSample].time = now;
+    rttSamples[nextSample].value = std::max((int64_t) 1, rtt - transferTime);
+    nextSample = (nextSample + 1) % BANDWIDTH_SAMPLES_COUNT;
+
+    int64_t srtt = smoothedRtt.load(std::memory_order_relaxed);
+    smoothedRtt.store(srtt == 0 ? rtt : (srtt * 7 + rtt) / 8, std::memory_order_relaxed);
+    bandwidth.store(maxBandwidth, std::memory_order_relaxed);
+    minRtt.store(getMinRtt(now), std::memory_order_relaxed);
+    lastSampleTime.store(now, std::memory_order_relaxed);
+    samplesCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+int64_t BandwidthEstimator::getBandwidth(int64_t now) {
+    int64_t result = 0;
+    for (uint32_t a = 0; a < BANDWIDTH_SAMPLES_COUNT; a++) {
+        if (rateSamples[a].time != 0 && now - rateSamples[a].time <= BANDWIDTH_WINDOW_MILLIS && rateSamples[a].value > result) {
+            result = rateSamples[a].value;
+        }
+    }
+    return result;
+}
+
+int64_t BandwidthEstimator::getMinRtt(int64_t now) {
+    int64_t result = 0;
+    for (uint32_t a = 0; a < BANDWIDTH_SAMPLES_COUNT; a++) {
+        if (rttSamples[a].time != 0 && now - rttSamples[a].time <= BANDWIDTH_WINDOW_MILLIS && (result == 0 || rttSamples[a].value < result)) {
+            result = rttSamples[a].value;
+        }
+    }
+    return result;
+}
+
+void BandwidthEstimator::getEstimate(BandwidthEstimate *estimate, int64_t now) {
+    bool expired = now - lastSampleTime.load(std::memory_order_relaxed) > BANDWIDTH_WINDOW_MILLIS;
+    estimate->bandwidth = expired ? 0 : bandwidth.load(std::memory_order_relaxed);
+    estimate->minRtt = expired ? 0 : minRtt.load(std::memory_order_relaxed);
+    estimate->smoothedRtt = smoothedRtt.load(std::memory_order_relaxed);
+    estimate->deliveredBytes = deliveredBytes.load(std::memory_order_relaxed);
+    estimate->samplesCount = samplesCount.load(std::memory_order_relaxed);
+}
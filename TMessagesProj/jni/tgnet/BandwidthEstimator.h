@@ -0,0 +1,56 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#ifndef BANDWIDTHESTIMATOR_H
+#define BANDWIDTHESTIMATOR_H
+
+#include <stdint.h>
+#include <atomic>
+
+#define BANDWIDTH_SAMPLES_COUNT 16
+#define BANDWIDTH_WINDOW_MILLIS 10000
+
+class Request;
+
+struct BandwidthEstimate {
+    int64_t bandwidth;
+    int64_t minRtt;
+    int64_t smoothedRtt;
+    uint64_t deliveredBytes;
+    uint32_t samplesCount;
+};
+
+class BandwidthEstimator {
+
+public:
+    void onRequestStarted(Request *request);
+    void onRequestCompleted(Request *request, uint32_t bytes, int64_t now);
+    int64_t getBandwidth(int64_t now);
+    int64_t getMinRtt(int64_t now);
+    void getEstimate(BandwidthEstimate *estimate, int64_t now);
+
+private:
+    struct Sample {
+        int64_t time = 0;
+        int64_t value = 0;
+    };
+
+    Sample rateSamples[BANDWIDTH_SAMPLES_COUNT];
+    Sample rttSamples[BANDWIDTH_SAMPLES_COUNT];
+    uint32_t nextSample = 0;
+    uint64_t delivered = 0;
+
+    std::atomic<int64_t> bandwidth{0};
+    std::atomic<int64_t> minRtt{0};
+    std::atomic<int64_t> smoothedRtt{0};
+    std::atomic<uint64_t> deliveredBytes{0};
+    std::atomic<uint32_t> samplesCount{0};
+    std::atomic<int64_t> lastSampleTime{0};
+};
+
+#endif
@@ -6,10 +6,19 @@
  * Copyright Nikolai Kudashov, 2015-2018.
  */
 
+#include <algorithm>
 #include "BuffersStorage.h"
 #include "FileLog.h"
 #include "NativeByteBuffer.h"
 
+#define BUFFERS_STORAGE_TRIM_INTERVAL 1024
+#define BUFFERS_STORAGE_CLASS_BYTES_LIMIT (4 * 1024 * 1024)
+#define BUFFERS_STORAGE_CLASS_COUNT_LIMIT 1024
+
+static const uint32_t classSizes[BUFFERS_STORAGE_CLASSES_COUNT] = {8, 128, 1024 + 200, 4096 + 200, 16384 + 200, 40000, 160000, 262144 + 200, 524288 + 200, 1048576 + 200};
+static const uint32_t classMinCounts[BUFFERS_STORAGE_CLASSES_COUNT] = {80, 80, 10, 10, 10, 10, 10, 4, 4, 2};
+static const uint32_t threadCacheCounts[BUFFERS_STORAGE_CLASSES_COUNT] = {16, 16, 8, 8, 4, 4, 2, 1, 1, 1};
+
 BuffersStorage &BuffersStorage::getInstance() {
     static BuffersStorage instance(true);
     return instance;
@@ -20,57 +29,77 @@ BuffersStorage::BuffersStorage(bool threadSafe) {
     if (isThreadSafe) {
         pthread_mutex_init(&mutex, NULL);
     }
+    for (int32_t a = 0; a < BUFFERS_STORAGE_CLASSES_COUNT; a++) {
+        classes[a].maxCount = classMinCounts[a];
+    }
     for (uint32_t a = 0; a < 4; a++) {
-        freeBuffers8.push_back(new NativeByteBuffer((uint32_t) 8));
+        classes[0].freeBuffers.push_back(new NativeByteBuffer((uint32_t) 8));
     }
     for (uint32_t a = 0; a < 5; a++) {
-        freeBuffers128.push_back(new NativeByteBuffer((uint32_t) 128));
+        classes[1].freeBuffers.push_back(new NativeByteBuffer((uint32_t) 128));
     }
+    bytesHeld = 4 * 8 + 5 * 128;
 }
 
-NativeByteBuffer *BuffersStorage::getFreeBuffer(uint32_t size) {
-    uint32_t byteCount = 0;
-    std::vector<NativeByteBuffer *> *arrayToGetFrom = nullptr;
-    NativeByteBuffer *buffer = nullptr;
-    if (size <= 8) {
-        arrayToGetFrom = &freeBuffers8;
-        byteCount = 8;
-    } else if (size <= 128) {
-        arrayToGetFrom = &freeBuffers128;
-        byteCount = 128;
-    } else if (size <= 1024 + 200) {
-        arrayToGetFrom = &freeBuffers1024;
-        byteCount = 1024 + 200;
-    } else if (size <= 4096 + 200) {
-        arrayToGetFrom = &freeBuffers4096;
-        byteCount = 4096 + 200;
-    } else if (size <= 16384 + 200) {
-        arrayToGetFrom = &freeBuffers16384;
-        byteCount = 16384 + 200;
-    } else if (size <= 40000) {
-        arrayToGetFrom = &freeBuffers32768;
-        byteCount = 40000;
-    } else if (size <= 160000) {
-        arrayToGetFrom = &freeBuffersBig;
-        byteCount = 160000;
-    } else {
-        buffer = new NativeByteBuffer(size);
+BuffersStorage::ThreadCache::~ThreadCache() {
+    if (owner == nullptr) {
+        return;
     }
-
-    if (arrayToGetFrom != nullptr) {
-        if (isThreadSafe) {
-            pthread_mutex_lock(&mutex);
+    for (int32_t a = 0; a < BUFFERS_STORAGE_CLASSES_COUNT; a++) {
+        while (!freeBuffers[a].empty()) {
+            NativeByteBuffer *buffer = freeBuffers[a].back();
+            freeBuffers[a].pop_back();
+            owner->returnToDepot(a, buffer, nullptr);
         }
-        if (arrayToGetFrom->size() > 0) {
-            buffer = (*arrayToGetFrom)[0];
-            arrayToGetFrom->erase(arrayToGetFrom->begin());
+    }
+}
+
+int32_t BuffersStorage::getClassForSize(uint32_t size) {
+    for (int32_t a = 0; a < BUFFERS_STORAGE_CLASSES_COUNT; a++) {
+        if (size <= classSizes[a]) {
+            return a;
         }
-        if (isThreadSafe) {
-            pthread_mutex_unlock(&mutex);
+    }
+    return -1;
+}
+
+int32_t BuffersStorage::getClassForCapacity(uint32_t capacity) {
+    int32_t sizeClass = getClassForSize(capacity);
+    return sizeClass != -1 && classSizes[sizeClass] == capacity ? sizeClass : -1;
+}
+
+BuffersStorage::ThreadCache *BuffersStorage::getThreadCache() {
+    if (!isThreadSafe) {
+        return nullptr;
+    }
+    thread_local static ThreadCache cache;
+    if (cache.owner == nullptr) {
+        cache.owner = this;
+    }
+    return cache.owner == this ? &cache : nullptr;
+}
+
+NativeByteBuffer *BuffersStorage::getFreeBuffer(uint32_t size) {
+    int32_t sizeClass = getClassForSize(size);
+    NativeByteBuffer *buffer = nullptr;
+    if (sizeClass == -1) {
+        missesCount++;
+        buffer = new NativeByteBuffer(size);
+    } else {
+        ThreadCache *cache = getThreadCache();
+        if (cache != nullptr && !cache->freeBuffers[sizeClass].empty()) {
+            buffer = cache->freeBuffers[sizeClass].back();
+            cache->freeBuffers[sizeClass].pop_back();
+        } else {
+            buffer = getFromDepot(sizeClass, cache);
         }
         if (buffer == nullptr) {
-            buffer = new NativeByteBuffer(byteCount);
-            if (LOGS_ENABLED) DEBUG_D("create new %u buffer", byteCount);
+            missesCount++;
+            buffer = new NativeByteBuffer(classSizes[sizeClass]);
+            if (LOGS_ENABLED) DEBUG_D("create new %u buffer", classSizes[sizeClass]);
+        } else {
+            hitsCount++;
+            bytesHeld -= classSizes[sizeClass];
         }
     }
     if (buffer != nullptr) {
@@ -84,40 +113,101 @@ void BuffersStorage::reuseFreeBuffer(NativeByteBuffer *buffer) {
     if (buffer == nullptr) {
         return;
     }
-    std::vector<NativeByteBuffer *> *arrayToReuse = nullptr;
-    uint32_t capacity = buffer->capacity();
-    uint32_t maxCount = 10;
-    if (capacity == 8) {
-        arrayToReuse = &freeBuffers8;
-        maxCount = 80;
-    } else if (capacity == 128) {
-        arrayToReuse = &freeBuffers128;
-        maxCount = 80;
-    } else if (capacity == 1024 + 200) {
-        arrayToReuse = &freeBuffers1024;
-    } else if (capacity == 4096 + 200) {
-        arrayToReuse = &freeBuffers4096;
-    } else if (capacity == 16384 + 200) {
-        arrayToReuse = &freeBuffers16384;
-    } else if (capacity == 40000) {
-        arrayToReuse = &freeBuffers32768;
-    } else if (capacity == 160000) {
-        arrayToReuse = &freeBuffersBig;
-    }
-    if (arrayToReuse != nullptr) {
-        if (isThreadSafe) {
-            pthread_mutex_lock(&mutex);
-        }
-        if (arrayToReuse->size() < maxCount) {
-            arrayToReuse->push_back(buffer);
-        } else {
-            if (LOGS_ENABLED) DEBUG_D("too more %d buffers", capacity);
-            delete buffer;
-        }
-        if (isThreadSafe) {
-            pthread_mutex_unlock(&mutex);
+    int32_t sizeClass = getClassForCapacity(buffer->capacity());
+    if (sizeClass == -1) {
+        delete buffer;
+        return;
+    }
+    ThreadCache *cache = getThreadCache();
+    bytesHeld += classSizes[sizeClass];
+    if (cache != nullptr && cache->freeBuffers[sizeClass].size() < threadCacheCounts[sizeClass]) {
+        cache->freeBuffers[sizeClass].push_back(buffer);
+        return;
+    }
+    returnToDepot(sizeClass, buffer, cache);
+}
+
+NativeByteBuffer *BuffersStorage::getFromDepot(int32_t sizeClass, ThreadCache *cache) {
+    NativeByteBuffer *buffer = nullptr;
+    if (isThreadSafe) {
+        pthread_mutex_lock(&mutex);
+    }
+    SizeClass &depot = classes[sizeClass];
+    size_t count = depot.freeBuffers.size();
+    if (count > 0) {
+        buffer = depot.freeBuffers.back();
+        depot.freeBuffers.pop_back();
+        count--;
+        if (cache != nullptr) {
+            size_t batch = std::min(count, (size_t) threadCacheCounts[sizeClass] / 2);
+            cache->freeBuffers[sizeClass].insert(cache->freeBuffers[sizeClass].end(), depot.freeBuffers.end() - batch, depot.freeBuffers.end());
+            depot.freeBuffers.resize(count - batch);
+            count -= batch;
         }
     } else {
-        delete buffer;
+        depot.missesCount++;
+    }
+    if (count < depot.minCount) {
+        depot.minCount = (uint32_t) count;
+    }
+    if (++depot.operationsCount >= BUFFERS_STORAGE_TRIM_INTERVAL) {
+        trimClass(sizeClass);
+    }
+    if (isThreadSafe) {
+        pthread_mutex_unlock(&mutex);
+    }
+    return buffer;
+}
+
+void BuffersStorage::returnToDepot(int32_t sizeClass, NativeByteBuffer *buffer, ThreadCache *cache) {
+    if (isThreadSafe) {
+        pthread_mutex_lock(&mutex);
+    }
+    SizeClass &depot = classes[sizeClass];
+    if (cache != nullptr) {
+        std::vector<NativeByteBuffer *> &cached = cache->freeBuffers[sizeClass];
+        size_t batch = cached.size() / 2;
+        depot.freeBuffers.insert(depot.freeBuffers.end(), cached.end() - batch, cached.end());
+        cached.resize(cached.size() - batch);
+    }
+    depot.freeBuffers.push_back(buffer);
+    uint32_t released = 0;
+    while (depot.freeBuffers.size() > depot.maxCount) {
+        delete depot.freeBuffers.back();
+        depot.freeBuffers.pop_back();
+        released++;
+    }
+    if (isThreadSafe) {
+        pthread_mutex_unlock(&mutex);
     }
+    if (released != 0) {
+        bytesHeld -= (uint64_t) released * classSizes[sizeClass];
+        if (LOGS_ENABLED) DEBUG_D("too more %u buffers", classSizes[sizeClass]);
+    }
+}
+
+void BuffersStorage::trimClass(int32_t sizeClass) {
+    SizeClass &depot = classes[sizeClass];
+    uint32_t minCount = classMinCounts[sizeClass];
+    if (depot.missesCount != 0) {
+        uint32_t limit = std::max(minCount, std::min((uint32_t) BUFFERS_STORAGE_CLASS_COUNT_LIMIT, BUFFERS_STORAGE_CLASS_BYTES_LIMIT / classSizes[sizeClass]));
+        depot.maxCount = std::min(limit, depot.maxCount + depot.missesCount);
+    } else if (depot.minCount > 1) {
+        uint32_t excess = std::min(depot.minCount / 2, (uint32_t) depot.freeBuffers.size());
+        for (uint32_t a = 0; a < excess; a++) {
+            delete depot.freeBuffers.back();
+            depot.freeBuffers.pop_back();
+        }
+        bytesHeld -= (uint64_t) excess * classSizes[sizeClass];
+        depot.maxCount = std::max(minCount, depot.maxCount - std::min(depot.maxCount, excess));
+    }
+    depot.operationsCount = 0;
+    depot.missesCount = 0;
+    depot.minCount = (uint32_t) depot.freeBuffers.size();
+}
+
+void BuffersStorage::getStats(BuffersStorageStats *stats) {
+    stats->hits = hitsCount;
+    stats->misses = missesCount;
+    stats->bytesHeld = bytesHeld;
 }
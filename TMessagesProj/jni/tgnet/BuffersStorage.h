@@ -10,29 +10,57 @@
 #define BUFFERSSTORAGE_H
 
 #include <vector>
+#include <atomic>
 #include <pthread.h>
 #include <stdint.h>
 
+#define BUFFERS_STORAGE_CLASSES_COUNT 10
+
 class NativeByteBuffer;
 
+struct BuffersStorageStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t bytesHeld;
+};
+
 class BuffersStorage {
 
 public:
     BuffersStorage(bool threadSafe);
     NativeByteBuffer *getFreeBuffer(uint32_t size);
     void reuseFreeBuffer(NativeByteBuffer *buffer);
+    void getStats(BuffersStorageStats *stats);
     static BuffersStorage &getInstance();
 
 private:
-    std::vector<NativeByteBuffer *> freeBuffers8;
-    std::vector<NativeByteBuffer *> freeBuffers128;
-    std::vector<NativeByteBuffer *> freeBuffers1024;
-    std::vector<NativeByteBuffer *> freeBuffers4096;
-    std::vector<NativeByteBuffer *> freeBuffers16384;
-    std::vector<NativeByteBuffer *> freeBuffers32768;
-    std::vector<NativeByteBuffer *> freeBuffersBig;
+    struct SizeClass {
+        std::vector<NativeByteBuffer *> freeBuffers;
+        uint32_t maxCount;
+        uint32_t operationsCount = 0;
+        uint32_t missesCount = 0;
+        uint32_t minCount = 0;
+    };
+
+    struct ThreadCache {
+        BuffersStorage *owner = nullptr;
+        std::vector<NativeByteBuffer *> freeBuffers[BUFFERS_STORAGE_CLASSES_COUNT];
+        ~ThreadCache();
+    };
+
+    static int32_t getClassForSize(uint32_t size);
+    static int32_t getClassForCapacity(uint32_t capacity);
+    ThreadCache *getThreadCache();
+    NativeByteBuffer *getFromDepot(int32_t sizeClass, ThreadCache *cache);
+    void returnToDepot(int32_t sizeClass, NativeByteBuffer *buffer, ThreadCache *cache);
+    void trimClass(int32_t sizeClass);
+
+    SizeClass classes[BUFFERS_STORAGE_CLASSES_COUNT];
     bool isThreadSafe = true;
     pthread_mutex_t mutex;
+    std::atomic<uint64_t> hitsCount{0};
+    std::atomic<uint64_t> missesCount{0};
+    std::atomic<uint64_t> bytesHeld{0};
 };
 
 #endif
@@ -25,47 +25,41 @@ void ByteStream::append(NativeByteBuffer *buffer) {
 }
 
 bool ByteStream::hasData() {
-    size_t size = buffersQueue.size();
-    for (uint32_t a = 0; a < size; a++) {
-        if (buffersQueue[a]->hasRemaining()) {
+    for (std::deque<NativeByteBuffer *>::iterator iter = buffersQueue.begin(); iter != buffersQueue.end(); iter++) {
+        if ((*iter)->hasRemaining()) {
             return true;
         }
     }
     return false;
 }
 
-void ByteStream::get(NativeByteBuffer *dst) {
-    if (dst == nullptr) {
-        return;
-    }
-
-    size_t size = buffersQueue.size();
-    NativeByteBuffer *buffer;
-    for (uint32_t a = 0; a < size; a++) {
-        buffer = buffersQueue[a];
-        if (buffer->remaining() > dst->remaining()) {
-            dst->writeBytes(buffer->bytes(), buffer->position(), dst->remaining());
-            break;
-        }
-        dst->writeBytes(buffer->bytes(), buffer->position(), buffer->remaining());
-        if (!dst->hasRemaining()) {
-            break;
+uint32_t ByteStream::get(struct iovec *iov, uint32_t count) {
+    uint32_t filled = 0;
+    for (std::deque<NativeByteBuffer *>::iterator iter = buffersQueue.begin(); iter != buffersQueue.end() && filled < count; iter++) {
+        NativeByteBuffer *buffer = *iter;
+        uint32_t remaining = buffer->remaining();
+        if (remaining == 0) {
+            continue;
         }
+        iov[filled].iov_base = buffer->bytes() + buffer->position();
+        iov[filled].iov_len = remaining;
+        filled++;
     }
+    return filled;
 }
 
 void ByteStream::discard(uint32_t count) {
     uint32_t remaining;
     NativeByteBuffer *buffer;
-    while (count > 0) {
-        buffer = buffersQueue[0];
+    while (!buffersQueue.empty()) {
+        buffer = buffersQueue.front();
         remaining = buffer->remaining();
         if (count < remaining) {
             buffer->position(buffer->position() + count);
             break;
         }
         buffer->reuse();
-        buffersQueue.erase(buffersQueue.begin());
+        buffersQueue.pop_front();
         count -= remaining;
     }
 }
@@ -74,10 +68,8 @@ void ByteStream::clean() {
     if (buffersQueue.empty()) {
         return;
     }
-    size_t size = buffersQueue.size();
-    for (uint32_t a = 0; a < size; a++) {
-        NativeByteBuffer *buffer = buffersQueue[a];
-        buffer->reuse();
+    for (std::deque<NativeByteBuffer *>::iterator iter = buffersQueue.begin(); iter != buffersQueue.end(); iter++) {
+        (*iter)->reuse();
     }
     buffersQueue.clear();
 }
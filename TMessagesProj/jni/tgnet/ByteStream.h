@@ -9,8 +9,9 @@
 #ifndef BYTESTREAM_H
 #define BYTESTREAM_H
 
-#include <vector>
+#include <deque>
 #include <stdint.h>
+#include <sys/uio.h>
 
 class NativeByteBuffer;
 
@@ -21,12 +22,12 @@ public:
     ~ByteStream();
     void append(NativeByteBuffer *buffer);
     bool hasData();
-    void get(NativeByteBuffer *dst);
+    uint32_t get(struct iovec *iov, uint32_t count);
     void discard(uint32_t count);
     void clean();
 
 private:
-    std::vector<NativeByteBuffer *> buffersQueue;
+    std::deque<NativeByteBuffer *> buffersQueue;
 };
 
 #endif
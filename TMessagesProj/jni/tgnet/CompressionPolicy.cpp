@@ -0,0 +1,100 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#include <math.h>
+#include <zlib.h>
+#include "CompressionPolicy.h"
+#include "NativeByteBuffer.h"
+#include "Defines.h"
+
+#define COMPRESSION_MIN_LENGTH 256
+#define COMPRESSION_MIN_SAVED_BYTES 64
+#define COMPRESSION_SAMPLE_CHUNKS 32
+#define COMPRESSION_SAMPLE_CHUNK_SIZE 64
+#define COMPRESSION_MAX_ENTROPY 7.2f
+#define COMPRESSION_HISTORY_MIN_SAMPLES 4
+#define COMPRESSION_PROBE_INTERVAL 32
+
+int32_t CompressionPolicy::getCompressionLevel(uint32_t requestType, NativeByteBuffer *payload, uint32_t length, int32_t networkType, bool networkSlow) {
+    if (length < COMPRESSION_MIN_LENGTH) {
+        skippedCount++;
+        return 0;
+    }
+    TypeHistory &typeHistory = history[requestType];
+    if (typeHistory.samplesCount >= COMPRESSION_HISTORY_MIN_SAMPLES) {
+        if (length * (1.0f - typeHistory.ratio) < COMPRESSION_MIN_SAVED_BYTES && ++typeHistory.skippedCount < COMPRESSION_PROBE_INTERVAL) {
+            skippedCount++;
+            return 0;
+        }
+    } else if (payload != nullptr && estimateEntropy(payload->bytes(), payload->limit()) > COMPRESSION_MAX_ENTROPY) {
+        typeHistory.ratio = 1.0f;
+        typeHistory.samplesCount++;
+        skippedCount++;
+        return 0;
+    }
+    typeHistory.skippedCount = 0;
+    if (networkSlow || networkType == NETWORK_TYPE_ROAMING) {
+        return Z_BEST_COMPRESSION;
+    } else if (networkType == NETWORK_TYPE_MOBILE) {
+        return 6;
+    }
+    return Z_BEST_SPEED;
+}
+
+void CompressionPolicy::onCompressed(uint32_t requestType, uint32_t length, uint32_t compressedLength, int64_t cpuTime) {
+    TypeHistory &typeHistory = history[requestType];
+    float ratio = compressedLength >= length ? 1.0f : (float) compressedLength / length;
+    if (typeHistory.samplesCount == 0) {
+        typeHistory.ratio = ratio;
+    } else {
+        typeHistory.ratio = typeHistory.ratio * 0.75f + ratio * 0.25f;
+    }
+    typeHistory.samplesCount++;
+    compressedCount++;
+    bytesIn += length;
+    if (compressedLength < length) {
+        bytesSaved += length - compressedLength;
+    }
+    cpuTimeMicros += (uint64_t) cpuTime;
+}
+
+void CompressionPolicy::getStats(CompressionStats *stats) {
+    stats->compressedCount = compressedCount;
+    stats->skippedCount = skippedCount;
+    stats->bytesIn = bytesIn;
+    stats->bytesSaved = bytesSaved;
+    stats->cpuTimeMicros = cpuTimeMicros;
+}
+
+float CompressionPolicy::estimateEntropy(uint8_t *bytes, uint32_t length) {
+    uint32_t counts[256] = {0};
+    uint32_t total = 0;
+    if (length <= COMPRESSION_SAMPLE_CHUNKS * COMPRESSION_SAMPLE_CHUNK_SIZE) {
+        for (uint32_t a = 0; a < length; a++) {
+            counts[bytes[a]]++;
+        }
+        total = length;
+    } else {
+        uint32_t step = length / COMPRESSION_SAMPLE_CHUNKS;
+        for (uint32_t a = 0; a < COMPRESSION_SAMPLE_CHUNKS; a++) {
+            uint8_t *chunk = bytes + a * step;
+            for (uint32_t b = 0; b < COMPRESSION_SAMPLE_CHUNK_SIZE; b++) {
+                counts[chunk[b]]++;
+            }
+        }
+        total = COMPRESSION_SAMPLE_CHUNKS * COMPRESSION_SAMPLE_CHUNK_SIZE;
+    }
+    float entropy = 0.0f;
+    for (uint32_t a = 0; a < 256; a++) {
+        if (counts[a] != 0) {
+            float p = (float) counts[a] / total;
+            entropy -= p * log2f(p);
+        }
+    }
+    return entropy;
+}
@@ -0,0 +1,50 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#ifndef COMPRESSIONPOLICY_H
+#define COMPRESSIONPOLICY_H
+
+#include <stdint.h>
+#include <atomic>
+#include <unordered_map>
+
+class NativeByteBuffer;
+
+struct CompressionStats {
+    uint64_t compressedCount;
+    uint64_t skippedCount;
+    uint64_t bytesIn;
+    uint64_t bytesSaved;
+    uint64_t cpuTimeMicros;
+};
+
+class CompressionPolicy {
+
+public:
+    int32_t getCompressionLevel(uint32_t requestType, NativeByteBuffer *payload, uint32_t length, int32_t networkType, bool networkSlow);
+    void onCompressed(uint32_t requestType, uint32_t length, uint32_t compressedLength, int64_t cpuTime);
+    void getStats(CompressionStats *stats);
+
+private:
+    struct TypeHistory {
+        float ratio = 0.0f;
+        uint32_t samplesCount = 0;
+        uint32_t skippedCount = 0;
+    };
+
+    static float estimateEntropy(uint8_t *bytes, uint32_t length);
+
+    std::unordered_map<uint32_t, TypeHistory> history;
+    std::atomic<uint64_t> compressedCount{0};
+    std::atomic<uint64_t> skippedCount{0};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesSaved{0};
+    std::atomic<uint64_t> cpuTimeMicros{0};
+};
+
+#endif
@@ -40,6 +40,7 @@ Connection::~Connection() {
         delete reconnectTimer;
         reconnectTimer = nullptr;
     }
+    clearPendingPackets();
 }
 
 void Connection::suspendConnection() {
@@ -61,18 +62,32 @@ void Connection::suspendConnection(bool idle) {
         restOfTheData->reuse();
         restOfTheData = nullptr;
     }
+    clearPendingPackets();
     lastPacketLength = 0;
     connectionToken = 0;
     wasConnected = false;
 }
 
-void Connection::onReceivedData(NativeByteBuffer *buffer) {
-    AES_ctr128_encrypt(buffer->bytes(), buffer->bytes(), buffer->limit(), &decryptKey, decryptIv, decryptCount, &decryptNum);
-    
+void Connection::clearPendingPackets() {
+    for (std::deque<EncryptedPacket *>::iterator iter = pendingPackets.begin(); iter != pendingPackets.end(); iter++) {
+        EncryptedPacket *packet = *iter;
+        if (packet->inFlight) {
+            packet->discarded = true;
+        } else {
+            packet->buffer->reuse();
+            delete packet;
+        }
+    }
+    pendingPackets.clear();
+}
+
+void Connection::onReceivedBytes(uint8_t *data, uint32_t length) {
+    AES_ctr128_encrypt(data, data, length, &decryptKey, decryptIv, decryptCount, &decryptNum);
+
     failedConnectionCount = 0;
 
     if (connectionType == ConnectionTypeGeneric || connectionType == ConnectionTypeTemp || connectionType == ConnectionTypeGenericMedia) {
-        receivedDataAmount += buffer->limit();
+        receivedDataAmount += length;
         if (receivedDataAmount >= 512 * 1024) {
             if (currentTimeout > 4) {
                 currentTimeout -= 2;
@@ -81,6 +96,26 @@ void Connection::onReceivedData(NativeByteBuffer *buffer) {
             receivedDataAmount = 0;
         }
     }
+}
+
+uint8_t *Connection::getReceiveFrameBuffer(uint32_t *length) {
+    if (restOfTheData == nullptr || lastPacketLength == 0 || restOfTheData->position() >= lastPacketLength) {
+        return nullptr;
+    }
+    *length = lastPacketLength - restOfTheData->position();
+    return restOfTheData->bytes() + restOfTheData->position();
+}
+
+void Connection::onReceivedFrameData(uint32_t length) {
+    onReceivedBytes(restOfTheData->bytes() + restOfTheData->position(), length);
+    restOfTheData->position(restOfTheData->position() + length);
+    if (restOfTheData->position() == lastPacketLength) {
+        parseReceivedData(restOfTheData, nullptr);
+    }
+}
+
+void Connection::onReceivedData(NativeByteBuffer *buffer) {
+    onReceivedBytes(buffer->bytes(), buffer->limit());
 
     NativeByteBuffer *parseLaterBuffer = nullptr;
     if (restOfTheData != nullptr) {
@@ -119,6 +154,10 @@ void Connection::onReceivedData(NativeByteBuffer *buffer) {
         }
     }
 
+    parseReceivedData(buffer, parseLaterBuffer);
+}
+
+void Connection::parseReceivedData(NativeByteBuffer *buffer, NativeByteBuffer *parseLaterBuffer) {
     buffer->rewind();
 
     while (buffer->hasRemaining()) {
@@ -255,7 +294,9 @@ void Connection::onReceivedData(NativeByteBuffer *buffer) {
 
         uint32_t old = buffer->limit();
         buffer->limit(buffer->position() + currentPacketLength);
+        buffer->setSlicesAllowed(buffer == restOfTheData && lastPacketLength != 0);
         ConnectionsManager::getInstance(currentDatacenter->instanceNum).onConnectionDataReceived(this, buffer, currentPacketLength);
+        buffer->setSlicesAllowed(false);
         buffer->position(buffer->limit());
         buffer->limit(old);
 
@@ -344,6 +385,7 @@ void Connection::connect() {
         restOfTheData->reuse();
         restOfTheData = nullptr;
     }
+    clearPendingPackets();
     lastPacketLength = 0;
     wasConnected = false;
     hasSomeDataSinceLastConnect = false;
@@ -657,6 +699,7 @@ void Connection::onDisconnected(int32_t reason, int32_t error) {
         restOfTheData->reuse();
         restOfTheData = nullptr;
     }
+    clearPendingPackets();
     lastPacketLength = 0;
     receivedDataAmount = 0;
     wasConnected = false;
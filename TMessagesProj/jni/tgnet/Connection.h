@@ -11,6 +11,7 @@
 
 #include <pthread.h>
 #include <vector>
+#include <deque>
 #include <string>
 #include <openssl/aes.h>
 #include "ConnectionSession.h"
@@ -46,12 +47,17 @@ public:
 protected:
 
     void onReceivedData(NativeByteBuffer *buffer) override;
+    uint8_t *getReceiveFrameBuffer(uint32_t *length) override;
+    void onReceivedFrameData(uint32_t length) override;
     void onDisconnected(int32_t reason, int32_t error) override;
     void onConnected() override;
     bool hasPendingRequests() override;
     void reconnect();
 
 private:
+    void onReceivedBytes(uint8_t *data, uint32_t length);
+    void parseReceivedData(NativeByteBuffer *buffer, NativeByteBuffer *parseLaterBuffer);
+    void clearPendingPackets();
 
     enum TcpConnectionState {
         TcpConnectionStageIdle,
@@ -85,6 +91,7 @@ private:
     bool firstPacketSent = false;
     NativeByteBuffer *restOfTheData = nullptr;
     uint32_t lastPacketLength = 0;
+    std::deque<EncryptedPacket *> pendingPackets;
     bool hasSomeDataSinceLastConnect = false;
     bool isTryingNextPort = false;
     bool wasConnected = false;
@@ -13,13 +13,100 @@
 #include "ConnectionsManager.h"
 #include "NativeByteBuffer.h"
 
-ConnectionSession::ConnectionSession(int32_t instance) {
+MessageIdsSet::MessageIdsSet(uint32_t capacity) {
+    slots.resize(capacity, 0);
+    mask = capacity - 1;
+}
+
+uint32_t MessageIdsSet::slotFor(int64_t messageId) {
+    return (uint32_t) (((uint64_t) messageId * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+}
+
+bool MessageIdsSet::contains(int64_t messageId) {
+    if (messageId == 0) {
+        return hasZero;
+    }
+    for (uint32_t slot = slotFor(messageId); slots[slot] != 0; slot = (slot + 1) & mask) {
+        if (slots[slot] == messageId) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MessageIdsSet::insert(int64_t messageId) {
+    if (messageId == 0) {
+        bool inserted = !hasZero;
+        hasZero = true;
+        return inserted;
+    }
+    if ((count + 1) * 4 > (mask + 1) * 3) {
+        grow();
+    }
+    uint32_t slot = slotFor(messageId);
+    for (; slots[slot] != 0; slot = (slot + 1) & mask) {
+        if (slots[slot] == messageId) {
+            return false;
+        }
+    }
+    slots[slot] = messageId;
+    count++;
+    return true;
+}
+
+void MessageIdsSet::erase(int64_t messageId) {
+    if (messageId == 0) {
+        hasZero = false;
+        return;
+    }
+    uint32_t slot = slotFor(messageId);
+    for (; slots[slot] != messageId; slot = (slot + 1) & mask) {
+        if (slots[slot] == 0) {
+            return;
+        }
+    }
+    for (uint32_t next = (slot + 1) & mask; slots[next] != 0; next = (next + 1) & mask) {
+        uint32_t home = slotFor(slots[next]);
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            slots[slot] = slots[next];
+            slot = next;
+        }
+    }
+    slots[slot] = 0;
+    count--;
+}
+
+void MessageIdsSet::clear() {
+    hasZero = false;
+    if (count != 0) {
+        std::fill(slots.begin(), slots.end(), 0);
+        count = 0;
+    }
+}
+
+void MessageIdsSet::grow() {
+    std::vector<int64_t> oldSlots;
+    oldSlots.swap(slots);
+    slots.resize(oldSlots.size() * 2, 0);
+    mask = (uint32_t) slots.size() - 1;
+    count = 0;
+    for (std::vector<int64_t>::iterator iter = oldSlots.begin(); iter != oldSlots.end(); iter++) {
+        if (*iter != 0) {
+            insert(*iter);
+        }
+    }
+}
+
+ConnectionSession::ConnectionSession(int32_t instance) : processedMessageIdsSet(512), messagesIdsForConfirmationSet(64) {
     instanceNum = instance;
 }
 
 void ConnectionSession::recreateSession() {
-    processedMessageIds.clear();
+    processedMessageIdsHead = 0;
+    processedMessageIdsCount = 0;
+    processedMessageIdsSet.clear();
     messagesIdsForConfirmation.clear();
+    messagesIdsForConfirmationSet.clear();
     processedSessionChanges.clear();
     nextSeqNo = 0;
 
@@ -56,22 +143,30 @@ int32_t ConnectionSession::isMessageIdProcessed(int64_t messageId) {
     if (!(messageId & 1)) {
         return 1;
     }
-    if (minProcessedMessageId != 0 && messageId < minProcessedMessageId) {
+    if (minProcessedMessageId != 0 && messageId <= minProcessedMessageId) {
         return 2;
     }
-    if (std::find(processedMessageIds.begin(), processedMessageIds.end(), messageId) != processedMessageIds.end()) {
+    if (processedMessageIdsSet.contains(messageId)) {
         return 1;
     }
     return 0;
 }
 
 void ConnectionSession::addProcessedMessageId(int64_t messageId) {
-    if (processedMessageIds.size() > 300) {
-        std::sort(processedMessageIds.begin(), processedMessageIds.end());
-        processedMessageIds.erase(processedMessageIds.begin(), processedMessageIds.begin() + 100);
-        minProcessedMessageId = *(processedMessageIds.begin());
+    if (!processedMessageIdsSet.insert(messageId)) {
+        return;
+    }
+    if (processedMessageIdsCount == PROCESSED_MESSAGE_IDS_COUNT) {
+        int64_t oldestMessageId = processedMessageIds[processedMessageIdsHead];
+        processedMessageIdsSet.erase(oldestMessageId);
+        if (oldestMessageId > minProcessedMessageId) {
+            minProcessedMessageId = oldestMessageId;
+        }
+    } else {
+        processedMessageIdsCount++;
     }
-    processedMessageIds.push_back(messageId);
+    processedMessageIds[processedMessageIdsHead] = messageId;
+    processedMessageIdsHead = (processedMessageIdsHead + 1) % PROCESSED_MESSAGE_IDS_COUNT;
 }
 
 bool ConnectionSession::hasMessagesToConfirm() {
@@ -79,10 +174,9 @@ bool ConnectionSession::hasMessagesToConfirm() {
 }
 
 void ConnectionSession::addMessageToConfirm(int64_t messageId) {
-    if (std::find(messagesIdsForConfirmation.begin(), messagesIdsForConfirmation.end(), messageId) != messagesIdsForConfirmation.end()) {
-        return;
+    if (messagesIdsForConfirmationSet.insert(messageId)) {
+        messagesIdsForConfirmation.push_back(messageId);
     }
-    messagesIdsForConfirmation.push_back(messageId);
 }
 
 NetworkMessage *ConnectionSession::generateConfirmationRequest() {
@@ -91,15 +185,14 @@ NetworkMessage *ConnectionSession::generateConfirmationRequest() {
     if (!messagesIdsForConfirmation.empty()) {
         TL_msgs_ack *msgAck = new TL_msgs_ack();
         msgAck->msg_ids.insert(msgAck->msg_ids.begin(), messagesIdsForConfirmation.begin(), messagesIdsForConfirmation.end());
-        NativeByteBuffer *os = new NativeByteBuffer(true);
-        msgAck->serializeToStream(os);
         networkMessage = new NetworkMessage();
         networkMessage->message = std::unique_ptr<TL_message>(new TL_message);
         networkMessage->message->msg_id = ConnectionsManager::getInstance(instanceNum).generateMessageId();
         networkMessage->message->seqno = generateMessageSeqNo(false);
-        networkMessage->message->bytes = os->capacity();
+        networkMessage->message->bytes = msgAck->getObjectSize();
         networkMessage->message->body = std::unique_ptr<TLObject>(msgAck);
         messagesIdsForConfirmation.clear();
+        messagesIdsForConfirmationSet.clear();
     }
 
     return networkMessage;
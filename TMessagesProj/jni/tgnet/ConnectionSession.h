@@ -13,6 +13,27 @@
 #include <vector>
 #include "Defines.h"
 
+#define PROCESSED_MESSAGE_IDS_COUNT 300
+
+class MessageIdsSet {
+
+public:
+    MessageIdsSet(uint32_t capacity);
+    bool contains(int64_t messageId);
+    bool insert(int64_t messageId);
+    void erase(int64_t messageId);
+    void clear();
+
+private:
+    uint32_t slotFor(int64_t messageId);
+    void grow();
+
+    std::vector<int64_t> slots;
+    uint32_t mask;
+    uint32_t count = 0;
+    bool hasZero = false;
+};
+
 class ConnectionSession {
 
 public:
@@ -36,8 +57,12 @@ private:
     uint32_t nextSeqNo = 0;
     int64_t minProcessedMessageId = 0;
 
-    std::vector<int64_t> processedMessageIds;
+    int64_t processedMessageIds[PROCESSED_MESSAGE_IDS_COUNT];
+    uint32_t processedMessageIdsHead = 0;
+    uint32_t processedMessageIdsCount = 0;
+    MessageIdsSet processedMessageIdsSet;
     std::vector<int64_t> messagesIdsForConfirmation;
+    MessageIdsSet messagesIdsForConfirmationSet;
     std::vector<int64_t> processedSessionChanges;
 };
 
@@ -23,11 +23,14 @@
 #include "Timer.h"
 #include "NativeByteBuffer.h"
 #include "BuffersStorage.h"
+#include "NetworkReactor.h"
 
 #ifndef EPOLLRDHUP
 #define EPOLLRDHUP 0x2000
 #endif
 
+#define SOCKET_SEND_IOV_COUNT 64
+
 ConnectionSocket::ConnectionSocket(int32_t instance) {
     instanceNum = instance;
     outgoingByteStream = new ByteStream();
@@ -36,6 +39,9 @@ ConnectionSocket::ConnectionSocket(int32_t instance) {
 }
 
 ConnectionSocket::~ConnectionSocket() {
+    if (flushScheduled) {
+        ConnectionsManager::getInstance(instanceNum).detachConnection(this);
+    }
     if (outgoingByteStream != nullptr) {
         delete outgoingByteStream;
         outgoingByteStream = nullptr;
@@ -51,7 +57,6 @@ void ConnectionSocket::openConnection(std::string address, uint16_t port, bool i
     isIpv6 = ipv6;
     currentAddress = address;
     currentPort = port;
-    int epolFd = ConnectionsManager::getInstance(instanceNum).epolFd;
     ConnectionsManager::getInstance(instanceNum).attachConnection(this);
 
     memset(&socketAddress, 0, sizeof(sockaddr_in));
@@ -166,7 +171,7 @@ void ConnectionSocket::openConnection(std::string address, uint16_t port, bool i
     } else {
         eventMask.events = EPOLLOUT | EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLET;
         eventMask.data.ptr = eventObject;
-        if (epoll_ctl(epolFd, EPOLL_CTL_ADD, socketFd, &eventMask) != 0) {
+        if (ConnectionsManager::getInstance(instanceNum).reactor->control(EPOLL_CTL_ADD, socketFd, &eventMask) != 0) {
             if (LOGS_ENABLED) DEBUG_E("connection(%p) epoll_ctl, adding socket failed", this);
             closeSocket(1, -1);
         }
@@ -192,11 +197,12 @@ void ConnectionSocket::closeSocket(int32_t reason, int32_t error) {
     lastEventTime = ConnectionsManager::getInstance(instanceNum).getCurrentTimeMonotonicMillis();
     ConnectionsManager::getInstance(instanceNum).detachConnection(this);
     if (socketFd >= 0) {
-        epoll_ctl(ConnectionsManager::getInstance(instanceNum).epolFd, EPOLL_CTL_DEL, socketFd, NULL);
+        ConnectionsManager::getInstance(instanceNum).reactor->control(EPOLL_CTL_DEL, socketFd, NULL);
         if (close(socketFd) != 0) {
             if (LOGS_ENABLED) DEBUG_E("connection(%p) unable to close socket", this);
         }
         socketFd = -1;
+        socketGeneration++;
     }
     proxyAuthState = 0;
     onConnectedSent = false;
@@ -213,10 +219,41 @@ void ConnectionSocket::onEvent(uint32_t events) {
         } else {
             ssize_t readCount;
             NativeByteBuffer *buffer = ConnectionsManager::getInstance(instanceNum).networkBuffer;
+            uint32_t generation = socketGeneration;
             while (true) {
+                uint32_t frameLength;
+                uint8_t *frameBuffer = proxyAuthState == 0 ? getReceiveFrameBuffer(&frameLength) : nullptr;
+                if (frameBuffer != nullptr) {
+                    readCount = recv(socketFd, frameBuffer, frameLength, 0);
+                    if (readCount < 0) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                            break;
+                        }
+                        closeSocket(1, -1);
+                        if (LOGS_ENABLED) DEBUG_E("connection(%p) recv failed", this);
+                        return;
+                    }
+                    if (readCount > 0) {
+                        lastEventTime = ConnectionsManager::getInstance(instanceNum).getCurrentTimeMonotonicMillis();
+                        if (ConnectionsManager::getInstance(instanceNum).delegate != nullptr) {
+                            ConnectionsManager::getInstance(instanceNum).delegate->onBytesReceived((int32_t) readCount, currentNetworkType, instanceNum);
+                        }
+                        onReceivedFrameData((uint32_t) readCount);
+                        if (socketFd < 0 || generation != socketGeneration) {
+                            return;
+                        }
+                    }
+                    if (readCount != frameLength) {
+                        break;
+                    }
+                    continue;
+                }
                 buffer->rewind();
                 readCount = recv(socketFd, buffer->bytes(), READ_BUFFER_SIZE, 0);
                 if (readCount < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        break;
+                    }
                     closeSocket(1, -1);
                     if (LOGS_ENABLED) DEBUG_E("connection(%p) recv failed", this);
                     return;
@@ -224,57 +261,9 @@ void ConnectionSocket::onEvent(uint32_t events) {
                 if (readCount > 0) {
                     buffer->limit((uint32_t) readCount);
                     lastEventTime = ConnectionsManager::getInstance(instanceNum).getCurrentTimeMonotonicMillis();
-                    if (proxyAuthState == 2) {
-                        if (readCount == 2) {
-                            uint8_t auth_method = buffer->bytes()[1];
-                            if (auth_method == 0xff) {
-                                closeSocket(1, -1);
-                                if (LOGS_ENABLED) DEBUG_E("connection(%p) unsupported proxy auth method", this);
-                            } else if (auth_method == 0x02) {
-                                if (LOGS_ENABLED) DEBUG_D("connection(%p) proxy auth required", this);
-                                proxyAuthState = 3;
-                            } else if (auth_method == 0x00) {
-                                proxyAuthState = 5;
-                            }
-                            adjustWriteOp();
-                        } else {
-                            closeSocket(1, -1);
-                            if (LOGS_ENABLED) DEBUG_E("connection(%p) invalid proxy response on state 2", this);
-                        }
-                    } else if (proxyAuthState == 4) {
-                        if (readCount == 2) {
-                            uint8_t auth_method = buffer->bytes()[1];
-                            if (auth_method != 0x00) {
-                                closeSocket(1, -1);
-                                if (LOGS_ENABLED) DEBUG_E("connection(%p) auth invalid", this);
-                            } else {
-                                proxyAuthState = 5;
-                            }
-                            adjustWriteOp();
-                        } else {
-                            closeSocket(1, -1);
-                            if (LOGS_ENABLED) DEBUG_E("connection(%p) invalid proxy response on state 4", this);
-                        }
-                    } else if (proxyAuthState == 6) {
-                        if (readCount > 2) {
-                            uint8_t status = buffer->bytes()[1];
-                            if (status == 0x00) {
-                                if (LOGS_ENABLED) DEBUG_D("connection(%p) connected via proxy", this);
-                                proxyAuthState = 0;
-                                adjustWriteOp();
-                            } else {
-                                closeSocket(1, -1);
-                                if (LOGS_ENABLED) DEBUG_E("connection(%p) invalid proxy status on state 6, 0x%x", this, status);
-                            }
-                        } else {
-                            closeSocket(1, -1);
-                            if (LOGS_ENABLED) DEBUG_E("connection(%p) invalid proxy response on state 6", this);
-                        }
-                    } else if (proxyAuthState == 0) {
-                        if (ConnectionsManager::getInstance(instanceNum).delegate != nullptr) {
-                            ConnectionsManager::getInstance(instanceNum).delegate->onBytesReceived((int32_t) readCount, currentNetworkType, instanceNum);
-                        }
-                        onReceivedData(buffer);
+                    processReceivedBuffer(buffer);
+                    if (socketFd < 0 || generation != socketGeneration) {
+                        return;
                     }
                 }
                 if (readCount != READ_BUFFER_SIZE) {
@@ -350,26 +339,10 @@ void ConnectionSocket::onEvent(uint32_t events) {
                     onConnected();
                     onConnectedSent = true;
                 }
-                NativeByteBuffer *buffer = ConnectionsManager::getInstance(instanceNum).networkBuffer;
-                buffer->clear();
-                outgoingByteStream->get(buffer);
-                buffer->flip();
-
-                uint32_t remaining = buffer->remaining();
-                if (remaining) {
-                    ssize_t sentLength;
-                    if ((sentLength = send(socketFd, buffer->bytes(), remaining, 0)) < 0) {
-                        if (LOGS_ENABLED) DEBUG_E("connection(%p) send failed", this);
-                        closeSocket(1, -1);
-                        return;
-                    } else {
-                        if (ConnectionsManager::getInstance(instanceNum).delegate != nullptr) {
-                            ConnectionsManager::getInstance(instanceNum).delegate->onBytesSent((int32_t) sentLength, currentNetworkType, instanceNum);
-                        }
-                        outgoingByteStream->discard((uint32_t) sentLength);
-                        adjustWriteOp();
-                    }
+                if (!sendOutgoingData()) {
+                    return;
                 }
+                updateWriteOp();
             }
         }
     }
@@ -388,16 +361,156 @@ void ConnectionSocket::onEvent(uint32_t events) {
     }
 }
 
+void ConnectionSocket::onReceivedRingData(uint8_t *data, uint32_t length) {
+    if (socketFd < 0) {
+        return;
+    }
+    lastEventTime = ConnectionsManager::getInstance(instanceNum).getCurrentTimeMonotonicMillis();
+    NativeByteBuffer *buffer = ConnectionsManager::getInstance(instanceNum).networkBuffer;
+    uint32_t generation = socketGeneration;
+    while (length > 0) {
+        uint32_t frameLength = 0;
+        uint8_t *frameBuffer = proxyAuthState == 0 ? getReceiveFrameBuffer(&frameLength) : nullptr;
+        uint32_t count;
+        if (frameBuffer != nullptr && frameLength != 0) {
+            count = std::min(length, frameLength);
+            memcpy(frameBuffer, data, count);
+            if (ConnectionsManager::getInstance(instanceNum).delegate != nullptr) {
+                ConnectionsManager::getInstance(instanceNum).delegate->onBytesReceived((int32_t) count, currentNetworkType, instanceNum);
+            }
+            onReceivedFrameData(count);
+        } else {
+            count = std::min(length, (uint32_t) READ_BUFFER_SIZE);
+            buffer->rewind();
+            memcpy(buffer->bytes(), data, count);
+            buffer->limit(count);
+            processReceivedBuffer(buffer);
+        }
+        if (socketFd < 0 || generation != socketGeneration) {
+            return;
+        }
+        data += count;
+        length -= count;
+    }
+}
+
+void ConnectionSocket::processReceivedBuffer(NativeByteBuffer *buffer) {
+    if (proxyAuthState == 2) {
+        if (buffer->limit() == 2) {
+            uint8_t auth_method = buffer->bytes()[1];
+            if (auth_method == 0xff) {
+                closeSocket(1, -1);
+                if (LOGS_ENABLED) DEBUG_E("connection(%p) unsupported proxy auth method", this);
+            } else if (auth_method == 0x02) {
+                if (LOGS_ENABLED) DEBUG_D("connection(%p) proxy auth required", this);
+                proxyAuthState = 3;
+            } else if (auth_method == 0x00) {
+                proxyAuthState = 5;
+            }
+            adjustWriteOp();
+        } else {
+            closeSocket(1, -1);
+            if (LOGS_ENABLED) DEBUG_E("connection(%p) invalid proxy response on state 2", this);
+        }
+    } else if (proxyAuthState == 4) {
+        if (buffer->limit() == 2) {
+            uint8_t auth_method = buffer->bytes()[1];
+            if (auth_method != 0x00) {
+                closeSocket(1, -1);
+                if (LOGS_ENABLED) DEBUG_E("connection(%p) auth invalid", this);
+            } else {
+                proxyAuthState = 5;
+            }
+            adjustWriteOp();
+        } else {
+            closeSocket(1, -1);
+            if (LOGS_ENABLED) DEBUG_E("connection(%p) invalid proxy response on state 4", this);
+        }
+    } else if (proxyAuthState == 6) {
+        if (buffer->limit() > 2) {
+            uint8_t status = buffer->bytes()[1];
+            if (status == 0x00) {
+                if (LOGS_ENABLED) DEBUG_D("connection(%p) connected via proxy", this);
+                proxyAuthState = 0;
+                adjustWriteOp();
+            } else {
+                closeSocket(1, -1);
+                if (LOGS_ENABLED) DEBUG_E("connection(%p) invalid proxy status on state 6, 0x%x", this, status);
+            }
+        } else {
+            closeSocket(1, -1);
+            if (LOGS_ENABLED) DEBUG_E("connection(%p) invalid proxy response on state 6", this);
+        }
+    } else if (proxyAuthState == 0) {
+        if (ConnectionsManager::getInstance(instanceNum).delegate != nullptr) {
+            ConnectionsManager::getInstance(instanceNum).delegate->onBytesReceived((int32_t) buffer->limit(), currentNetworkType, instanceNum);
+        }
+        onReceivedData(buffer);
+    }
+}
+
 void ConnectionSocket::writeBuffer(uint8_t *data, uint32_t size) {
     NativeByteBuffer *buffer = BuffersStorage::getInstance().getFreeBuffer(size);
     buffer->writeBytes(data, size);
-    outgoingByteStream->append(buffer);
-    adjustWriteOp();
+    writeBuffer(buffer);
 }
 
 void ConnectionSocket::writeBuffer(NativeByteBuffer *buffer) {
     outgoingByteStream->append(buffer);
-    adjustWriteOp();
+    if (proxyAuthState == 0 && onConnectedSent && socketFd >= 0) {
+        ConnectionsManager::getInstance(instanceNum).scheduleSocketFlush(this);
+    } else {
+        adjustWriteOp();
+    }
+}
+
+void ConnectionSocket::flushOutgoingData() {
+    flushScheduled = false;
+    if (socketFd < 0 || proxyAuthState != 0 || !onConnectedSent) {
+        return;
+    }
+    if (sendOutgoingData()) {
+        updateWriteOp();
+    }
+}
+
+bool ConnectionSocket::sendOutgoingData() {
+    struct iovec iov[SOCKET_SEND_IOV_COUNT];
+    struct msghdr message;
+    memset(&message, 0, sizeof(struct msghdr));
+    message.msg_iov = iov;
+    while (true) {
+        message.msg_iovlen = outgoingByteStream->get(iov, SOCKET_SEND_IOV_COUNT);
+        if (message.msg_iovlen == 0) {
+            return true;
+        }
+        size_t length = 0;
+        for (size_t a = 0; a < message.msg_iovlen; a++) {
+            length += iov[a].iov_len;
+        }
+        ssize_t sentLength;
+        if ((sentLength = sendmsg(socketFd, &message, 0)) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            if (LOGS_ENABLED) DEBUG_E("connection(%p) send failed", this);
+            closeSocket(1, -1);
+            return false;
+        }
+        if (ConnectionsManager::getInstance(instanceNum).delegate != nullptr) {
+            ConnectionsManager::getInstance(instanceNum).delegate->onBytesSent((int32_t) sentLength, currentNetworkType, instanceNum);
+        }
+        outgoingByteStream->discard((uint32_t) sentLength);
+        if ((size_t) sentLength != length) {
+            return true;
+        }
+    }
+}
+
+void ConnectionSocket::updateWriteOp() {
+    if (((eventMask.events & EPOLLOUT) != 0) != outgoingByteStream->hasData()) {
+        adjustWriteOp();
+    }
 }
 
 void ConnectionSocket::adjustWriteOp() {
@@ -406,7 +519,7 @@ void ConnectionSocket::adjustWriteOp() {
         eventMask.events |= EPOLLOUT;
     }
     eventMask.data.ptr = eventObject;
-    if (epoll_ctl(ConnectionsManager::getInstance(instanceNum).epolFd, EPOLL_CTL_MOD, socketFd, &eventMask) != 0) {
+    if (ConnectionsManager::getInstance(instanceNum).reactor->control(EPOLL_CTL_MOD, socketFd, &eventMask) != 0) {
         if (LOGS_ENABLED) DEBUG_E("connection(%p) epoll_ctl, modify socket failed", this);
         closeSocket(1, -1);
     }
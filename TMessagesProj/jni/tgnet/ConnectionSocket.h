@@ -36,8 +36,11 @@ public:
 protected:
     int32_t instanceNum;
     void onEvent(uint32_t events);
+    void onReceivedRingData(uint8_t *data, uint32_t length);
     void checkTimeout(int64_t now);
     virtual void onReceivedData(NativeByteBuffer *buffer) = 0;
+    virtual uint8_t *getReceiveFrameBuffer(uint32_t *length) = 0;
+    virtual void onReceivedFrameData(uint32_t length) = 0;
     virtual void onDisconnected(int32_t reason, int32_t error) = 0;
     virtual void onConnected() = 0;
     virtual bool hasPendingRequests() = 0;
@@ -54,6 +57,7 @@ private:
     struct sockaddr_in socketAddress;
     struct sockaddr_in6 socketAddress6;
     int socketFd = -1;
+    uint32_t socketGeneration = 0;
     time_t timeout = 12;
     bool onConnectedSent = false;
     int64_t lastEventTime = 0;
@@ -66,10 +70,15 @@ private:
     uint8_t buffer[1024];
 
     uint8_t proxyAuthState;
+    bool flushScheduled = false;
 
     int32_t checkSocketError(int32_t *error);
     void closeSocket(int32_t reason, int32_t error);
+    void processReceivedBuffer(NativeByteBuffer *buffer);
     void adjustWriteOp();
+    void updateWriteOp();
+    void flushOutgoingData();
+    bool sendOutgoingData();
 
     friend class EventObject;
     friend class ConnectionsManager;
@@ -30,185 +30,88 @@
 #include "ByteArray.h"
 #include "Config.h"
 #include "ProxyCheckInfo.h"
+#include "NetworkReactor.h"
+#include "CryptoWorkerPool.h"
 
 #ifdef ANDROID
 #include <jni.h>
 JavaVM *javaVm = nullptr;
-JNIEnv *jniEnv[MAX_ACCOUNT_COUNT];
+JNIEnv *jniEnv[MAX_INSTANCE_COUNT];
 jclass jclass_ByteBuffer = nullptr;
 jmethodID jclass_ByteBuffer_allocateDirect = 0;
+jmethodID jclass_ByteBuffer_duplicate = 0;
+jmethodID jclass_ByteBuffer_slice = 0;
+jmethodID jclass_Buffer_position = 0;
+jmethodID jclass_Buffer_limit = 0;
 #endif
 
-static bool done = false;
+static std::atomic<ConnectionsManager *> instances[MAX_INSTANCE_COUNT];
+static pthread_mutex_t instancesMutex = PTHREAD_MUTEX_INITIALIZER;
 
-ConnectionsManager::ConnectionsManager(int32_t instance) {
+ConnectionsManager::ConnectionsManager(int32_t instance) : downloadScheduler(this) {
     instanceNum = instance;
-    if ((epolFd = epoll_create(128)) == -1) {
-        if (LOGS_ENABLED) DEBUG_E("unable to create epoll instance");
-        exit(1);
-    }
-    int flags;
-    if ((flags = fcntl(epolFd, F_GETFD, NULL)) < 0) {
-        if (LOGS_ENABLED) DEBUG_W("fcntl(%d, F_GETFD)", epolFd);
-    }
-    if (!(flags & FD_CLOEXEC)) {
-        if (fcntl(epolFd, F_SETFD, flags | FD_CLOEXEC) == -1) {
-            if (LOGS_ENABLED) DEBUG_W("fcntl(%d, F_SETFD)", epolFd);
-        }
-    }
-
-    if ((epollEvents = new epoll_event[128]) == nullptr) {
-        if (LOGS_ENABLED) DEBUG_E("unable to allocate epoll events");
-        exit(1);
-    }
-
-    eventFd = eventfd(0, EFD_NONBLOCK);
-    if (eventFd != -1) {
-        struct epoll_event event = {0};
-        event.data.ptr = new EventObject(&eventFd, EventObjectTypeEvent);
-        event.events = EPOLLIN | EPOLLET;
-        if (epoll_ctl(epolFd, EPOLL_CTL_ADD, eventFd, &event) == -1) {
-            eventFd = -1;
-            FileLog::e("unable to add eventfd");
-        }
-    }
-
-    if (eventFd == -1) {
-        pipeFd = new int[2];
-        if (pipe(pipeFd) != 0) {
-            if (LOGS_ENABLED) DEBUG_E("unable to create pipe");
-            exit(1);
-        }
-        flags = fcntl(pipeFd[0], F_GETFL);
-        if (flags == -1) {
-            if (LOGS_ENABLED) DEBUG_E("fcntl get pipefds[0] failed");
-            exit(1);
-        }
-        if (fcntl(pipeFd[0], F_SETFL, flags | O_NONBLOCK) == -1) {
-            if (LOGS_ENABLED) DEBUG_E("fcntl set pipefds[0] failed");
-            exit(1);
-        }
-
-        flags = fcntl(pipeFd[1], F_GETFL);
-        if (flags == -1) {
-            if (LOGS_ENABLED) DEBUG_E("fcntl get pipefds[1] failed");
-            exit(1);
-        }
-        if (fcntl(pipeFd[1], F_SETFL, flags | O_NONBLOCK) == -1) {
-            if (LOGS_ENABLED) DEBUG_E("fcntl set pipefds[1] failed");
-            exit(1);
-        }
-
-        EventObject *eventObject = new EventObject(pipeFd, EventObjectTypePipe);
-
-        epoll_event eventMask = {};
-        eventMask.events = EPOLLIN;
-        eventMask.data.ptr = eventObject;
-        if (epoll_ctl(epolFd, EPOLL_CTL_ADD, pipeFd[0], &eventMask) != 0) {
-            if (LOGS_ENABLED) DEBUG_E("can't add pipe to epoll");
-            exit(1);
-        }
-    }
-
+    reactor = NetworkReactor::obtain(instance);
+    networkBuffer = reactor->networkBuffer;
     sizeCalculator = new NativeByteBuffer(true);
-    networkBuffer = new NativeByteBuffer((uint32_t) READ_BUFFER_SIZE);
-    if (networkBuffer == nullptr) {
-        if (LOGS_ENABLED) DEBUG_E("unable to allocate read buffer");
-        exit(1);
-    }
-
-    pthread_mutex_init(&mutex, NULL);
 }
 
 ConnectionsManager::~ConnectionsManager() {
-    if (epolFd != 0) {
-        close(epolFd);
-        epolFd = 0;
-    }
-    pthread_mutex_destroy(&mutex);
+
 }
 
 ConnectionsManager& ConnectionsManager::getInstance(int32_t instanceNum) {
-  /*  switch (instanceNum) {
-        case 0:
-            static ConnectionsManager instance0(0);
-            return instance0;
-        case 1:
-            static ConnectionsManager instance1(1);
-            return instance1;
-        case 2:
-        default:
-            static ConnectionsManager instance2(2);
-            return instance2;
-    } */
-
-  // prafulla_edit: added instances
-
-    switch(instanceNum)
-    {
-        case 0:
-            static ConnectionsManager instance0(0);
-            return instance0;
-        case 1:
-            static ConnectionsManager instance1(1);
-            return instance1;
-        default:
-            static ConnectionsManager instance2(2);
-            return instance2;
+    if (instanceNum < 0 || instanceNum >= MAX_INSTANCE_COUNT) {
+        instanceNum = MAX_INSTANCE_COUNT - 1;
+    }
+    ConnectionsManager *instance = instances[instanceNum].load(std::memory_order_acquire);
+    if (instance == nullptr) {
+        pthread_mutex_lock(&instancesMutex);
+        instance = instances[instanceNum].load(std::memory_order_relaxed);
+        if (instance == nullptr) {
+            instance = new ConnectionsManager(instanceNum);
+            instances[instanceNum].store(instance, std::memory_order_release);
+        }
+        pthread_mutex_unlock(&instancesMutex);
+    }
+    return *instance;
+}
 
+void ConnectionsManager::useSharedNetworkThreads(uint32_t count) {
+    NetworkReactor::setSharedCount(count);
+}
 
-    }
+void ConnectionsManager::useIoUring(bool value) {
+    NetworkReactor::setUseIoUring(value);
 }
 
 int ConnectionsManager::callEvents(int64_t now) {
-    if (!events.empty()) {
-        for (std::list<EventObject *>::iterator iter = events.begin(); iter != events.end();) {
-            EventObject *eventObject = (*iter);
-            if (eventObject->time <= now) {
-                iter = events.erase(iter);
-                eventObject->onEvent(0);
-            } else {
-                int diff = (int) (eventObject->time - now);
-                return diff > 1000 || diff < 0 ? 1000 : diff;
-            }
+    events.advance(now);
+    EventObject *eventObject;
+    while ((eventObject = events.popExpired()) != nullptr) {
+        eventObject->onEvent(0);
+    }
+    int32_t timeout = 1000;
+    if (networkPaused) {
+        int32_t timeToPushPing = (int32_t) ((sendingPushPing ? 30000 : 60000 * 3) - llabs(now - lastPushPingTime));
+        if (timeToPushPing > 0) {
+            timeout = timeToPushPing;
         }
     }
-    if (!networkPaused) {
-        return 1000;
+    int64_t nextTime = events.getNextTime();
+    if (nextTime != -1 && nextTime - now < timeout) {
+        timeout = nextTime > now ? (int32_t) (nextTime - now) : 0;
     }
-    int32_t timeToPushPing = (int32_t) ((sendingPushPing ? 30000 : 60000 * 3) - llabs(now - lastPushPingTime));
-    if (timeToPushPing <= 0) {
-        return 1000;
+    if (networkPaused) {
+        if (LOGS_ENABLED) DEBUG_D("schedule next epoll wakeup in %d ms", timeout);
     }
-    if (LOGS_ENABLED) DEBUG_D("schedule next epoll wakeup in %d ms", timeToPushPing);
-    return timeToPushPing;
+    return timeout;
 }
 
 void ConnectionsManager::checkPendingTasks() {
-    while (true) {
-        std::function<void()> task;
-        pthread_mutex_lock(&mutex);
-        if (pendingTasks.empty()) {
-            pthread_mutex_unlock(&mutex);
-            return;
-        }
-        task = pendingTasks.front();
-        pendingTasks.pop();
-        pthread_mutex_unlock(&mutex);
-        task();
-    }
+    pendingTasks.drain();
 }
 
-void ConnectionsManager::select() {
-    checkPendingTasks();
-    int eventsCount = epoll_wait(epolFd, epollEvents, 128, callEvents(getCurrentTimeMonotonicMillis()));
-    checkPendingTasks();
-    int64_t now = getCurrentTimeMonotonicMillis();
-    callEvents(now);
-    for (int32_t a = 0; a < eventsCount; a++) {
-        EventObject *eventObject = (EventObject *) epollEvents[a].data.ptr;
-        eventObject->onEvent(epollEvents[a].events);
-    }
+void ConnectionsManager::onSelectFinished(int64_t now) {
     size_t count = activeConnections.size();
     for (uint32_t a = 0; a < count; a++) {
         activeConnections[a]->checkTimeout(now);
@@ -287,66 +190,40 @@ void ConnectionsManager::select() {
             if (abs((int32_t) (now / 1000) - lastDcUpdateTime) >= DC_UPDATE_TIME) {
                 updateDcSettings(0, false);
             }
-            processRequestQueue(0, 0);
+            dispatchRequestQueue(0, 0);
         } else if (!datacenter->isHandshakingAny()) {
             datacenter->beginHandshake(HandshakeTypeAll, true);
         }
     }
 }
 
-void ConnectionsManager::scheduleTask(std::function<void()> task) {
-    pthread_mutex_lock(&mutex);
-    pendingTasks.push(task);
-    pthread_mutex_unlock(&mutex);
-    wakeup();
+void ConnectionsManager::scheduleTask(Task &&task) {
+    if (pendingTasks.push(std::move(task))) {
+        wakeup();
+    }
 }
 
 void ConnectionsManager::scheduleEvent(EventObject *eventObject, uint32_t time) {
     eventObject->time = getCurrentTimeMonotonicMillis() + time;
-    std::list<EventObject *>::iterator iter;
-    for (iter = events.begin(); iter != events.end(); iter++) {
-        if ((*iter)->time > eventObject->time) {
-            break;
-        }
-    }
-    events.insert(iter, eventObject);
+    events.add(eventObject);
 }
 
 void ConnectionsManager::removeEvent(EventObject *eventObject) {
-    for (std::list<EventObject *>::iterator iter = events.begin(); iter != events.end(); iter++) {
-        if (*iter == eventObject) {
-            events.erase(iter);
-            break;
-        }
-    }
+    events.remove(eventObject);
 }
 
 void ConnectionsManager::wakeup() {
-    if (pipeFd == nullptr) {
-        eventfd_write(eventFd, 1);
-    } else {
-        char ch = 'x';
-        write(pipeFd[1], &ch, 1);
-    }
+    reactor->wakeup();
 }
 
-void *ConnectionsManager::ThreadProc(void *data) {
-    if (LOGS_ENABLED) DEBUG_D("network thread started");
-    ConnectionsManager *networkManager = (ConnectionsManager *) (data);
-#ifdef ANDROID
-    javaVm->AttachCurrentThread(&jniEnv[networkManager->instanceNum], NULL);
-#endif
-    if (networkManager->currentUserId != 0 && networkManager->pushConnectionEnabled) {
-        Datacenter *datacenter = networkManager->getDatacenterWithId(networkManager->currentDatacenterId);
+void ConnectionsManager::onNetworkThreadAttached() {
+    if (currentUserId != 0 && pushConnectionEnabled) {
+        Datacenter *datacenter = getDatacenterWithId(currentDatacenterId);
         if (datacenter != nullptr) {
-            datacenter->createPushConnection()->setSessionId(networkManager->pushSessionId);
-            networkManager->sendPing(datacenter, true);
+            datacenter->createPushConnection()->setSessionId(pushSessionId);
+            sendPing(datacenter, true);
         }
     }
-    do {
-        networkManager->select();
-    } while (!done);
-    return nullptr;
 }
 
 void ConnectionsManager::loadConfig() {
@@ -464,78 +341,130 @@ void ConnectionsManager::saveConfig() {
     buffer->reuse();
 }
 
+#define GZIP_MAX_PRESCAN_SIZE (32 * 1024 * 1024)
+
+struct InflateStream {
+    z_stream stream;
+    bool initialized = false;
+
+    ~InflateStream() {
+        if (initialized) {
+            inflateEnd(&stream);
+        }
+    }
+};
+
+struct DeflateStream {
+    z_stream stream;
+    bool initialized = false;
+    int32_t level = Z_BEST_COMPRESSION;
+
+    ~DeflateStream() {
+        if (initialized) {
+            deflateEnd(&stream);
+        }
+    }
+};
+
+inline uint32_t getGZipUncompressedSize(NativeByteBuffer *data) {
+    uint32_t length = data->limit();
+    uint8_t *bytes = data->bytes();
+    if (length < 18 || bytes[0] != 0x1f || bytes[1] != 0x8b) {
+        return 0;
+    }
+    uint32_t size = bytes[length - 4] | (bytes[length - 3] << 8) | (bytes[length - 2] << 16) | ((uint32_t) bytes[length - 1] << 24);
+    return size <= GZIP_MAX_PRESCAN_SIZE ? size : 0;
+}
+
 inline NativeByteBuffer *decompressGZip(NativeByteBuffer *data) {
+    thread_local static InflateStream inflateStream;
+    z_stream *stream = &inflateStream.stream;
     int retCode;
-    z_stream stream;
 
-    memset(&stream, 0, sizeof(z_stream));
-    stream.avail_in = data->limit();
-    stream.next_in = data->bytes();
+    if (!inflateStream.initialized) {
+        memset(stream, 0, sizeof(z_stream));
+        retCode = inflateInit2(stream, 15 + 32);
+        if (retCode != Z_OK) {
+            if (LOGS_ENABLED) DEBUG_E("inflateInit2() failed with error %i", retCode);
+            return nullptr;
+        }
+        inflateStream.initialized = true;
+    } else {
+        inflateReset(stream);
+    }
+    stream->avail_in = data->limit();
+    stream->next_in = data->bytes();
 
-    retCode = inflateInit2(&stream, 15 + 32);
-    if (retCode != Z_OK) {
-        if (LOGS_ENABLED) DEBUG_E("can't decompress data");
-        exit(1);
+    uint32_t size = getGZipUncompressedSize(data);
+    if (size == 0) {
+        size = data->limit() * 4;
     }
-    NativeByteBuffer *result = BuffersStorage::getInstance().getFreeBuffer(data->limit() * 4);
-    stream.avail_out = result->capacity();
-    stream.next_out = result->bytes();
-    while (1) {
-        retCode = inflate(&stream, Z_NO_FLUSH);
+    NativeByteBuffer *result = BuffersStorage::getInstance().getFreeBuffer(size);
+    stream->avail_out = result->capacity();
+    stream->next_out = result->bytes();
+    while (true) {
+        retCode = inflate(stream, Z_NO_FLUSH);
         if (retCode == Z_STREAM_END) {
             break;
         }
-        if (retCode == Z_OK) {
+        if ((retCode == Z_OK || retCode == Z_BUF_ERROR) && stream->avail_out == 0) {
+            uint32_t written = (uint32_t) stream->total_out;
             NativeByteBuffer *newResult = BuffersStorage::getInstance().getFreeBuffer(result->capacity() * 2);
-            memcpy(newResult->bytes(), result->bytes(), result->capacity());
-            stream.avail_out = newResult->capacity() - result->capacity();
-            stream.next_out = newResult->bytes() + result->capacity();
+            memcpy(newResult->bytes(), result->bytes(), written);
+            stream->avail_out = newResult->capacity() - written;
+            stream->next_out = newResult->bytes() + written;
             result->reuse();
             result = newResult;
         } else {
-            if (LOGS_ENABLED) DEBUG_E("can't decompress data");
-            exit(1);
+            if (LOGS_ENABLED) DEBUG_E("can't decompress data, inflate() returned %i", retCode);
+            result->reuse();
+            return nullptr;
         }
     }
-    result->limit((uint32_t) stream.total_out);
-    inflateEnd(&stream);
+    result->limit((uint32_t) stream->total_out);
     return result;
 }
 
-inline NativeByteBuffer *compressGZip(NativeByteBuffer *buffer) {
+inline NativeByteBuffer *compressGZip(NativeByteBuffer *buffer, int32_t level) {
     if (buffer == nullptr || buffer->limit() == 0) {
         return nullptr;
     }
-    z_stream stream;
+    thread_local static DeflateStream deflateStream;
+    z_stream *stream = &deflateStream.stream;
     int retCode;
 
-    memset(&stream, 0, sizeof(z_stream));
-    stream.avail_in = buffer->limit();
-    stream.next_in = buffer->bytes();
-
-    retCode = deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
-    if (retCode != Z_OK) {
-        if (LOGS_ENABLED) DEBUG_E("%s: deflateInit2() failed with error %i", __PRETTY_FUNCTION__, retCode);
-        return nullptr;
+    if (!deflateStream.initialized) {
+        memset(stream, 0, sizeof(z_stream));
+        retCode = deflateInit2(stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+        if (retCode != Z_OK) {
+            if (LOGS_ENABLED) DEBUG_E("%s: deflateInit2() failed with error %i", __PRETTY_FUNCTION__, retCode);
+            return nullptr;
+        }
+        deflateStream.initialized = true;
+    } else {
+        deflateReset(stream);
     }
+    if (deflateStream.level != level) {
+        deflateParams(stream, level, Z_DEFAULT_STRATEGY);
+        deflateStream.level = level;
+    }
+    stream->avail_in = buffer->limit();
+    stream->next_in = buffer->bytes();
 
     NativeByteBuffer *result = BuffersStorage::getInstance().getFreeBuffer(buffer->limit());
-    stream.avail_out = result->limit();
-    stream.next_out = result->bytes();
-    retCode = deflate(&stream, Z_FINISH);
+    stream->avail_out = result->limit();
+    stream->next_out = result->bytes();
+    retCode = deflate(stream, Z_FINISH);
     if ((retCode != Z_OK) && (retCode != Z_STREAM_END)) {
         if (LOGS_ENABLED) DEBUG_E("%s: deflate() failed with error %i", __PRETTY_FUNCTION__, retCode);
-        deflateEnd(&stream);
         result->reuse();
         return nullptr;
     }
-    if (retCode != Z_STREAM_END || stream.total_out >= buffer->limit() - 4) {
-        deflateEnd(&stream);
+    if (retCode != Z_STREAM_END || stream->total_out >= buffer->limit() - 4) {
         result->reuse();
         return nullptr;
     }
-    result->limit((uint32_t) stream.total_out);
-    deflateEnd(&stream);
+    result->limit((uint32_t) stream->total_out);
     return result;
 }
 
@@ -549,6 +478,11 @@ int64_t ConnectionsManager::getCurrentTimeMonotonicMillis() {
     return (int64_t) timeSpecMonotonic.tv_sec * 1000 + (int64_t) timeSpecMonotonic.tv_nsec / 1000000;
 }
 
+int64_t ConnectionsManager::getCurrentTimeMonotonicMicros() {
+    clock_gettime(CLOCK_MONOTONIC, &timeSpecMonotonic);
+    return (int64_t) timeSpecMonotonic.tv_sec * 1000000 + (int64_t) timeSpecMonotonic.tv_nsec / 1000;
+}
+
 int32_t ConnectionsManager::getCurrentTime() {
     return (int32_t) (getCurrentTimeMillis() / 1000) + timeDifference;
 }
@@ -592,7 +526,7 @@ void ConnectionsManager::cleanUp(bool resetKeys) {
                 request->onComplete(nullptr, error, 0);
                 delete error;
             }
-            iter = requestsQueue.erase(iter);
+            iter = removeQueuedRequest(iter);
         }
         for (requestsIter iter = runningRequests.begin(); iter != runningRequests.end();) {
             Request *request = iter->get();
@@ -607,7 +541,7 @@ void ConnectionsManager::cleanUp(bool resetKeys) {
                 request->onComplete(nullptr, error, 0);
                 delete error;
             }
-            iter = runningRequests.erase(iter);
+            iter = removeRunningRequest(iter);
         }
         quickAckIdToRequestIds.clear();
 
@@ -693,15 +627,12 @@ void ConnectionsManager::onConnectionClosed(Connection *connection, int reason)
                 ProxyCheckInfo *proxyCheckInfo = iter->get();
                 if (proxyCheckInfo->connectionNum == connection->getConnectionNum()) {
                     bool found = false;
-                    for (requestsIter iter2 = runningRequests.begin(); iter2 != runningRequests.end(); iter2++) {
-                        Request *request = iter2->get();
-                        if (connection->getConnectionToken() == request->connectionToken && request->requestToken == proxyCheckInfo->requestToken && (request->connectionType & 0x0000ffff) == ConnectionTypeProxy) {
-                            request->completed = true;
-                            runningRequests.erase(iter2);
-                            proxyCheckInfo->onRequestTime(-1);
-                            found = true;
-                            break;
-                        }
+                    Request *request = getRunningRequestWithToken(proxyCheckInfo->requestToken);
+                    if (request != nullptr && connection->getConnectionToken() == request->connectionToken && (request->connectionType & 0x0000ffff) == ConnectionTypeProxy) {
+                        request->completed = true;
+                        removeRunningRequest(request->listIterator);
+                        proxyCheckInfo->onRequestTime(-1);
+                        found = true;
                     }
                     if (found) {
                         proxyActiveChecks.erase(iter);
@@ -744,13 +675,13 @@ void ConnectionsManager::onConnectionConnected(Connection *connection) {
 }
 
 void ConnectionsManager::onConnectionQuickAckReceived(Connection *connection, int32_t ack) {
-    std::map<int32_t, std::vector<int32_t>>::iterator iter = quickAckIdToRequestIds.find(ack);
+    std::unordered_map<int32_t, std::vector<int32_t>>::iterator iter = quickAckIdToRequestIds.find(ack);
     if (iter == quickAckIdToRequestIds.end()) {
         return;
     }
-    for (requestsIter iter2 = runningRequests.begin(); iter2 != runningRequests.end(); iter2++) {
-        Request *request = iter2->get();
-        if (std::find(iter->second.begin(), iter->second.end(), request->requestToken) != iter->second.end()) {
+    for (std::vector<int32_t>::iterator iter2 = iter->second.begin(); iter2 != iter->second.end(); iter2++) {
+        Request *request = getRunningRequestWithToken(*iter2);
+        if (request != nullptr) {
             request->onQuickAck();
         }
     }
@@ -857,67 +788,148 @@ void ConnectionsManager::onConnectionDataReceived(Connection *connection, Native
                 length -= padding;
             }
         }
-        if (length < 24 + 32 || !connection->allowsCustomPadding() && (length - 24) % 16 != 0 || !datacenter->decryptServerResponse(keyId, data->bytes() + mark + 8, data->bytes() + mark + 24, length - 24, connection)) {
+        if (length < 24 + 32 || !connection->allowsCustomPadding() && (length - 24) % 16 != 0) {
+            if (LOGS_ENABLED) DEBUG_E("connection(%p) unable to decrypt server response", connection);
+            connection->reconnect();
+            return;
+        }
+        if (length >= CRYPTO_OFFLOAD_MIN_SIZE || !connection->pendingPackets.empty()) {
+            EncryptedPacket *packet = new EncryptedPacket();
+            packet->keyId = keyId;
+            packet->buffer = data->createSlice(mark, length);
+            if (packet->buffer == nullptr) {
+                packet->buffer = BuffersStorage::getInstance().getFreeBuffer(length);
+                memcpy(packet->buffer->bytes(), data->bytes() + mark, length);
+            }
+            connection->pendingPackets.push_back(packet);
+            if (length >= CRYPTO_OFFLOAD_MIN_SIZE) {
+                ByteArray *authKey = datacenter->getAuthKey(connection->getConnectionType(), false, &packet->authKeyId, 1);
+                if (authKey != nullptr) {
+                    memcpy(packet->authKey, authKey->bytes, std::min((uint32_t) sizeof(packet->authKey), authKey->length));
+                    packet->mtProtoVersion = getMtProtoVersion();
+                    packet->offloaded = true;
+                    packet->inFlight = true;
+                    uint8_t *bytes = packet->buffer->bytes();
+                    Datacenter::generateServerResponseKey(packet->authKey, bytes + 8, packet->aesKeyIv, packet->mtProtoVersion);
+                    AesIgeStream stream;
+                    stream.buffer = bytes + 24;
+                    stream.key = packet->aesKeyIv;
+                    stream.iv = packet->aesKeyIv + 32;
+                    stream.length = length - 24;
+                    CryptoWorkerPool::getInstance().postAesIge(stream, false, [&, connection, packet] {
+                        uint8_t *bytes = packet->buffer->bytes();
+                        packet->valid = Datacenter::checkServerResponse(packet->authKey, packet->authKeyId, packet->keyId, bytes + 8, bytes + 24, packet->buffer->limit() - 24, packet->mtProtoVersion);
+                        scheduleTask([&, connection, packet] {
+                            onEncryptedPacketDecrypted(connection, packet);
+                        });
+                    });
+                    return;
+                }
+            }
+            processPendingPackets(connection);
+            return;
+        }
+        if (!datacenter->decryptServerResponse(keyId, data->bytes() + mark + 8, data->bytes() + mark + 24, length - 24, connection)) {
             if (LOGS_ENABLED) DEBUG_E("connection(%p) unable to decrypt server response", connection);
             connection->reconnect();
             return;
         }
-        data->position(mark + 24);
+        processDecryptedPacket(connection, data, mark);
+    }
+}
 
-        int64_t messageServerSalt = data->readInt64(&error);
-        int64_t messageSessionId = data->readInt64(&error);
+void ConnectionsManager::onEncryptedPacketDecrypted(Connection *connection, EncryptedPacket *packet) {
+    packet->inFlight = false;
+    if (packet->discarded) {
+        packet->buffer->reuse();
+        delete packet;
+        return;
+    }
+    processPendingPackets(connection);
+}
 
-        if (messageSessionId != connection->getSessionId()) {
-            if (LOGS_ENABLED) DEBUG_E("connection(%p) received invalid message session id (0x%" PRIx64 " instead of 0x%" PRIx64 ")", connection, (uint64_t) messageSessionId, (uint64_t) connection->getSessionId());
+void ConnectionsManager::processPendingPackets(Connection *connection) {
+    Datacenter *datacenter = connection->getDatacenter();
+    while (!connection->pendingPackets.empty()) {
+        EncryptedPacket *packet = connection->pendingPackets.front();
+        if (packet->inFlight) {
+            break;
+        }
+        NativeByteBuffer *buffer = packet->buffer;
+        if (!packet->offloaded) {
+            packet->valid = datacenter->decryptServerResponse(packet->keyId, buffer->bytes() + 8, buffer->bytes() + 24, buffer->limit() - 24, connection);
+        }
+        if (!packet->valid) {
+            if (LOGS_ENABLED) DEBUG_E("connection(%p) unable to decrypt server response", connection);
+            connection->reconnect();
             return;
         }
+        connection->pendingPackets.pop_front();
+        buffer->setSlicesAllowed(true);
+        processDecryptedPacket(connection, buffer, 0);
+        buffer->reuse();
+        delete packet;
+    }
+}
 
-        int64_t messageId = data->readInt64(&error);
-        int32_t messageSeqNo = data->readInt32(&error);
-        uint32_t messageLength = data->readUint32(&error);
+void ConnectionsManager::processDecryptedPacket(Connection *connection, NativeByteBuffer *data, uint32_t mark) {
+    bool error = false;
+    Datacenter *datacenter = connection->getDatacenter();
+    data->position(mark + 24);
 
-        int32_t processedStatus = connection->isMessageIdProcessed(messageId);
+    int64_t messageServerSalt = data->readInt64(&error);
+    int64_t messageSessionId = data->readInt64(&error);
 
-        if (messageSeqNo % 2 != 0) {
-            connection->addMessageToConfirm(messageId);
-        }
+    if (messageSessionId != connection->getSessionId()) {
+        if (LOGS_ENABLED) DEBUG_E("connection(%p) received invalid message session id (0x%" PRIx64 " instead of 0x%" PRIx64 ")", connection, (uint64_t) messageSessionId, (uint64_t) connection->getSessionId());
+        return;
+    }
 
-        TLObject *object = nullptr;
+    int64_t messageId = data->readInt64(&error);
+    int32_t messageSeqNo = data->readInt32(&error);
+    uint32_t messageLength = data->readUint32(&error);
 
-        if (processedStatus != 1) {
-            deserializingDatacenter = datacenter;
-            object = TLdeserialize(nullptr, messageLength, data);
-            if (processedStatus == 2) {
-                if (object == nullptr) {
-                    connection->recreateSession();
-                    connection->reconnect();
-                    return;
-                } else {
-                    delete object;
-                    object = nullptr;
-                }
+    int32_t processedStatus = connection->isMessageIdProcessed(messageId);
+
+    if (messageSeqNo % 2 != 0) {
+        connection->addMessageToConfirm(messageId);
+    }
+
+    TLObject *object = nullptr;
+
+    if (processedStatus != 1) {
+        deserializingDatacenter = datacenter;
+        object = TLdeserialize(nullptr, messageLength, data);
+        if (processedStatus == 2) {
+            if (object == nullptr) {
+                connection->recreateSession();
+                connection->reconnect();
+                return;
+            } else {
+                delete object;
+                object = nullptr;
             }
         }
-        if (!processedStatus) {
-            if (object != nullptr) {
-                connection->setHasUsefullData();
-                if (LOGS_ENABLED) DEBUG_D("connection(%p, account%u, dc%u, type %d) received object %s", connection, instanceNum, datacenter->getDatacenterId(), connection->getConnectionType(), typeid(*object).name());
-                processServerResponse(object, messageId, messageSeqNo, messageServerSalt, connection, 0, 0);
-                connection->addProcessedMessageId(messageId);
-                delete object;
-                if (connection->getConnectionType() == ConnectionTypePush) {
-                    std::vector<std::unique_ptr<NetworkMessage>> messages;
-                    sendMessagesToConnectionWithConfirmation(messages, connection, false);
-                }
-            } else {
-                if (delegate != nullptr) {
-                    delegate->onUnparsedMessageReceived(0, data, connection->getConnectionType(), instanceNum);
-                }
+    }
+    if (!processedStatus) {
+        if (object != nullptr) {
+            connection->setHasUsefullData();
+            if (LOGS_ENABLED) DEBUG_D("connection(%p, account%u, dc%u, type %d) received object %s", connection, instanceNum, datacenter->getDatacenterId(), connection->getConnectionType(), typeid(*object).name());
+            processServerResponse(object, messageId, messageSeqNo, messageServerSalt, connection, 0, 0);
+            connection->addProcessedMessageId(messageId);
+            delete object;
+            if (connection->getConnectionType() == ConnectionTypePush) {
+                std::vector<std::unique_ptr<NetworkMessage>> messages;
+                sendMessagesToConnectionWithConfirmation(messages, connection, false);
             }
         } else {
-            std::vector<std::unique_ptr<NetworkMessage>> messages;
-            sendMessagesToConnectionWithConfirmation(messages, connection, false);
+            if (delegate != nullptr) {
+                delegate->onUnparsedMessageReceived(0, data, connection->getConnectionType(), instanceNum);
+            }
         }
+    } else {
+        std::vector<std::unique_ptr<NetworkMessage>> messages;
+        sendMessagesToConnectionWithConfirmation(messages, connection, false);
     }
 }
 
@@ -938,30 +950,177 @@ bool ConnectionsManager::hasPendingRequestsForConnection(Connection *connection)
                 return true;
             }
         }
-        for (requestsIter iter2 = runningRequests.begin(); iter2 != runningRequests.end(); iter2++) {
-            Request *request = iter2->get();
-            uint8_t connectionNum = (uint8_t) (request->connectionType >> 16);
-            ConnectionType connectionType = (ConnectionType) (request->connectionType & 0x0000ffff);
-            if (connectionType == type && connectionNum == num || request->connectionToken == token) {
-                return true;
-            }
+        if (runningRequestsCountByConnectionType.find((uint32_t) type | ((uint32_t) (uint8_t) num << 16)) != runningRequestsCountByConnectionType.end()) {
+            return true;
         }
-        return false;
+        return token != 0 && runningRequestsCountByConnectionToken.find(token) != runningRequestsCountByConnectionToken.end();
     }
     return true;
 }
 
-TLObject *ConnectionsManager::getRequestWithMessageId(int64_t messageId) {
-    for (requestsIter iter = runningRequests.begin(); iter != runningRequests.end(); iter++) {
-        Request *request = iter->get();
-        if (request->messageId == messageId) {
-            return request->rawRequest;
+void ConnectionsManager::addRequestToQueue(Request *request) {
+    requestsQueue.push_back(std::unique_ptr<Request>(request));
+    request->listIterator = std::prev(requestsQueue.end());
+    requestsByToken[request->requestToken] = request;
+    requestsQueueChanged = true;
+}
+
+requestsIter ConnectionsManager::removeQueuedRequest(requestsIter iter) {
+    removeRequestTokenIndex(iter->get());
+    return requestsQueue.erase(iter);
+}
+
+requestsIter ConnectionsManager::removeRunningRequest(requestsIter iter) {
+    removeRunningRequestIndex(iter->get());
+    removeRequestTokenIndex(iter->get());
+    return runningRequests.erase(iter);
+}
+
+requestsIter ConnectionsManager::moveRequestToRunning(requestsIter iter) {
+    requestsIter next = std::next(iter);
+    runningRequests.splice(runningRequests.end(), requestsQueue, iter);
+    addRunningRequestIndex(iter->get());
+    return next;
+}
+
+requestsIter ConnectionsManager::moveRequestToQueue(requestsIter iter) {
+    requestsIter next = std::next(iter);
+    removeRunningRequestIndex(iter->get());
+    requestsQueue.splice(requestsQueue.end(), runningRequests, iter);
+    return next;
+}
+
+void ConnectionsManager::removeRequestTokenIndex(Request *request) {
+    std::unordered_map<int32_t, Request *>::iterator iter = requestsByToken.find(request->requestToken);
+    if (iter != requestsByToken.end() && iter->second == request) {
+        requestsByToken.erase(iter);
+    }
+}
+
+void ConnectionsManager::addRunningRequestIndex(Request *request) {
+    request->running = true;
+    indexRunningRequestMessageId(request);
+    for (std::vector<int64_t>::iterator iter = request->respondsToMessageIds.begin(); iter != request->respondsToMessageIds.end(); iter++) {
+        runningRequestsByMessageId[*iter] = request;
+        request->indexedMessageIds.push_back(*iter);
+    }
+    if (request->connectionToken != 0) {
+        runningRequestsCountByConnectionToken[request->connectionToken]++;
+    }
+    runningRequestsCountByConnectionType[request->connectionType & 0x00ffffff]++;
+    switch (request->connectionType & 0x0000ffff) {
+        case ConnectionTypeGeneric:
+            genericRunningRequestCount++;
+            break;
+        case ConnectionTypeDownload:
+            downloadRunningRequestCount[request->runningDatacenterId]++;
+            break;
+        case ConnectionTypeUpload:
+            uploadRunningRequestCount++;
+            break;
+        default:
+            break;
+    }
+    scheduleRunningRequestsCheck(request->startTime + 9);
+}
+
+void ConnectionsManager::removeRunningRequestIndex(Request *request) {
+    for (std::vector<int64_t>::iterator iter = request->indexedMessageIds.begin(); iter != request->indexedMessageIds.end(); iter++) {
+        std::unordered_map<int64_t, Request *>::iterator iter2 = runningRequestsByMessageId.find(*iter);
+        if (iter2 != runningRequestsByMessageId.end() && iter2->second == request) {
+            runningRequestsByMessageId.erase(iter2);
+        }
+    }
+    request->indexedMessageIds.clear();
+    setRunningRequestConnectionToken(request, 0);
+    std::unordered_map<uint32_t, uint32_t>::iterator iter = runningRequestsCountByConnectionType.find(request->connectionType & 0x00ffffff);
+    if (iter != runningRequestsCountByConnectionType.end() && --iter->second == 0) {
+        runningRequestsCountByConnectionType.erase(iter);
+    }
+    switch (request->connectionType & 0x0000ffff) {
+        case ConnectionTypeGeneric:
+            genericRunningRequestCount--;
+            break;
+        case ConnectionTypeDownload: {
+            std::map<uint32_t, uint32_t>::iterator iter2 = downloadRunningRequestCount.find(request->runningDatacenterId);
+            if (iter2 != downloadRunningRequestCount.end() && --iter2->second == 0) {
+                downloadRunningRequestCount.erase(iter2);
+            }
+            break;
+        }
+        case ConnectionTypeUpload:
+            uploadRunningRequestCount--;
+            break;
+        default:
+            break;
+    }
+    request->running = false;
+    requestsQueueChanged = true;
+}
+
+void ConnectionsManager::indexRunningRequestMessageId(Request *request) {
+    if (request->messageId != 0) {
+        runningRequestsByMessageId[request->messageId] = request;
+        request->indexedMessageIds.push_back(request->messageId);
+    }
+}
+
+void ConnectionsManager::setRunningRequestConnectionToken(Request *request, uint32_t token) {
+    if (request->running && request->connectionToken != token) {
+        if (request->connectionToken != 0) {
+            std::unordered_map<uint32_t, uint32_t>::iterator iter = runningRequestsCountByConnectionToken.find(request->connectionToken);
+            if (iter != runningRequestsCountByConnectionToken.end() && --iter->second == 0) {
+                runningRequestsCountByConnectionToken.erase(iter);
+            }
+        }
+        if (token != 0) {
+            runningRequestsCountByConnectionToken[token]++;
+        } else {
+            nextRunningRequestsCheckTime = 0;
         }
     }
+    request->connectionToken = token;
+}
+
+void ConnectionsManager::clearRunningRequest(Request *request, bool time) {
+    setRunningRequestConnectionToken(request, 0);
+    request->clear(time);
+    if (time) {
+        nextRunningRequestsCheckTime = 0;
+    }
+}
+
+Request *ConnectionsManager::getRunningRequestRespondingTo(int64_t messageId) {
+    std::unordered_map<int64_t, Request *>::iterator iter = runningRequestsByMessageId.find(messageId);
+    if (iter == runningRequestsByMessageId.end() || !iter->second->respondsToMessageId(messageId)) {
+        return nullptr;
+    }
+    return iter->second;
+}
+
+Request *ConnectionsManager::getRequestWithToken(int32_t token) {
+    std::unordered_map<int32_t, Request *>::iterator iter = requestsByToken.find(token);
+    if (iter == requestsByToken.end() || iter->second->requestToken != token) {
+        return nullptr;
+    }
+    return iter->second;
+}
+
+Request *ConnectionsManager::getRunningRequestWithToken(int32_t token) {
+    Request *request = getRequestWithToken(token);
+    return request != nullptr && request->running ? request : nullptr;
+}
+
+TLObject *ConnectionsManager::getRequestWithMessageId(int64_t messageId) {
+    std::unordered_map<int64_t, Request *>::iterator iter = runningRequestsByMessageId.find(messageId);
+    if (iter != runningRequestsByMessageId.end() && iter->second->messageId == messageId) {
+        return iter->second->rawRequest;
+    }
     return nullptr;
 }
 
 TLObject *ConnectionsManager::TLdeserialize(TLObject *request, uint32_t bytes, NativeByteBuffer *data) {
+    TLObjectArenaScope arenaScope;
     bool error = false;
     uint32_t position = data->position();
     uint32_t constructor = data->readUint32(&error);
@@ -999,18 +1158,20 @@ TLObject *ConnectionsManager::TLdeserialize(TLObject *request, uint32_t bytes, N
     }
     if (object == nullptr) {
         data->position(position);
+    } else {
+        object->objectConstructor = constructor;
     }
     return object;
 }
 
 void ConnectionsManager::processServerResponse(TLObject *message, int64_t messageId, int32_t messageSeqNo, int64_t messageSalt, Connection *connection, int64_t innerMsgId, int64_t containerMessageId) {
-    const std::type_info &typeInfo = typeid(*message);
+    uint32_t constructor = message->objectConstructor;
 
-    if (LOGS_ENABLED) DEBUG_D("process server response %p - %s", message, typeInfo.name());
+    if (LOGS_ENABLED) DEBUG_D("process server response %p - %s", message, typeid(*message).name());
 
     Datacenter *datacenter = connection->getDatacenter();
 
-    if (typeInfo == typeid(TL_new_session_created)) {
+    if (constructor == TL_new_session_created::constructor) {
         TL_new_session_created *response = (TL_new_session_created *) message;
 
         if (!connection->isSessionProcessed(response->unique_id)) {
@@ -1027,7 +1188,7 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
                 Datacenter *requestDatacenter = getDatacenterWithId(request->datacenterId);
                 if (request->messageId < response->first_msg_id && request->connectionType & connection->getConnectionType() && requestDatacenter != nullptr && requestDatacenter->getDatacenterId() == datacenter->getDatacenterId()) {
                     if (LOGS_ENABLED) DEBUG_D("clear request %p - %s", request->rawRequest, typeid(*request->rawRequest).name());
-                    request->clear(true);
+                    clearRunningRequest(request, true);
                 }
             }
 
@@ -1044,7 +1205,7 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
             }
             connection->addProcessedSession(response->unique_id);
         }
-    } else if (typeInfo == typeid(TL_msg_container)) {
+    } else if (constructor == TL_msg_container::constructor) {
         TL_msg_container *response = (TL_msg_container *) message;
         size_t count = response->messages.size();
         if (LOGS_ENABLED) DEBUG_D("received container with %d items", (int32_t) count);
@@ -1078,7 +1239,7 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
             }
             connection->addProcessedMessageId(innerMessageId);
         }
-    } else if (typeInfo == typeid(TL_pong)) {
+    } else if (constructor == TL_pong::constructor) {
         if (connection->getConnectionType() == ConnectionTypePush) {
             if (!registeredForInternalPush) {
                 registerForInternalPushUpdates();
@@ -1091,16 +1252,13 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
                 for (std::vector<std::unique_ptr<ProxyCheckInfo>>::iterator iter = proxyActiveChecks.begin(); iter != proxyActiveChecks.end(); iter++) {
                     ProxyCheckInfo *proxyCheckInfo = iter->get();
                     if (proxyCheckInfo->pingId == response->ping_id) {
-                        for (requestsIter iter2 = runningRequests.begin(); iter2 != runningRequests.end(); iter2++) {
-                            Request *request = iter2->get();
-                            if (request->requestToken == proxyCheckInfo->requestToken) {
-                                int64_t ping = llabs(getCurrentTimeMonotonicMillis() - request->startTimeMillis);
-                                if (LOGS_ENABLED) DEBUG_D("got ping response for request %p, %" PRId64, request->rawRequest, ping);
-                                request->completed = true;
-                                proxyCheckInfo->onRequestTime(ping);
-                                runningRequests.erase(iter2);
-                                break;
-                            }
+                        Request *request = getRunningRequestWithToken(proxyCheckInfo->requestToken);
+                        if (request != nullptr) {
+                            int64_t ping = llabs(getCurrentTimeMonotonicMillis() - request->startTimeMillis);
+                            if (LOGS_ENABLED) DEBUG_D("got ping response for request %p, %" PRId64, request->rawRequest, ping);
+                            request->completed = true;
+                            proxyCheckInfo->onRequestTime(ping);
+                            removeRunningRequest(request->listIterator);
                         }
                         proxyActiveChecks.erase(iter);
 
@@ -1125,22 +1283,19 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
                 sendingPing = false;
             }
         }
-    } else if (typeInfo == typeid(TL_future_salts)) {
+    } else if (constructor == TL_future_salts::constructor) {
         TL_future_salts *response = (TL_future_salts *) message;
         int64_t requestMid = response->req_msg_id;
-        for (requestsIter iter = runningRequests.begin(); iter != runningRequests.end(); iter++) {
-            Request *request = iter->get();
-            if (request->respondsToMessageId(requestMid)) {
-                request->onComplete(response, nullptr, connection->currentNetworkType);
-                request->completed = true;
-                runningRequests.erase(iter);
-                break;
-            }
+        Request *request = getRunningRequestRespondingTo(requestMid);
+        if (request != nullptr) {
+            request->onComplete(response, nullptr, connection->currentNetworkType);
+            request->completed = true;
+            removeRunningRequest(request->listIterator);
         }
-    } else if (dynamic_cast<DestroySessionRes *>(message)) {
+    } else if (constructor == TL_destroy_session_ok::constructor || constructor == TL_destroy_session_none::constructor) {
         DestroySessionRes *response = (DestroySessionRes *) message;
-        if (LOGS_ENABLED) DEBUG_D("destroyed session 0x%" PRIx64 " (%s)", (uint64_t) response->session_id, typeInfo == typeid(TL_destroy_session_ok) ? "ok" : "not found");
-    } else if (typeInfo == typeid(TL_rpc_result)) {
+        if (LOGS_ENABLED) DEBUG_D("destroyed session 0x%" PRIx64 " (%s)", (uint64_t) response->session_id, constructor == TL_destroy_session_ok::constructor ? "ok" : "not found");
+    } else if (constructor == TL_rpc_result::constructor) {
         TL_rpc_result *response = (TL_rpc_result *) message;
         int64_t resultMid = response->req_msg_id;
 
@@ -1150,7 +1305,7 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
             TLObject *object = response->result.get();
             if (LOGS_ENABLED) DEBUG_D("connection(%p, account%u, dc%u, type %d) received rpc_result with %s", connection, instanceNum, datacenter->getDatacenterId(), connection->getConnectionType(), typeid(*object).name());
         }
-        RpcError *error = hasResult ? dynamic_cast<RpcError *>(response->result.get()) : nullptr;
+        RpcError *error = hasResult ? TLClassStore::asRpcError(response->result.get()) : nullptr;
         if (error != nullptr) {
             if (LOGS_ENABLED) DEBUG_E("connection(%p, account%u, dc%u, type %d) rpc error %d: %s", connection, instanceNum, datacenter->getDatacenterId(), connection->getConnectionType(), error->error_code, error->error_message.c_str());
             if (error->error_code == 303) {
@@ -1178,12 +1333,9 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
         uint32_t retryRequestsFromDatacenter = DEFAULT_DATACENTER_ID - 1;
         uint32_t retryRequestsConnections = 0;
 
-        if (!ignoreResult) {
-            for (requestsIter iter = runningRequests.begin(); iter != runningRequests.end(); iter++) {
-                Request *request = iter->get();
-                if (!request->respondsToMessageId(resultMid)) {
-                    continue;
-                }
+        Request *request = ignoreResult ? nullptr : getRunningRequestRespondingTo(resultMid);
+        if (request != nullptr) {
+            {
                 if (LOGS_ENABLED) DEBUG_D("got response for request %p - %s", request->rawRequest, typeid(*request->rawRequest).name());
                 bool discardResponse = false;
                 bool isError = false;
@@ -1193,10 +1345,10 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
                     TL_error *implicitError = nullptr;
                     NativeByteBuffer *unpacked_data = nullptr;
                     TLObject *result = response->result.get();
-                    if (typeid(*result) == typeid(TL_gzip_packed)) {
+                    if (result->objectConstructor == TL_gzip_packed::constructor) {
                         TL_gzip_packed *innerResponse = (TL_gzip_packed *) result;
                         unpacked_data = decompressGZip(innerResponse->packed_data.get());
-                        TLObject *object = TLdeserialize(request->rawRequest, unpacked_data->limit(), unpacked_data);
+                        TLObject *object = unpacked_data != nullptr ? TLdeserialize(request->rawRequest, unpacked_data->limit(), unpacked_data) : nullptr;
                         if (object != nullptr) {
                             response->result = std::unique_ptr<TLObject>(object);
                         } else {
@@ -1205,8 +1357,8 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
                     }
 
                     hasResult = response->result.get() != nullptr;
-                    error = hasResult ? dynamic_cast<RpcError *>(response->result.get()) : nullptr;
-                    TL_error *error2 = hasResult ? dynamic_cast<TL_error *>(response->result.get()) : nullptr;
+                    error = hasResult ? TLClassStore::asRpcError(response->result.get()) : nullptr;
+                    TL_error *error2 = hasResult && response->result->objectConstructor == TL_error::constructor ? (TL_error *) response->result.get() : nullptr;
                     if (error != nullptr) {
                         allowInitConnection = false;
                         static std::string authRestart = "AUTH_RESTART";
@@ -1284,6 +1436,9 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
                                 delete error2;
                             }
                         } else {
+                            if (request->connectionType & ConnectionTypeDownload) {
+                                datacenter->bandwidthEstimator.onRequestCompleted(request, response->resultLength, getCurrentTimeMonotonicMillis());
+                            }
                             request->onComplete(response->result.get(), nullptr, connection->currentNetworkType);
                         }
                     }
@@ -1346,13 +1501,12 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
                     }
                     request->completed = true;
                     removeRequestFromGuid(request->requestToken);
-                    runningRequests.erase(iter);
+                    removeRunningRequest(request->listIterator);
                 } else {
                     request->messageId = 0;
                     request->messageSeqNo = 0;
-                    request->connectionToken = 0;
+                    setRunningRequestConnectionToken(request, 0);
                 }
-                break;
             }
         }
 
@@ -1361,9 +1515,9 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
         } else {
             processRequestQueue(0, 0);
         }
-    } else if (typeInfo == typeid(TL_msgs_ack)) {
+    } else if (constructor == TL_msgs_ack::constructor) {
 
-    } else if (typeInfo == typeid(TL_bad_msg_notification)) {
+    } else if (constructor == TL_bad_msg_notification::constructor) {
         TL_bad_msg_notification *result = (TL_bad_msg_notification *) message;
         if (LOGS_ENABLED) DEBUG_E("bad message notification %d for messageId 0x%" PRIx64 ", seqno %d", result->error_code, result->bad_msg_id, result->bad_msg_seqno);
         switch (result->error_code) {
@@ -1392,22 +1546,16 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
                 break;
             }
             case 20: {
-                for (requestsIter iter = runningRequests.begin(); iter != runningRequests.end(); iter++) {
-                    Request *request = iter->get();
-                    if (request->respondsToMessageId(result->bad_msg_id)) {
-                        if (request->completed) {
-                            break;
-                        }
-                        connection->addMessageToConfirm(result->bad_msg_id);
-                        request->clear(true);
-                        break;
-                    }
+                Request *request = getRunningRequestRespondingTo(result->bad_msg_id);
+                if (request != nullptr && !request->completed) {
+                    connection->addMessageToConfirm(result->bad_msg_id);
+                    clearRunningRequest(request, true);
                 }
             }
             default:
                 break;
         }
-    } else if (typeInfo == typeid(TL_bad_server_salt)) {
+    } else if (constructor == TL_bad_server_salt::constructor) {
         TL_bad_server_salt *response = (TL_bad_server_salt *) message;
         if (messageId != 0) {
             int64_t time = (int64_t) (messageId / 4294967296.0 * 1000);
@@ -1443,49 +1591,37 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
         if (datacenter->hasAuthKey(ConnectionTypeGeneric, 1)) {
             processRequestQueue(AllConnectionTypes, datacenter->getDatacenterId());
         }
-    } else if (typeInfo == typeid(MsgsStateInfo)) {
+    } else if (constructor == MsgsStateInfo::constructor) {
         MsgsStateInfo *response = (MsgsStateInfo *) message;
-        if (LOGS_ENABLED) DEBUG_D("connection(%p, account%u, dc%u, type %d) got %s for messageId 0x%" PRIx64, connection, instanceNum, datacenter->getDatacenterId(), connection->getConnectionType(), typeInfo.name(), response->req_msg_id);
+        if (LOGS_ENABLED) DEBUG_D("connection(%p, account%u, dc%u, type %d) got %s for messageId 0x%" PRIx64, connection, instanceNum, datacenter->getDatacenterId(), connection->getConnectionType(), typeid(*message).name(), response->req_msg_id);
 
         std::map<int64_t, int64_t>::iterator mIter = resendRequests.find(response->req_msg_id);
         if (mIter != resendRequests.end()) {
             if (LOGS_ENABLED) DEBUG_D("found resend for messageId 0x%" PRIx64, mIter->second);
             connection->addMessageToConfirm(mIter->second);
-            for (requestsIter iter = runningRequests.begin(); iter != runningRequests.end(); iter++) {
-                Request *request = iter->get();
-                if (request->respondsToMessageId(mIter->second)) {
-                    if (request->completed) {
-                        break;
-                    }
-                    request->clear(true);
-                    break;
-                }
+            Request *request = getRunningRequestRespondingTo(mIter->second);
+            if (request != nullptr && !request->completed) {
+                clearRunningRequest(request, true);
             }
             resendRequests.erase(mIter);
         }
-    } else if (dynamic_cast<MsgDetailedInfo *>(message)) {
+    } else if (constructor == TL_msg_detailed_info::constructor || constructor == TL_msg_new_detailed_info::constructor) {
         MsgDetailedInfo *response = (MsgDetailedInfo *) message;
 
         bool requestResend = false;
         bool confirm = true;
 
-        if (LOGS_ENABLED) DEBUG_D("connection(%p, account%u, dc%u, type %d) got %s for messageId 0x%" PRIx64, connection, instanceNum, datacenter->getDatacenterId(), connection->getConnectionType(), typeInfo.name(), response->msg_id);
-        if (typeInfo == typeid(TL_msg_detailed_info)) {
-            for (requestsIter iter = runningRequests.begin(); iter != runningRequests.end(); iter++) {
-                Request *request = iter->get();
-                if (request->respondsToMessageId(response->msg_id)) {
-                    if (request->completed) {
-                        break;
-                    }
-                    if (LOGS_ENABLED) DEBUG_D("got TL_msg_detailed_info for rpc request %p - %s", request->rawRequest, typeid(*request->rawRequest).name());
-                    int32_t currentTime = (int32_t) (getCurrentTimeMonotonicMillis() / 1000);
-                    if (request->lastResendTime == 0 || abs(currentTime - request->lastResendTime) >= 60) {
-                        request->lastResendTime = currentTime;
-                        requestResend = true;
-                    } else {
-                        confirm = false;
-                    }
-                    break;
+        if (LOGS_ENABLED) DEBUG_D("connection(%p, account%u, dc%u, type %d) got %s for messageId 0x%" PRIx64, connection, instanceNum, datacenter->getDatacenterId(), connection->getConnectionType(), typeid(*message).name(), response->msg_id);
+        if (constructor == TL_msg_detailed_info::constructor) {
+            Request *request = getRunningRequestRespondingTo(response->msg_id);
+            if (request != nullptr && !request->completed) {
+                if (LOGS_ENABLED) DEBUG_D("got TL_msg_detailed_info for rpc request %p - %s", request->rawRequest, typeid(*request->rawRequest).name());
+                int32_t currentTime = (int32_t) (getCurrentTimeMonotonicMillis() / 1000);
+                if (request->lastResendTime == 0 || abs(currentTime - request->lastResendTime) >= 60) {
+                    request->lastResendTime = currentTime;
+                    requestResend = true;
+                } else {
+                    confirm = false;
                 }
             }
         } else {
@@ -1512,9 +1648,13 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
         } else if (confirm) {
             connection->addMessageToConfirm(response->answer_msg_id);
         }
-    } else if (typeInfo == typeid(TL_gzip_packed)) {
+    } else if (constructor == TL_gzip_packed::constructor) {
         TL_gzip_packed *response = (TL_gzip_packed *) message;
         NativeByteBuffer *data = decompressGZip(response->packed_data.get());
+        if (data == nullptr) {
+            if (LOGS_ENABLED) DEBUG_E("connection(%p, account%u, dc%u, type %d) received corrupted gzip_packed", connection, instanceNum, datacenter->getDatacenterId(), connection->getConnectionType());
+            return;
+        }
         TLObject *object = TLdeserialize(getRequestWithMessageId(messageId), data->limit(), data);
         if (object != nullptr) {
             if (LOGS_ENABLED) DEBUG_D("connection(%p, account%u, dc%u, type %d) received object %s", connection, instanceNum, datacenter->getDatacenterId(), connection->getConnectionType(), typeid(*object).name());
@@ -1526,7 +1666,7 @@ void ConnectionsManager::processServerResponse(TLObject *message, int64_t messag
             }
         }
         data->reuse();
-    } else if (typeInfo == typeid(TL_updatesTooLong)) {
+    } else if (constructor == TL_updatesTooLong::constructor) {
         if (connection->connectionType == ConnectionTypePush) {
             if (networkPaused) {
                 lastPauseTime = getCurrentTimeMonotonicMillis();
@@ -1670,6 +1810,28 @@ void ConnectionsManager::detachConnection(ConnectionSocket *connection) {
     if (iter != activeConnections.end()) {
         activeConnections.erase(iter);
     }
+    if (connection->flushScheduled) {
+        connection->flushScheduled = false;
+        iter = std::find(socketsToFlush.begin(), socketsToFlush.end(), connection);
+        if (iter != socketsToFlush.end()) {
+            socketsToFlush.erase(iter);
+        }
+    }
+}
+
+void ConnectionsManager::scheduleSocketFlush(ConnectionSocket *connection) {
+    if (!connection->flushScheduled) {
+        connection->flushScheduled = true;
+        socketsToFlush.push_back(connection);
+    }
+}
+
+void ConnectionsManager::flushSockets() {
+    while (!socketsToFlush.empty()) {
+        ConnectionSocket *connection = socketsToFlush.back();
+        socketsToFlush.pop_back();
+        connection->flushOutgoingData();
+    }
 }
 
 int32_t ConnectionsManager::sendRequestInternal(TLObject *object, onCompleteFunc onComplete, onQuickAckFunc onQuickAck, uint32_t flags, uint32_t datacenterId, ConnectionType connetionType, bool immediate) {
@@ -1681,9 +1843,9 @@ int32_t ConnectionsManager::sendRequestInternal(TLObject *object, onCompleteFunc
     Request *request = new Request(instanceNum, lastRequestToken++, connetionType, flags, datacenterId, onComplete, onQuickAck, nullptr);
     request->rawRequest = object;
     request->rpcRequest = wrapInLayer(object, getDatacenterWithId(datacenterId), request);
-    requestsQueue.push_back(std::unique_ptr<Request>(request));
+    addRequestToQueue(request);
     if (immediate) {
-        processRequestQueue(0, 0);
+        dispatchRequestQueue(0, 0);
     }
     return request->requestToken;
 }
@@ -1706,9 +1868,9 @@ int32_t ConnectionsManager::sendRequest(TLObject *object, onCompleteFunc onCompl
         Request *request = new Request(instanceNum, requestToken, connetionType, flags, datacenterId, onComplete, onQuickAck, nullptr);
         request->rawRequest = object;
         request->rpcRequest = wrapInLayer(object, getDatacenterWithId(datacenterId), request);
-        requestsQueue.push_back(std::unique_ptr<Request>(request));
+        addRequestToQueue(request);
         if (immediate) {
-            processRequestQueue(0, 0);
+            dispatchRequestQueue(0, 0);
         }
     });
     return requestToken;
@@ -1747,9 +1909,9 @@ void ConnectionsManager::sendRequest(TLObject *object, onCompleteFunc onComplete
         request->ptr3 = ptr3;
         request->rpcRequest = wrapInLayer(object, getDatacenterWithId(datacenterId), request);
         if (LOGS_ENABLED) DEBUG_D("send request wrapped %p - %s", request->rpcRequest.get(), typeid(*(request->rpcRequest.get())).name());
-        requestsQueue.push_back(std::unique_ptr<Request>(request));
+        addRequestToQueue(request);
         if (immediate) {
-            processRequestQueue(0, 0);
+            dispatchRequestQueue(0, 0);
         }
     });
 }
@@ -1836,37 +1998,40 @@ void ConnectionsManager::removeRequestFromGuid(int32_t requestToken) {
 }
 
 bool ConnectionsManager::cancelRequestInternal(int32_t token, int64_t messageId, bool notifyServer, bool removeFromClass) {
-    for (requestsIter iter = requestsQueue.begin(); iter != requestsQueue.end(); iter++) {
-        Request *request = iter->get();
-        if (token != 0 && request->requestToken == token || messageId != 0 && request->respondsToMessageId(messageId)) {
-            request->cancelled = true;
-            if (LOGS_ENABLED) DEBUG_D("cancelled queued rpc request %p - %s", request->rawRequest, typeid(*request->rawRequest).name());
-            requestsQueue.erase(iter);
-            if (removeFromClass) {
-                removeRequestFromGuid(token);
+    Request *request = token != 0 ? getRequestWithToken(token) : nullptr;
+    if (request == nullptr && messageId != 0) {
+        request = getRunningRequestRespondingTo(messageId);
+        if (request == nullptr) {
+            for (requestsIter iter = requestsQueue.begin(); iter != requestsQueue.end(); iter++) {
+                if ((*iter)->respondsToMessageId(messageId)) {
+                    request = iter->get();
+                    break;
+                }
             }
-            return true;
         }
     }
+    if (request == nullptr) {
+        return false;
+    }
 
-    for (requestsIter iter = runningRequests.begin(); iter != runningRequests.end(); iter++) {
-        Request *request = iter->get();
-        if (token != 0 && request->requestToken == token || messageId != 0 && request->respondsToMessageId(messageId)) {
-            if (notifyServer) {
-                TL_rpc_drop_answer *dropAnswer = new TL_rpc_drop_answer();
-                dropAnswer->req_msg_id = request->messageId;
-                sendRequest(dropAnswer, nullptr, nullptr, RequestFlagEnableUnauthorized | RequestFlagWithoutLogin | RequestFlagFailOnServerErrors, request->datacenterId, request->connectionType, true);
-            }
-            request->cancelled = true;
-            if (LOGS_ENABLED) DEBUG_D("cancelled running rpc request %p - %s", request->rawRequest, typeid(*request->rawRequest).name());
-            runningRequests.erase(iter);
-            if (removeFromClass) {
-                removeRequestFromGuid(token);
-            }
-            return true;
+    if (!request->running) {
+        request->cancelled = true;
+        if (LOGS_ENABLED) DEBUG_D("cancelled queued rpc request %p - %s", request->rawRequest, typeid(*request->rawRequest).name());
+        removeQueuedRequest(request->listIterator);
+    } else {
+        if (notifyServer) {
+            TL_rpc_drop_answer *dropAnswer = new TL_rpc_drop_answer();
+            dropAnswer->req_msg_id = request->messageId;
+            sendRequest(dropAnswer, nullptr, nullptr, RequestFlagEnableUnauthorized | RequestFlagWithoutLogin | RequestFlagFailOnServerErrors, request->datacenterId, request->connectionType, true);
         }
+        request->cancelled = true;
+        if (LOGS_ENABLED) DEBUG_D("cancelled running rpc request %p - %s", request->rawRequest, typeid(*request->rawRequest).name());
+        removeRunningRequest(request->listIterator);
     }
-    return false;
+    if (removeFromClass) {
+        removeRequestFromGuid(token);
+    }
+    return true;
 }
 
 void ConnectionsManager::cancelRequest(int32_t token, bool notifyServer) {
@@ -1933,7 +2098,7 @@ void ConnectionsManager::sendMessagesToConnection(std::vector<std::unique_ptr<Ne
                     }
 
                     if (!requestIds.empty()) {
-                        std::map<int32_t, std::vector<int32_t>>::iterator iter = quickAckIdToRequestIds.find(quickAckId);
+                        std::unordered_map<int32_t, std::vector<int32_t>>::iterator iter = quickAckIdToRequestIds.find(quickAckId);
                         if (iter == quickAckIdToRequestIds.end()) {
                             quickAckIdToRequestIds[quickAckId] = requestIds;
                         } else {
@@ -1989,7 +2154,7 @@ void ConnectionsManager::clearRequestsForDatacenter(Datacenter *datacenter, Hand
             continue;
         }
         if (type == HandshakeTypePerm || type == HandshakeTypeAll || type == HandshakeTypeMediaTemp && request->isMediaRequest() || type == HandshakeTypeTemp && !request->isMediaRequest()) {
-            request->clear(true);
+            clearRunningRequest(request, true);
         }
     }
 }
@@ -2029,228 +2194,239 @@ inline void addMessageToDatacenter(uint32_t datacenterId, NetworkMessage *networ
 }
 
 void ConnectionsManager::processRequestQueue(uint32_t connectionTypes, uint32_t dc) {
+    nextRunningRequestsCheckTime = 0;
+    requestsQueueChanged = true;
+    dispatchRequestQueue(connectionTypes, dc);
+}
+
+void ConnectionsManager::scheduleRunningRequestsCheck(int32_t time) {
+    if (time < nextRunningRequestsCheckTime) {
+        nextRunningRequestsCheckTime = time;
+    }
+}
+
+uint32_t ConnectionsManager::getDownloadRunningRequestCount(uint32_t datacenterId) {
+    std::map<uint32_t, uint32_t>::iterator iter = downloadRunningRequestCount.find(datacenterId);
+    return iter != downloadRunningRequestCount.end() ? iter->second : 0;
+}
+
+void ConnectionsManager::dispatchRequestQueue(uint32_t connectionTypes, uint32_t dc) {
     genericMessagesToDatacenters.clear();
     genericMediaMessagesToDatacenters.clear();
     tempMessagesToDatacenters.clear();
     unknownDatacenterIds.clear();
     neededDatacenters.clear();
     unauthorizedDatacenters.clear();
-    downloadRunningRequestCount.clear();
 
     int64_t currentTimeMillis = getCurrentTimeMonotonicMillis();
     int32_t currentTime = (int32_t) (currentTimeMillis / 1000);
-    uint32_t genericRunningRequestCount = 0;
-    uint32_t uploadRunningRequestCount = 0;
 
-    for (requestsIter iter = runningRequests.begin(); iter != runningRequests.end();) {
-        Request *request = iter->get();
-        const std::type_info &typeInfo = typeid(*request->rawRequest);
-
-        uint32_t datacenterId = request->datacenterId;
-        if (datacenterId == DEFAULT_DATACENTER_ID) {
-            if (movingToDatacenterId != DEFAULT_DATACENTER_ID) {
-                iter++;
-                continue;
-            }
-            datacenterId = currentDatacenterId;
-        }
+    if (connectionTypes != 0 || currentTime >= nextRunningRequestsCheckTime) {
+        nextRunningRequestsCheckTime = INT32_MAX;
+        for (requestsIter iter = runningRequests.begin(); iter != runningRequests.end();) {
+            Request *request = iter->get();
+            const std::type_info &typeInfo = typeid(*request->rawRequest);
 
-        switch (request->connectionType & 0x0000ffff) {
-            case ConnectionTypeGeneric:
-                genericRunningRequestCount++;
-                break;
-            case ConnectionTypeDownload: {
-                uint32_t currentCount;
-                std::map<uint32_t, uint32_t>::iterator dcIter = downloadRunningRequestCount.find(datacenterId);
-                if (dcIter != downloadRunningRequestCount.end()) {
-                    currentCount = dcIter->second;
-                } else {
-                    currentCount = 0;
+            uint32_t datacenterId = request->datacenterId;
+            if (datacenterId == DEFAULT_DATACENTER_ID) {
+                if (movingToDatacenterId != DEFAULT_DATACENTER_ID) {
+                    scheduleRunningRequestsCheck(currentTime + 1);
+                    iter++;
+                    continue;
                 }
-                downloadRunningRequestCount[datacenterId] = currentCount + 1;
-                break;
+                datacenterId = currentDatacenterId;
             }
-            case ConnectionTypeUpload:
-                uploadRunningRequestCount++;
-                break;
-            default:
-                break;
-        }
-
-        if (request->requestFlags & RequestFlagTryDifferentDc) {
-            int32_t requestStartTime = request->startTime;
-            int32_t timeout = 30;
-            if (updatingDcSettings && dynamic_cast<TL_help_getConfig *>(request->rawRequest)) {
-                requestStartTime = updatingDcStartTime;
-                updatingDcStartTime = currentTime;
-                timeout = 60;
-            }
-            if (request->startTime != 0 && abs(currentTime - requestStartTime) >= timeout) {
-                if (LOGS_ENABLED) DEBUG_D("move %s to requestsQueue", typeid(*request->rawRequest).name());
-                requestsQueue.push_back(std::move(*iter));
-                iter = runningRequests.erase(iter);
-                continue;
-            }
-        }
-        int32_t canUseUnboundKey = 0;
-        if ((request->requestFlags & RequestFlagUseUnboundKey) != 0) {
-            canUseUnboundKey |= 1;
-        }
 
-        Datacenter *requestDatacenter = getDatacenterWithId(datacenterId);
-        if (requestDatacenter == nullptr) {
-            if (std::find(unknownDatacenterIds.begin(), unknownDatacenterIds.end(), datacenterId) == unknownDatacenterIds.end()) {
-                unknownDatacenterIds.push_back(datacenterId);
-            }
-            iter++;
-            continue;
-        } else {
-            if (requestDatacenter->isCdnDatacenter) {
-                request->requestFlags |= RequestFlagEnableUnauthorized;
+            if (request->requestFlags & RequestFlagTryDifferentDc) {
+                int32_t requestStartTime = request->startTime;
+                int32_t timeout = 30;
+                if (updatingDcSettings && dynamic_cast<TL_help_getConfig *>(request->rawRequest)) {
+                    requestStartTime = updatingDcStartTime;
+                    updatingDcStartTime = currentTime;
+                    timeout = 60;
+                }
+                if (request->startTime != 0 && abs(currentTime - requestStartTime) >= timeout) {
+                    if (LOGS_ENABLED) DEBUG_D("move %s to requestsQueue", typeid(*request->rawRequest).name());
+                    iter = moveRequestToQueue(iter);
+                    continue;
+                }
+                if (request->startTime != 0) {
+                    scheduleRunningRequestsCheck(requestStartTime + timeout);
+                }
             }
-            if (request->needInitRequest(requestDatacenter, currentVersion) && !request->hasInitFlag() && request->rawRequest->isNeedLayer()) {
-                if (LOGS_ENABLED) DEBUG_D("move %p - %s to requestsQueue because of initConnection", request->rawRequest, typeid(*request->rawRequest).name());
-                requestsQueue.push_back(std::move(*iter));
-                iter = runningRequests.erase(iter);
-                continue;
+            int32_t canUseUnboundKey = 0;
+            if ((request->requestFlags & RequestFlagUseUnboundKey) != 0) {
+                canUseUnboundKey |= 1;
             }
 
-            if (!requestDatacenter->hasAuthKey(request->connectionType, canUseUnboundKey)) {
-                std::pair<Datacenter *, ConnectionType> pair = std::make_pair(requestDatacenter, request->connectionType);
-                if (std::find(neededDatacenters.begin(), neededDatacenters.end(), pair) == neededDatacenters.end()) {
-                    neededDatacenters.push_back(pair);
+            Datacenter *requestDatacenter = getDatacenterWithId(datacenterId);
+            if (requestDatacenter == nullptr) {
+                if (std::find(unknownDatacenterIds.begin(), unknownDatacenterIds.end(), datacenterId) == unknownDatacenterIds.end()) {
+                    unknownDatacenterIds.push_back(datacenterId);
                 }
+                scheduleRunningRequestsCheck(currentTime + 1);
                 iter++;
                 continue;
-            } else if (!(request->requestFlags & RequestFlagEnableUnauthorized) && !requestDatacenter->authorized && request->datacenterId != DEFAULT_DATACENTER_ID && request->datacenterId != currentDatacenterId) {
-                if (std::find(unauthorizedDatacenters.begin(), unauthorizedDatacenters.end(), requestDatacenter) == unauthorizedDatacenters.end()) {
-                    unauthorizedDatacenters.push_back(requestDatacenter);
+            } else {
+                if (requestDatacenter->isCdnDatacenter) {
+                    request->requestFlags |= RequestFlagEnableUnauthorized;
+                }
+                if (request->needInitRequest(requestDatacenter, currentVersion) && !request->hasInitFlag() && request->rawRequest->isNeedLayer()) {
+                    if (LOGS_ENABLED) DEBUG_D("move %p - %s to requestsQueue because of initConnection", request->rawRequest, typeid(*request->rawRequest).name());
+                    iter = moveRequestToQueue(iter);
+                    continue;
+                }
+
+                if (!requestDatacenter->hasAuthKey(request->connectionType, canUseUnboundKey)) {
+                    std::pair<Datacenter *, ConnectionType> pair = std::make_pair(requestDatacenter, request->connectionType);
+                    if (std::find(neededDatacenters.begin(), neededDatacenters.end(), pair) == neededDatacenters.end()) {
+                        neededDatacenters.push_back(pair);
+                    }
+                    scheduleRunningRequestsCheck(currentTime + 1);
+                    iter++;
+                    continue;
+                } else if (!(request->requestFlags & RequestFlagEnableUnauthorized) && !requestDatacenter->authorized && request->datacenterId != DEFAULT_DATACENTER_ID && request->datacenterId != currentDatacenterId) {
+                    if (std::find(unauthorizedDatacenters.begin(), unauthorizedDatacenters.end(), requestDatacenter) == unauthorizedDatacenters.end()) {
+                        unauthorizedDatacenters.push_back(requestDatacenter);
+                    }
+                    scheduleRunningRequestsCheck(currentTime + 1);
+                    iter++;
+                    continue;
                 }
+            }
+
+            Connection *connection = requestDatacenter->getConnectionByType(request->connectionType, true, canUseUnboundKey);
+            int32_t maxTimeout = request->connectionType & ConnectionTypeGeneric ? 8 : 30;
+            if (!networkAvailable || connection->getConnectionToken() == 0) {
+                scheduleRunningRequestsCheck(currentTime + 1);
                 iter++;
                 continue;
             }
-        }
 
-        Connection *connection = requestDatacenter->getConnectionByType(request->connectionType, true, canUseUnboundKey);
-        int32_t maxTimeout = request->connectionType & ConnectionTypeGeneric ? 8 : 30;
-        if (!networkAvailable || connection->getConnectionToken() == 0) {
-            iter++;
-            continue;
-        }
+            uint32_t requestConnectionType = request->connectionType & 0x0000ffff;
 
-        uint32_t requestConnectionType = request->connectionType & 0x0000ffff;
+            bool forceThisRequest = (connectionTypes & requestConnectionType) && requestDatacenter->getDatacenterId() == dc;
 
-        bool forceThisRequest = (connectionTypes & requestConnectionType) && requestDatacenter->getDatacenterId() == dc;
-
-        if (typeInfo == typeid(TL_get_future_salts) || typeInfo == typeid(TL_destroy_session)) {
-            if (request->messageId != 0) {
-                request->addRespondMessageId(request->messageId);
+            if (typeInfo == typeid(TL_get_future_salts) || typeInfo == typeid(TL_destroy_session)) {
+                if (request->messageId != 0) {
+                    request->addRespondMessageId(request->messageId);
+                }
+                clearRunningRequest(request, false);
+                forceThisRequest = false;
             }
-            request->clear(false);
-            forceThisRequest = false;
-        }
 
-        if (forceThisRequest || (abs(currentTime - request->startTime) > maxTimeout &&
-                                 (currentTime >= request->minStartTime ||
-                                  (request->failedByFloodWait != 0 && (request->minStartTime - currentTime) > request->failedByFloodWait) ||
-                                  (request->failedByFloodWait == 0 && abs(currentTime - request->minStartTime) >= 60))
-        )
-                ) {
-            if (!forceThisRequest && request->connectionToken > 0) {
-                if ((request->connectionType & ConnectionTypeGeneric || request->connectionType & ConnectionTypeTemp) && request->connectionToken == connection->getConnectionToken()) {
-                    if (LOGS_ENABLED) DEBUG_D("request token is valid, not retrying %s (%p)", typeInfo.name(), request->rawRequest);
-                    iter++;
-                    continue;
-                } else {
-                    if (connection->getConnectionToken() != 0 && request->connectionToken == connection->getConnectionToken()) {
-                        if (LOGS_ENABLED) DEBUG_D("request download token is valid, not retrying %s (%p)", typeInfo.name(), request->rawRequest);
+            bool canStart = currentTime >= request->minStartTime ||
+                            (request->failedByFloodWait != 0 && (request->minStartTime - currentTime) > request->failedByFloodWait) ||
+                            (request->failedByFloodWait == 0 && abs(currentTime - request->minStartTime) >= 60);
+            if (forceThisRequest || (abs(currentTime - request->startTime) > maxTimeout && canStart)) {
+                if (!forceThisRequest && request->connectionToken > 0) {
+                    if ((request->connectionType & ConnectionTypeGeneric || request->connectionType & ConnectionTypeTemp) && request->connectionToken == connection->getConnectionToken()) {
+                        if (LOGS_ENABLED) DEBUG_D("request token is valid, not retrying %s (%p)", typeInfo.name(), request->rawRequest);
+                        scheduleRunningRequestsCheck(currentTime + 1);
                         iter++;
                         continue;
+                    } else {
+                        if (connection->getConnectionToken() != 0 && request->connectionToken == connection->getConnectionToken()) {
+                            if (LOGS_ENABLED) DEBUG_D("request download token is valid, not retrying %s (%p)", typeInfo.name(), request->rawRequest);
+                            scheduleRunningRequestsCheck(currentTime + 1);
+                            iter++;
+                            continue;
+                        }
                     }
                 }
-            }
 
-            if (request->connectionToken != 0 && request->connectionToken != connection->getConnectionToken()) {
-                request->lastResendTime = 0;
-            }
+                if (request->connectionToken != 0 && request->connectionToken != connection->getConnectionToken()) {
+                    request->lastResendTime = 0;
+                }
 
-            request->retryCount++;
+                request->retryCount++;
 
-            if (!request->failedBySalt) {
-                if (request->connectionType & ConnectionTypeDownload) {
-                    uint32_t retryMax = 10;
-                    if (!(request->requestFlags & RequestFlagForceDownload)) {
-                        if (request->failedByFloodWait) {
-                            retryMax = 1;
-                        } else {
-                            retryMax = 6;
+                if (!request->failedBySalt) {
+                    if (request->connectionType & ConnectionTypeDownload) {
+                        uint32_t retryMax = 10;
+                        if (!(request->requestFlags & RequestFlagForceDownload)) {
+                            if (request->failedByFloodWait) {
+                                retryMax = 1;
+                            } else {
+                                retryMax = 6;
+                            }
+                        }
+                        if (request->retryCount >= retryMax) {
+                            if (LOGS_ENABLED) DEBUG_E("timed out %s", typeInfo.name());
+                            TL_error *error = new TL_error();
+                            error->code = -123;
+                            error->text = "RETRY_LIMIT";
+                            request->onComplete(nullptr, error, connection->currentNetworkType);
+                            delete error;
+                            iter = removeRunningRequest(iter);
+                            continue;
                         }
                     }
-                    if (request->retryCount >= retryMax) {
-                        if (LOGS_ENABLED) DEBUG_E("timed out %s", typeInfo.name());
-                        TL_error *error = new TL_error();
-                        error->code = -123;
-                        error->text = "RETRY_LIMIT";
-                        request->onComplete(nullptr, error, connection->currentNetworkType);
-                        delete error;
-                        iter = runningRequests.erase(iter);
-                        continue;
-                    }
+                } else {
+                    request->failedBySalt = false;
                 }
-            } else {
-                request->failedBySalt = false;
-            }
 
-            if (request->messageSeqNo == 0) {
-                request->messageSeqNo = connection->generateMessageSeqNo((request->connectionType & ConnectionTypeProxy) == 0);
-                request->messageId = generateMessageId();
-                if (request->rawRequest->initFunc != nullptr) {
-                    request->rawRequest->initFunc(request->messageId);
+                if (request->messageSeqNo == 0) {
+                    request->messageSeqNo = connection->generateMessageSeqNo((request->connectionType & ConnectionTypeProxy) == 0);
+                    request->messageId = generateMessageId();
+                    indexRunningRequestMessageId(request);
+                    if (request->rawRequest->initFunc != nullptr) {
+                        request->rawRequest->initFunc(request->messageId);
+                    }
+                }
+                request->startTime = currentTime;
+                request->startTimeMillis = currentTimeMillis;
+                if (request->connectionType & ConnectionTypeDownload) {
+                    requestDatacenter->bandwidthEstimator.onRequestStarted(request);
                 }
-            }
-            request->startTime = currentTime;
-            request->startTimeMillis = currentTimeMillis;
-
-            NetworkMessage *networkMessage = new NetworkMessage();
-            networkMessage->message = std::unique_ptr<TL_message>(new TL_message());
-            networkMessage->message->msg_id = request->messageId;
-            networkMessage->message->bytes = request->serializedLength;
-            networkMessage->message->outgoingBody = request->getRpcRequest();
-            networkMessage->message->seqno = request->messageSeqNo;
-            networkMessage->requestId = request->requestToken;
-            networkMessage->invokeAfter = (request->requestFlags & RequestFlagInvokeAfter) != 0;
-            networkMessage->needQuickAck = (request->requestFlags & RequestFlagNeedQuickAck) != 0;
 
-            request->connectionToken = connection->getConnectionToken();
-            switch (requestConnectionType) {
-                case ConnectionTypeGeneric:
-                    addMessageToDatacenter(requestDatacenter->getDatacenterId(), networkMessage, genericMessagesToDatacenters);
-                    break;
-                case ConnectionTypeGenericMedia:
-                    addMessageToDatacenter(requestDatacenter->getDatacenterId(), networkMessage, genericMediaMessagesToDatacenters);
-                    break;
-                case ConnectionTypeTemp:
-                    addMessageToDatacenter(requestDatacenter->getDatacenterId(), networkMessage, tempMessagesToDatacenters);
-                    break;
-                case ConnectionTypeProxy: {
-                    std::vector<std::unique_ptr<NetworkMessage>> array;
-                    array.push_back(std::unique_ptr<NetworkMessage>(networkMessage));
-                    sendMessagesToConnection(array, connection, false);
-                    break;
+                NetworkMessage *networkMessage = new NetworkMessage();
+                networkMessage->message = std::unique_ptr<TL_message>(new TL_message());
+                networkMessage->message->msg_id = request->messageId;
+                networkMessage->message->bytes = request->serializedLength;
+                networkMessage->message->outgoingBody = request->getRpcRequest();
+                networkMessage->message->seqno = request->messageSeqNo;
+                networkMessage->requestId = request->requestToken;
+                networkMessage->invokeAfter = (request->requestFlags & RequestFlagInvokeAfter) != 0;
+                networkMessage->needQuickAck = (request->requestFlags & RequestFlagNeedQuickAck) != 0;
+
+                setRunningRequestConnectionToken(request, connection->getConnectionToken());
+                switch (requestConnectionType) {
+                    case ConnectionTypeGeneric:
+                        addMessageToDatacenter(requestDatacenter->getDatacenterId(), networkMessage, genericMessagesToDatacenters);
+                        break;
+                    case ConnectionTypeGenericMedia:
+                        addMessageToDatacenter(requestDatacenter->getDatacenterId(), networkMessage, genericMediaMessagesToDatacenters);
+                        break;
+                    case ConnectionTypeTemp:
+                        addMessageToDatacenter(requestDatacenter->getDatacenterId(), networkMessage, tempMessagesToDatacenters);
+                        break;
+                    case ConnectionTypeProxy: {
+                        std::vector<std::unique_ptr<NetworkMessage>> array;
+                        array.push_back(std::unique_ptr<NetworkMessage>(networkMessage));
+                        sendMessagesToConnection(array, connection, false);
+                        break;
+                    }
+                    case ConnectionTypeDownload:
+                    case ConnectionTypeUpload: {
+                        std::vector<std::unique_ptr<NetworkMessage>> array;
+                        array.push_back(std::unique_ptr<NetworkMessage>(networkMessage));
+                        sendMessagesToConnectionWithConfirmation(array, connection, false);
+                        request->onWriteToSocket();
+                        break;
+                    }
+                    default:
+                        delete networkMessage;
                 }
-                case ConnectionTypeDownload:
-                case ConnectionTypeUpload: {
-                    std::vector<std::unique_ptr<NetworkMessage>> array;
-                    array.push_back(std::unique_ptr<NetworkMessage>(networkMessage));
-                    sendMessagesToConnectionWithConfirmation(array, connection, false);
-                    request->onWriteToSocket();
-                    break;
+            } else {
+                int32_t retryTime = request->startTime + maxTimeout + 1;
+                if (!canStart && request->minStartTime > retryTime) {
+                    retryTime = request->minStartTime;
                 }
-                default:
-                    delete networkMessage;
+                scheduleRunningRequestsCheck(retryTime);
             }
+            iter++;
         }
-        iter++;
     }
 
     Connection *genericConnection = nullptr;
@@ -2278,202 +2454,213 @@ void ConnectionsManager::processRequestQueue(uint32_t connectionTypes, uint32_t
         }
     }
 
-    for (requestsIter iter = requestsQueue.begin(); iter != requestsQueue.end();) {
-        Request *request = iter->get();
-        if (request->cancelled) {
-            iter = requestsQueue.erase(iter);
-            continue;
-        }
-
-        uint32_t datacenterId = request->datacenterId;
-        if (datacenterId == DEFAULT_DATACENTER_ID) {
-            if (movingToDatacenterId != DEFAULT_DATACENTER_ID) {
-                iter++;
+    if (requestsQueueChanged) {
+        requestsQueueChanged = false;
+        for (requestsIter iter = requestsQueue.begin(); iter != requestsQueue.end();) {
+            Request *request = iter->get();
+            if (request->cancelled) {
+                iter = removeQueuedRequest(iter);
                 continue;
             }
-            datacenterId = currentDatacenterId;
-        }
 
-        int32_t canUseUnboundKey = 0;
-        if ((request->requestFlags & RequestFlagUseUnboundKey) != 0) {
-            canUseUnboundKey |= 1;
-        }
-
-        if (request->requestFlags & RequestFlagTryDifferentDc) {
-            int32_t requestStartTime = request->startTime;
-            int32_t timeout = 30;
-            if (updatingDcSettings && dynamic_cast<TL_help_getConfig *>(request->rawRequest)) {
-                requestStartTime = updatingDcStartTime;
-                timeout = 60;
-            } else {
-                request->startTime = 0;
-                request->startTimeMillis = 0;
-            }
-            if (requestStartTime != 0 && abs(currentTime - requestStartTime) >= timeout) {
-                std::vector<uint32_t> allDc;
-                for (std::map<uint32_t, Datacenter *>::iterator iter2 = datacenters.begin(); iter2 != datacenters.end(); iter2++) {
-                    if (iter2->first == datacenterId || iter2->second->isCdnDatacenter) {
-                        continue;
-                    }
-                    allDc.push_back(iter2->first);
-                }
-                uint8_t index;
-                RAND_bytes(&index, 1);
-                datacenterId = allDc[index % allDc.size()];
-                if (dynamic_cast<TL_help_getConfig *>(request->rawRequest)) {
-                    updatingDcStartTime = currentTime;
-                    request->datacenterId = datacenterId;
-                } else {
-                    currentDatacenterId = datacenterId;
+            uint32_t datacenterId = request->datacenterId;
+            if (datacenterId == DEFAULT_DATACENTER_ID) {
+                if (movingToDatacenterId != DEFAULT_DATACENTER_ID) {
+                    requestsQueueChanged = true;
+                    iter++;
+                    continue;
                 }
+                datacenterId = currentDatacenterId;
             }
-        }
 
-        Datacenter *requestDatacenter = getDatacenterWithId(datacenterId);
-        if (requestDatacenter == nullptr) {
-            if (std::find(unknownDatacenterIds.begin(), unknownDatacenterIds.end(), datacenterId) == unknownDatacenterIds.end()) {
-                unknownDatacenterIds.push_back(datacenterId);
+            int32_t canUseUnboundKey = 0;
+            if ((request->requestFlags & RequestFlagUseUnboundKey) != 0) {
+                canUseUnboundKey |= 1;
             }
-            iter++;
-            continue;
-        } else {
-            if (request->needInitRequest(requestDatacenter, currentVersion) && !request->hasInitFlag()) {
-                request->rpcRequest.release();
-                request->rpcRequest = wrapInLayer(request->rawRequest, requestDatacenter, request);
+
+            if (request->requestFlags & RequestFlagTryDifferentDc) {
+                int32_t requestStartTime = request->startTime;
+                int32_t timeout = 30;
+                if (updatingDcSettings && dynamic_cast<TL_help_getConfig *>(request->rawRequest)) {
+                    requestStartTime = updatingDcStartTime;
+                    timeout = 60;
+                    requestsQueueChanged = true;
+                } else {
+                    request->startTime = 0;
+                    request->startTimeMillis = 0;
+                }
+                if (requestStartTime != 0 && abs(currentTime - requestStartTime) >= timeout) {
+                    std::vector<uint32_t> allDc;
+                    for (std::map<uint32_t, Datacenter *>::iterator iter2 = datacenters.begin(); iter2 != datacenters.end(); iter2++) {
+                        if (iter2->first == datacenterId || iter2->second->isCdnDatacenter) {
+                            continue;
+                        }
+                        allDc.push_back(iter2->first);
+                    }
+                    uint8_t index;
+                    RAND_bytes(&index, 1);
+                    datacenterId = allDc[index % allDc.size()];
+                    if (dynamic_cast<TL_help_getConfig *>(request->rawRequest)) {
+                        updatingDcStartTime = currentTime;
+                        request->datacenterId = datacenterId;
+                    } else {
+                        currentDatacenterId = datacenterId;
+                    }
+                }
             }
 
-            if (!requestDatacenter->hasAuthKey(request->connectionType, canUseUnboundKey)) {
-                std::pair<Datacenter *, ConnectionType> pair = std::make_pair(requestDatacenter, request->connectionType);
-                if (std::find(neededDatacenters.begin(), neededDatacenters.end(), pair) == neededDatacenters.end()) {
-                    neededDatacenters.push_back(pair);
+            Datacenter *requestDatacenter = getDatacenterWithId(datacenterId);
+            if (requestDatacenter == nullptr) {
+                if (std::find(unknownDatacenterIds.begin(), unknownDatacenterIds.end(), datacenterId) == unknownDatacenterIds.end()) {
+                    unknownDatacenterIds.push_back(datacenterId);
                 }
+                requestsQueueChanged = true;
                 iter++;
                 continue;
-            } else if (!(request->requestFlags & RequestFlagEnableUnauthorized) && !requestDatacenter->authorized && request->datacenterId != DEFAULT_DATACENTER_ID && request->datacenterId != currentDatacenterId) {
-                if (std::find(unauthorizedDatacenters.begin(), unauthorizedDatacenters.end(), requestDatacenter) == unauthorizedDatacenters.end()) {
-                    unauthorizedDatacenters.push_back(requestDatacenter);
+            } else {
+                if (request->needInitRequest(requestDatacenter, currentVersion) && !request->hasInitFlag()) {
+                    request->rpcRequest.release();
+                    request->rpcRequest = wrapInLayer(request->rawRequest, requestDatacenter, request);
                 }
-                iter++;
-                continue;
-            }
-        }
-
-        Connection *connection = requestDatacenter->getConnectionByType(request->connectionType, true, canUseUnboundKey);
-
-        if (request->connectionType & ConnectionTypeGeneric && connection->getConnectionToken() == 0) {
-            iter++;
-            continue;
-        }
 
-        switch (request->connectionType & 0x0000ffff) {
-            case ConnectionTypeGeneric:
-            case ConnectionTypeGenericMedia:
-                if (!canUseUnboundKey && genericRunningRequestCount >= 60) {
+                if (!requestDatacenter->hasAuthKey(request->connectionType, canUseUnboundKey)) {
+                    std::pair<Datacenter *, ConnectionType> pair = std::make_pair(requestDatacenter, request->connectionType);
+                    if (std::find(neededDatacenters.begin(), neededDatacenters.end(), pair) == neededDatacenters.end()) {
+                        neededDatacenters.push_back(pair);
+                    }
+                    requestsQueueChanged = true;
                     iter++;
                     continue;
-                }
-                genericRunningRequestCount++;
-                break;
-            case ConnectionTypeDownload: {
-                uint32_t currentCount;
-                std::map<uint32_t, uint32_t>::iterator dcIter = downloadRunningRequestCount.find(datacenterId);
-                if (dcIter != downloadRunningRequestCount.end()) {
-                    currentCount = dcIter->second;
-                } else {
-                    currentCount = 0;
-                }
-                if (!networkAvailable || currentCount >= 6) {
+                } else if (!(request->requestFlags & RequestFlagEnableUnauthorized) && !requestDatacenter->authorized && request->datacenterId != DEFAULT_DATACENTER_ID && request->datacenterId != currentDatacenterId) {
+                    if (std::find(unauthorizedDatacenters.begin(), unauthorizedDatacenters.end(), requestDatacenter) == unauthorizedDatacenters.end()) {
+                        unauthorizedDatacenters.push_back(requestDatacenter);
+                    }
+                    requestsQueueChanged = true;
                     iter++;
                     continue;
                 }
-                downloadRunningRequestCount[datacenterId] = currentCount + 1;
-                break;
             }
-            case ConnectionTypeProxy:
-            case ConnectionTypeTemp:
-                if (!networkAvailable) {
-                    iter++;
-                    continue;
+
+            Connection *connection = requestDatacenter->getConnectionByType(request->connectionType, true, canUseUnboundKey);
+
+            if (request->connectionType & ConnectionTypeGeneric && connection->getConnectionToken() == 0) {
+                requestsQueueChanged = true;
+                iter++;
+                continue;
+            }
+
+            if (!networkAvailable && (request->connectionType & (ConnectionTypeDownload | ConnectionTypeUpload | ConnectionTypeProxy | ConnectionTypeTemp))) {
+                requestsQueueChanged = true;
+                iter++;
+                continue;
+            }
+            switch (request->connectionType & 0x0000ffff) {
+                case ConnectionTypeGeneric:
+                case ConnectionTypeGenericMedia:
+                    if (!canUseUnboundKey && genericRunningRequestCount >= 60) {
+                        iter++;
+                        continue;
+                    }
+                    break;
+                case ConnectionTypeDownload:
+                    if (getDownloadRunningRequestCount(datacenterId) >= DOWNLOAD_DC_MAX_REQUESTS) {
+                        iter++;
+                        continue;
+                    }
+                    break;
+                case ConnectionTypeUpload:
+                    if (uploadRunningRequestCount >= 10) {
+                        iter++;
+                        continue;
+                    }
+                    break;
+                default:
+                    break;
+            }
+
+            request->messageId = generateMessageId();
+            if (request->rawRequest->initFunc != nullptr) {
+                request->rawRequest->initFunc(request->messageId);
+            }
+
+            uint32_t requestLength = request->rpcRequest->getObjectSize();
+            int32_t compressionLevel = 0;
+            uint32_t requestType = 0;
+            if (request->requestFlags & RequestFlagCanCompress) {
+                request->requestFlags &= ~RequestFlagCanCompress;
+                TL_api_request *apiRequest = dynamic_cast<TL_api_request *>(request->rawRequest);
+                if (apiRequest != nullptr && apiRequest->request->limit() >= 4) {
+                    requestType = *((uint32_t *) apiRequest->request->bytes());
                 }
-                break;
-            case ConnectionTypeUpload:
-                if (!networkAvailable || uploadRunningRequestCount >= 10) {
-                    iter++;
-                    continue;
+                compressionLevel = compressionPolicy.getCompressionLevel(requestType, apiRequest != nullptr ? apiRequest->request : nullptr, requestLength, currentNetworkType, networkSlow);
+            }
+            if (compressionLevel != 0) {
+                NativeByteBuffer *original = BuffersStorage::getInstance().getFreeBuffer(requestLength);
+                request->rpcRequest->serializeToStream(original);
+                int64_t compressStartTime = getCurrentTimeMonotonicMicros();
+                NativeByteBuffer *buffer = compressGZip(original, compressionLevel);
+                compressionPolicy.onCompressed(requestType, requestLength, buffer != nullptr ? buffer->limit() : requestLength, getCurrentTimeMonotonicMicros() - compressStartTime);
+                if (buffer != nullptr) {
+                    TL_gzip_packed *packed = new TL_gzip_packed();
+                    packed->originalRequest = std::move(request->rpcRequest);
+                    packed->packed_data_to_send = buffer;
+                    request->rpcRequest = std::unique_ptr<TLObject>(packed);
+                    requestLength = packed->getObjectSize();
                 }
-                uploadRunningRequestCount++;
-                break;
-            default:
-                break;
-        }
+                original->reuse();
+            }
 
-        request->messageId = generateMessageId();
-        if (request->rawRequest->initFunc != nullptr) {
-            request->rawRequest->initFunc(request->messageId);
-        }
-
-        uint32_t requestLength = request->rpcRequest->getObjectSize();
-        if (request->requestFlags & RequestFlagCanCompress) {
-            request->requestFlags &= ~RequestFlagCanCompress;
-            NativeByteBuffer *original = BuffersStorage::getInstance().getFreeBuffer(requestLength);
-            request->rpcRequest->serializeToStream(original);
-            NativeByteBuffer *buffer = compressGZip(original);
-            if (buffer != nullptr) {
-                TL_gzip_packed *packed = new TL_gzip_packed();
-                packed->originalRequest = std::move(request->rpcRequest);
-                packed->packed_data_to_send = buffer;
-                request->rpcRequest = std::unique_ptr<TLObject>(packed);
-                requestLength = packed->getObjectSize();
-            }
-            original->reuse();
-        }
-
-        request->serializedLength = requestLength;
-        request->messageSeqNo = connection->generateMessageSeqNo((request->connectionType & ConnectionTypeProxy) == 0);
-        request->startTime = currentTime;
-        request->startTimeMillis = currentTimeMillis;
-        request->connectionToken = connection->getConnectionToken();
-
-        NetworkMessage *networkMessage = new NetworkMessage();
-        networkMessage->message = std::unique_ptr<TL_message>(new TL_message());
-        networkMessage->message->msg_id = request->messageId;
-        networkMessage->message->bytes = request->serializedLength;
-        networkMessage->message->outgoingBody = request->getRpcRequest();
-        networkMessage->message->seqno = request->messageSeqNo;
-        networkMessage->requestId = request->requestToken;
-        networkMessage->invokeAfter = (request->requestFlags & RequestFlagInvokeAfter) != 0;
-        networkMessage->needQuickAck = (request->requestFlags & RequestFlagNeedQuickAck) != 0;
-
-        runningRequests.push_back(std::move(*iter));
-
-        switch (request->connectionType & 0x0000ffff) {
-            case ConnectionTypeGeneric:
-                addMessageToDatacenter(requestDatacenter->getDatacenterId(), networkMessage, genericMessagesToDatacenters);
-                break;
-            case ConnectionTypeGenericMedia:
-                addMessageToDatacenter(requestDatacenter->getDatacenterId(), networkMessage, genericMediaMessagesToDatacenters);
-                break;
-            case ConnectionTypeTemp:
-                addMessageToDatacenter(requestDatacenter->getDatacenterId(), networkMessage, tempMessagesToDatacenters);
-                break;
-            case ConnectionTypeProxy: {
-                std::vector<std::unique_ptr<NetworkMessage>> array;
-                array.push_back(std::unique_ptr<NetworkMessage>(networkMessage));
-                sendMessagesToConnection(array, connection, false);
-                break;
+            request->serializedLength = requestLength;
+            request->messageSeqNo = connection->generateMessageSeqNo((request->connectionType & ConnectionTypeProxy) == 0);
+            request->startTime = currentTime;
+            request->startTimeMillis = currentTimeMillis;
+            if (request->connectionType & ConnectionTypeDownload) {
+                requestDatacenter->bandwidthEstimator.onRequestStarted(request);
             }
-            case ConnectionTypeDownload:
-            case ConnectionTypeUpload: {
-                std::vector<std::unique_ptr<NetworkMessage>> array;
-                array.push_back(std::unique_ptr<NetworkMessage>(networkMessage));
-                sendMessagesToConnectionWithConfirmation(array, connection, false);
-                break;
+            request->connectionToken = connection->getConnectionToken();
+            request->runningDatacenterId = datacenterId;
+
+            NetworkMessage *networkMessage = new NetworkMessage();
+            networkMessage->message = std::unique_ptr<TL_message>(new TL_message());
+            networkMessage->message->msg_id = request->messageId;
+            networkMessage->message->bytes = request->serializedLength;
+            networkMessage->message->outgoingBody = request->getRpcRequest();
+            networkMessage->message->seqno = request->messageSeqNo;
+            networkMessage->requestId = request->requestToken;
+            networkMessage->invokeAfter = (request->requestFlags & RequestFlagInvokeAfter) != 0;
+            networkMessage->needQuickAck = (request->requestFlags & RequestFlagNeedQuickAck) != 0;
+
+            requestsIter next = moveRequestToRunning(iter);
+
+            switch (request->connectionType & 0x0000ffff) {
+                case ConnectionTypeGeneric:
+                    addMessageToDatacenter(requestDatacenter->getDatacenterId(), networkMessage, genericMessagesToDatacenters);
+                    break;
+                case ConnectionTypeGenericMedia:
+                    addMessageToDatacenter(requestDatacenter->getDatacenterId(), networkMessage, genericMediaMessagesToDatacenters);
+                    break;
+                case ConnectionTypeTemp:
+                    addMessageToDatacenter(requestDatacenter->getDatacenterId(), networkMessage, tempMessagesToDatacenters);
+                    break;
+                case ConnectionTypeProxy: {
+                    std::vector<std::unique_ptr<NetworkMessage>> array;
+                    array.push_back(std::unique_ptr<NetworkMessage>(networkMessage));
+                    sendMessagesToConnection(array, connection, false);
+                    break;
+                }
+                case ConnectionTypeDownload:
+                case ConnectionTypeUpload: {
+                    std::vector<std::unique_ptr<NetworkMessage>> array;
+                    array.push_back(std::unique_ptr<NetworkMessage>(networkMessage));
+                    sendMessagesToConnectionWithConfirmation(array, connection, false);
+                    break;
+                }
+                default:
+                    delete networkMessage;
             }
-            default:
-                delete networkMessage;
-        }
 
-        iter = requestsQueue.erase(iter);
+            iter = next;
+        }
     }
 
     for (std::map<uint32_t, Datacenter *>::iterator iter = datacenters.begin(); iter != datacenters.end(); iter++) {
@@ -3043,7 +3230,7 @@ void ConnectionsManager::init(uint32_t version, int32_t layer, int32_t apiId, st
         saveConfig();
     }
 
-    pthread_create(&networkThread, NULL, (ConnectionsManager::ThreadProc), this);
+    reactor->attach(this);
 
     if (needLoadConfig) {
         updateDcSettings(0, false);
@@ -3179,6 +3366,19 @@ int32_t ConnectionsManager::getMtProtoVersion() {
     return mtProtoVersion;
 }
 
+void ConnectionsManager::getCompressionStats(CompressionStats *stats) {
+    compressionPolicy.getStats(stats);
+}
+
+bool ConnectionsManager::getBandwidthEstimate(uint32_t datacenterId, BandwidthEstimate *estimate) {
+    Datacenter *datacenter = getDatacenterWithId(datacenterId);
+    if (datacenter == nullptr) {
+        return false;
+    }
+    datacenter->bandwidthEstimator.getEstimate(estimate, getCurrentTimeMonotonicMillis());
+    return true;
+}
+
 int64_t ConnectionsManager::checkProxy(std::string address, uint16_t port, std::string username, std::string password, std::string secret, onRequestTimeFunc requestTimeFunc, jobject ptr1) {
     ProxyCheckInfo *proxyCheckInfo = new ProxyCheckInfo();
     proxyCheckInfo->address = address;
@@ -3257,6 +3457,14 @@ void ConnectionsManager::useJavaVM(JavaVM *vm, bool useJavaByteBuffers) {
             if (LOGS_ENABLED) DEBUG_E("can't find java ByteBuffer allocateDirect");
             exit(1);
         }
+        jclass_ByteBuffer_duplicate = env->GetMethodID(jclass_ByteBuffer, "duplicate", "()Ljava/nio/ByteBuffer;");
+        jclass_ByteBuffer_slice = env->GetMethodID(jclass_ByteBuffer, "slice", "()Ljava/nio/ByteBuffer;");
+        jclass_Buffer_position = env->GetMethodID(jclass_ByteBuffer, "position", "(I)Ljava/nio/Buffer;");
+        jclass_Buffer_limit = env->GetMethodID(jclass_ByteBuffer, "limit", "(I)Ljava/nio/Buffer;");
+        if (jclass_ByteBuffer_duplicate == 0 || jclass_ByteBuffer_slice == 0 || jclass_Buffer_position == 0 || jclass_Buffer_limit == 0) {
+            if (LOGS_ENABLED) DEBUG_E("can't find java ByteBuffer slice methods");
+            exit(1);
+        }
         if (LOGS_ENABLED) DEBUG_D("using java ByteBuffer");
     }
 }
@@ -10,13 +10,18 @@
 #define CONNECTIONSMANAGER_H
 
 #include <pthread.h>
-#include <queue>
 #include <functional>
 #include <sys/epoll.h>
 #include <map>
+#include <unordered_map>
 #include <atomic>
 // #include <bits/unique_ptr.h>
 #include "Defines.h"
+#include "TimerWheel.h"
+#include "TaskQueue.h"
+#include "CompressionPolicy.h"
+#include "BandwidthEstimator.h"
+#include "DownloadScheduler.h"
 
 #ifdef ANDROID
 #include <jni.h>
@@ -35,6 +40,7 @@ class TL_config;
 class EventObject;
 class Config;
 class ProxyCheckInfo;
+class NetworkReactor;
 
 class ConnectionsManager {
 
@@ -43,8 +49,11 @@ public:
     ~ConnectionsManager();
 
     static ConnectionsManager &getInstance(int32_t instanceNum);
+    static void useSharedNetworkThreads(uint32_t count);
+    static void useIoUring(bool value);
     int64_t getCurrentTimeMillis();
     int64_t getCurrentTimeMonotonicMillis();
+    int64_t getCurrentTimeMonotonicMicros();
     int32_t getCurrentTime();
     bool isTestBackend();
     int32_t getTimeDifference();
@@ -72,6 +81,8 @@ public:
     void applyDnsConfig(NativeByteBuffer *buffer, std::string phone);
     void setMtProtoVersion(int version);
     int32_t getMtProtoVersion();
+    void getCompressionStats(CompressionStats *stats);
+    bool getBandwidthEstimate(uint32_t datacenterId, BandwidthEstimate *estimate);
     int64_t checkProxy(std::string address, uint16_t port, std::string username, std::string password, std::string secret, onRequestTimeFunc requestTimeFunc, jobject ptr1);
 
 #ifdef ANDROID
@@ -80,13 +91,12 @@ public:
 #endif
 
 private:
-    static void *ThreadProc(void *data);
-
     void initDatacenters();
     void loadConfig();
     void saveConfig();
     void saveConfigInternal(NativeByteBuffer *buffer);
-    void select();
+    void onNetworkThreadAttached();
+    void onSelectFinished(int64_t now);
     void wakeup();
     void processServerResponse(TLObject *message, int64_t messageId, int32_t messageSeqNo, int64_t messageSalt, Connection *connection, int64_t innerMsgId, int64_t containerMessageId);
     void sendPing(Datacenter *datacenter, bool usePushConnection);
@@ -96,6 +106,9 @@ private:
     void clearRequestsForDatacenter(Datacenter *datacenter, HandshakeType type);
     void registerForInternalPushUpdates();
     void processRequestQueue(uint32_t connectionType, uint32_t datacenterId);
+    void dispatchRequestQueue(uint32_t connectionType, uint32_t datacenterId);
+    void scheduleRunningRequestsCheck(int32_t time);
+    uint32_t getDownloadRunningRequestCount(uint32_t datacenterId);
     void moveToDatacenter(uint32_t datacenterId);
     void authorizeOnMovingDatacenter();
     void authorizedOnMovingDatacenter();
@@ -107,18 +120,37 @@ private:
     int32_t sendRequestInternal(TLObject *object, onCompleteFunc onComplete, onQuickAckFunc onQuickAck, uint32_t flags, uint32_t datacenterId, ConnectionType connetionType, bool immediate);
 
     void checkPendingTasks();
-    void scheduleTask(std::function<void()> task);
+    void scheduleTask(Task &&task);
     void scheduleEvent(EventObject *eventObject, uint32_t time);
     void removeEvent(EventObject *eventObject);
     void onConnectionClosed(Connection *connection, int reason);
     void onConnectionConnected(Connection *connection);
     void onConnectionQuickAckReceived(Connection *connection, int32_t ack);
     void onConnectionDataReceived(Connection *connection, NativeByteBuffer *data, uint32_t length);
+    void onEncryptedPacketDecrypted(Connection *connection, EncryptedPacket *packet);
+    void processPendingPackets(Connection *connection);
+    void processDecryptedPacket(Connection *connection, NativeByteBuffer *data, uint32_t mark);
     bool hasPendingRequestsForConnection(Connection *connection);
     void attachConnection(ConnectionSocket *connection);
     void detachConnection(ConnectionSocket *connection);
+    void scheduleSocketFlush(ConnectionSocket *connection);
+    void flushSockets();
     TLObject *TLdeserialize(TLObject *request, uint32_t bytes, NativeByteBuffer *data);
     TLObject *getRequestWithMessageId(int64_t messageId);
+    Request *getRunningRequestRespondingTo(int64_t messageId);
+    Request *getRequestWithToken(int32_t token);
+    Request *getRunningRequestWithToken(int32_t token);
+    void addRequestToQueue(Request *request);
+    requestsIter removeQueuedRequest(requestsIter iter);
+    requestsIter removeRunningRequest(requestsIter iter);
+    requestsIter moveRequestToRunning(requestsIter iter);
+    requestsIter moveRequestToQueue(requestsIter iter);
+    void removeRequestTokenIndex(Request *request);
+    void addRunningRequestIndex(Request *request);
+    void removeRunningRequestIndex(Request *request);
+    void indexRunningRequestMessageId(Request *request);
+    void setRunningRequestConnectionToken(Request *request, uint32_t token);
+    void clearRunningRequest(Request *request, bool time);
     void onDatacenterHandshakeComplete(Datacenter *datacenter, HandshakeType type, int32_t timeDiff);
     void onDatacenterExportAuthorizationComplete(Datacenter *datacenter);
     int64_t generateMessageId();
@@ -131,10 +163,10 @@ private:
     uint32_t configVersion = 4;
     Config *config = nullptr;
 
-    std::list<EventObject *> events;
+    TimerWheel events;
 
     std::map<uint32_t, Datacenter *> datacenters;
-    std::map<int32_t, std::vector<std::int32_t>> quickAckIdToRequestIds;
+    std::unordered_map<int32_t, std::vector<std::int32_t>> quickAckIdToRequestIds;
     int32_t pingTime;
     bool testBackend = false;
     bool clientBlocked = true;
@@ -176,10 +208,8 @@ private:
     std::vector<std::unique_ptr<ProxyCheckInfo>> proxyCheckQueue;
     std::vector<std::unique_ptr<ProxyCheckInfo>> proxyActiveChecks;
 
-    pthread_t networkThread;
-    pthread_mutex_t mutex;
-    std::queue<std::function<void()>> pendingTasks;
-    struct epoll_event *epollEvents;
+    NetworkReactor *reactor;
+    TaskQueue pendingTasks;
     timespec timeSpec;
     timespec timeSpecMonotonic;
     int32_t timeDifference = 0;
@@ -188,15 +218,24 @@ private:
     bool networkSlow = false;
     bool ipv6Enabled = false;
     std::vector<ConnectionSocket *> activeConnections;
-    int epolFd;
-    int eventFd;
-    int *pipeFd;
+    std::vector<ConnectionSocket *> socketsToFlush;
     NativeByteBuffer *networkBuffer;
 
     requestsList requestsQueue;
     requestsList runningRequests;
+    std::unordered_map<int32_t, Request *> requestsByToken;
+    std::unordered_map<int64_t, Request *> runningRequestsByMessageId;
+    std::unordered_map<uint32_t, uint32_t> runningRequestsCountByConnectionToken;
+    std::unordered_map<uint32_t, uint32_t> runningRequestsCountByConnectionType;
+    std::map<uint32_t, uint32_t> downloadRunningRequestCount;
+    uint32_t genericRunningRequestCount = 0;
+    uint32_t uploadRunningRequestCount = 0;
+    int32_t nextRunningRequestsCheckTime = 0;
+    bool requestsQueueChanged = true;
     std::vector<uint32_t> requestingSaltsForDc;
     int32_t lastPingId = 0;
+    CompressionPolicy compressionPolicy;
+    DownloadScheduler downloadScheduler;
 
     int32_t currentNetworkType = NETWORK_TYPE_WIFI;
     uint32_t currentVersion = 1;
@@ -219,7 +258,6 @@ private:
     std::map<uint32_t, std::vector<std::unique_ptr<NetworkMessage>>> tempMessagesToDatacenters;
     std::vector<uint32_t> unknownDatacenterIds;
     std::vector<std::pair<Datacenter *, ConnectionType>> neededDatacenters;
-    std::map<uint32_t, uint32_t> downloadRunningRequestCount;
     std::vector<Datacenter *> unauthorizedDatacenters;
     NativeByteBuffer *sizeCalculator;
 
@@ -230,19 +268,26 @@ private:
     friend class Connection;
     friend class Timer;
     friend class Datacenter;
+    friend class DownloadScheduler;
     friend class TL_message;
     friend class TL_rpc_result;
     friend class Config;
     friend class FileLoadOperation;
+    friend class FileUploadOperation;
     friend class FileLog;
     friend class Handshake;
+    friend class NetworkReactor;
 };
 
 #ifdef ANDROID
 extern JavaVM *javaVm;
-extern JNIEnv *jniEnv[MAX_ACCOUNT_COUNT];
+extern JNIEnv *jniEnv[MAX_INSTANCE_COUNT];
 extern jclass jclass_ByteBuffer;
 extern jmethodID jclass_ByteBuffer_allocateDirect;
+extern jmethodID jclass_ByteBuffer_duplicate;
+extern jmethodID jclass_ByteBuffer_slice;
+extern jmethodID jclass_Buffer_position;
+extern jmethodID jclass_Buffer_limit;
 #endif
 
 #endif
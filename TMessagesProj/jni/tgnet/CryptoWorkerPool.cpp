@@ -0,0 +1,93 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#include <stdlib.h>
+#include "CryptoWorkerPool.h"
+#include "FileLog.h"
+#include "Defines.h"
+
+CryptoWorkerPool &CryptoWorkerPool::getInstance() {
+    static CryptoWorkerPool instance;
+    return instance;
+}
+
+CryptoWorkerPool::CryptoWorkerPool() {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&condition, NULL);
+}
+
+void CryptoWorkerPool::post(Task &&task) {
+    pthread_mutex_lock(&mutex);
+    if (!threadsStarted) {
+        startThreads();
+    }
+    tasks.push_back(std::move(task));
+    pthread_mutex_unlock(&mutex);
+    pthread_cond_signal(&condition);
+}
+
+void CryptoWorkerPool::postAesIge(AesIgeStream &stream, bool encrypt, Task &&completion) {
+    pthread_mutex_lock(&mutex);
+    if (!threadsStarted) {
+        startThreads();
+    }
+    aesIgeJobs.emplace_back();
+    AesIgeJob &job = aesIgeJobs.back();
+    job.stream = stream;
+    job.encrypt = encrypt;
+    job.completion = std::move(completion);
+    pthread_mutex_unlock(&mutex);
+    pthread_cond_signal(&condition);
+}
+
+void CryptoWorkerPool::startThreads() {
+    for (uint32_t a = 0; a < CRYPTO_WORKERS_COUNT; a++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, CryptoWorkerPool::ThreadProc, this) != 0) {
+            if (LOGS_ENABLED) DEBUG_E("can't create crypto worker thread");
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+    threadsStarted = true;
+}
+
+void *CryptoWorkerPool::ThreadProc(void *data) {
+    CryptoWorkerPool *pool = (CryptoWorkerPool *) data;
+    AesIgeStream streams[AES_IGE_MAX_STREAMS];
+    Task completions[AES_IGE_MAX_STREAMS];
+    while (true) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->tasks.empty() && pool->aesIgeJobs.empty()) {
+            pthread_cond_wait(&pool->condition, &pool->mutex);
+        }
+        if (!pool->aesIgeJobs.empty()) {
+            bool encrypt = pool->aesIgeJobs.front().encrypt;
+            uint32_t count = 0;
+            while (count < AES_IGE_MAX_STREAMS && !pool->aesIgeJobs.empty() && pool->aesIgeJobs.front().encrypt == encrypt) {
+                AesIgeJob &job = pool->aesIgeJobs.front();
+                streams[count] = job.stream;
+                completions[count] = std::move(job.completion);
+                pool->aesIgeJobs.pop_front();
+                count++;
+            }
+            pthread_mutex_unlock(&pool->mutex);
+            AesIge::process(streams, count, encrypt);
+            for (uint32_t a = 0; a < count; a++) {
+                completions[a]();
+                completions[a].reset();
+            }
+            continue;
+        }
+        Task task = std::move(pool->tasks.front());
+        pool->tasks.pop_front();
+        pthread_mutex_unlock(&pool->mutex);
+        task();
+    }
+    return nullptr;
+}
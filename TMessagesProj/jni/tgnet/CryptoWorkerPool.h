@@ -0,0 +1,44 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#ifndef CRYPTOWORKERPOOL_H
+#define CRYPTOWORKERPOOL_H
+
+#include <pthread.h>
+#include <deque>
+#include "TaskQueue.h"
+#include "AesIge.h"
+
+class CryptoWorkerPool {
+
+public:
+    static CryptoWorkerPool &getInstance();
+
+    void post(Task &&task);
+    void postAesIge(AesIgeStream &stream, bool encrypt, Task &&completion);
+
+private:
+    struct AesIgeJob {
+        AesIgeStream stream;
+        bool encrypt = false;
+        Task completion;
+    };
+
+    CryptoWorkerPool();
+
+    static void *ThreadProc(void *data);
+    void startThreads();
+
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    std::deque<Task> tasks;
+    std::deque<AesIgeJob> aesIgeJobs;
+    bool threadsStarted = false;
+};
+
+#endif
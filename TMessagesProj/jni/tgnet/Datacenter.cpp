@@ -16,6 +16,7 @@
 #include <memory.h>
 #include <inttypes.h>
 #include "Datacenter.h"
+#include "AesIge.h"
 #include "Connection.h"
 #include "MTProtoScheme.h"
 #include "ApiScheme.h"
@@ -919,22 +920,13 @@ void Datacenter::onHandshakeConnectionConnected(Connection *connection) {
 }
 
 inline void Datacenter::aesIgeEncryption(uint8_t *buffer, uint8_t *key, uint8_t *iv, bool encrypt, bool changeIv, uint32_t length) {
-    uint8_t *ivBytes = iv;
-    if (!changeIv) {
-        ivBytes = new uint8_t[32];
-        memcpy(ivBytes, iv, 32);
-    }
-    AES_KEY akey;
-    if (!encrypt) {
-        AES_set_decrypt_key(key, 32 * 8, &akey);
-        AES_ige_encrypt(buffer, buffer, length, &akey, ivBytes, AES_DECRYPT);
-    } else {
-        AES_set_encrypt_key(key, 32 * 8, &akey);
-        AES_ige_encrypt(buffer, buffer, length, &akey, ivBytes, AES_ENCRYPT);
-    }
-    if (!changeIv) {
-        delete [] ivBytes;
-    }
+    AesIgeStream stream;
+    stream.buffer = buffer;
+    stream.key = key;
+    stream.iv = iv;
+    stream.length = length;
+    stream.changeIv = changeIv;
+    AesIge::process(&stream, 1, encrypt);
 }
 
 void Datacenter::processHandshakeResponse(bool media, TLObject *message, int64_t messageId) {
@@ -1185,15 +1177,26 @@ bool Datacenter::decryptServerResponse(int64_t keyId, uint8_t *key, uint8_t *dat
     if (authKey == nullptr) {
         return false;
     }
+    return decryptServerResponse(authKey->bytes, authKeyId, keyId, key, data, length, ConnectionsManager::getInstance(instanceNum).getMtProtoVersion());
+}
+
+bool Datacenter::decryptServerResponse(uint8_t *authKey, int64_t authKeyId, int64_t keyId, uint8_t *key, uint8_t *data, uint32_t length, int32_t mtProtoVersion) {
+    thread_local static uint8_t messageKey[64];
+    generateServerResponseKey(authKey, key, messageKey, mtProtoVersion);
+    aesIgeEncryption(data, messageKey, messageKey + 32, false, false, length);
+    return checkServerResponse(authKey, authKeyId, keyId, key, data, length, mtProtoVersion);
+}
+
+void Datacenter::generateServerResponseKey(uint8_t *authKey, uint8_t *key, uint8_t *result, int32_t mtProtoVersion) {
+    generateMessageKey(0, authKey, key, result, true, mtProtoVersion);
+}
+
+bool Datacenter::checkServerResponse(uint8_t *authKey, int64_t authKeyId, int64_t keyId, uint8_t *key, uint8_t *data, uint32_t length, int32_t mtProtoVersion) {
     bool error = false;
     if (authKeyId != keyId) {
         error = true;
     }
-    thread_local static uint8_t messageKey[96];
-    int mtProtoVersion = ConnectionsManager::getInstance(instanceNum).getMtProtoVersion();
-    generateMessageKey(instanceNum, authKey->bytes, key, messageKey + 32, true, mtProtoVersion);
-    aesIgeEncryption(data, messageKey + 32, messageKey + 64, false, false, length);
-
+    thread_local static uint8_t messageKey[32];
     uint32_t messageLength;
     memcpy(&messageLength, data + 28, sizeof(uint32_t));
     uint32_t paddingLength = (int32_t) length - (messageLength + 32);
@@ -1210,7 +1213,7 @@ bool Datacenter::decryptServerResponse(int64_t keyId, uint8_t *key, uint8_t *dat
     switch (mtProtoVersion) {
         case 2: {
             SHA256_Init(&sha256Ctx);
-            SHA256_Update(&sha256Ctx, authKey->bytes + 88 + 8, 32);
+            SHA256_Update(&sha256Ctx, authKey + 88 + 8, 32);
             SHA256_Update(&sha256Ctx, data, length);
             SHA256_Final(messageKey, &sha256Ctx);
             break;
@@ -14,6 +14,7 @@
 #include <map>
 // #include <bits/unique_ptr.h>
 #include "Defines.h"
+#include "BandwidthEstimator.h"
 
 class TL_future_salt;
 class Connection;
@@ -76,6 +77,9 @@ private:
     void processHandshakeResponse(bool media, TLObject *message, int64_t messageId);
     NativeByteBuffer *createRequestsData(std::vector<std::unique_ptr<NetworkMessage>> &requests, int32_t *quickAckId, Connection *connection, bool pfsInit);
     bool decryptServerResponse(int64_t keyId, uint8_t *key, uint8_t *data, uint32_t length, Connection *connection);
+    static bool decryptServerResponse(uint8_t *authKey, int64_t authKeyId, int64_t keyId, uint8_t *key, uint8_t *data, uint32_t length, int32_t mtProtoVersion);
+    static void generateServerResponseKey(uint8_t *authKey, uint8_t *key, uint8_t *result, int32_t mtProtoVersion);
+    static bool checkServerResponse(uint8_t *authKey, int64_t authKeyId, int64_t keyId, uint8_t *key, uint8_t *data, uint32_t length, int32_t mtProtoVersion);
     TLObject *getCurrentHandshakeRequest(bool media);
     ByteArray *getAuthKey(ConnectionType connectionType, bool perm, int64_t *authKeyId, int32_t allowPendingKey);
 
@@ -121,6 +125,7 @@ private:
     bool isCdnDatacenter = false;
 
     std::vector<std::unique_ptr<Handshake>> handshakes;
+    BandwidthEstimator bandwidthEstimator;
 
     const uint32_t configVersion = 10;
     const uint32_t paramsConfigVersion = 1;
@@ -30,12 +30,31 @@
 #define UPLOAD_CONNECTIONS_COUNT 4
 #define CONNECTION_BACKGROUND_KEEP_TIME 10000
 #define MAX_ACCOUNT_COUNT 3
-
-#define DOWNLOAD_CHUNK_SIZE 1024 * 32
-#define DOWNLOAD_CHUNK_BIG_SIZE 1024 * 128
-#define DOWNLOAD_MAX_REQUESTS 4
-#define DOWNLOAD_MAX_BIG_REQUESTS 4
-#define DOWNLOAD_BIG_FILE_MIN_SIZE 1024 * 1024
+#define MAX_INSTANCE_COUNT 64
+
+#define DOWNLOAD_CHUNK_SIZE (1024 * 32)
+#define DOWNLOAD_CHUNK_BIG_SIZE (1024 * 128)
+#define DOWNLOAD_MAX_REQUESTS 8
+#define DOWNLOAD_MAX_BIG_REQUESTS 16
+#define DOWNLOAD_CHUNK_MAX_SIZE (1024 * 512)
+#define DOWNLOAD_MAX_WINDOW 32
+#define DOWNLOAD_MAX_IN_FLIGHT_BYTES (1024 * 1024 * 8)
+#define DOWNLOAD_DC_MAX_REQUESTS 6
+#define DOWNLOAD_DC_MIN_IN_FLIGHT_BYTES (1024 * 1024)
+#define DOWNLOAD_MAX_TOTAL_REQUESTS 16
+#define DOWNLOAD_MAX_TOTAL_IN_FLIGHT_BYTES (1024 * 1024 * 16)
+#define DOWNLOAD_BIG_FILE_MIN_SIZE (1024 * 1024)
+
+#define UPLOAD_CHUNK_SIZE (1024 * 128)
+#define UPLOAD_CHUNK_MAX_SIZE (1024 * 512)
+#define UPLOAD_MAX_PARTS 3000
+#define UPLOAD_MIN_REQUESTS 2
+#define UPLOAD_MAX_REQUESTS 8
+#define UPLOAD_BIG_FILE_MIN_SIZE (1024 * 1024 * 10)
+#define UPLOAD_MD5_BLOCK_SIZE (1024 * 256)
+
+#define CRYPTO_WORKERS_COUNT 2
+#define CRYPTO_OFFLOAD_MIN_SIZE (1024 * 32)
 
 #define NETWORK_TYPE_MOBILE 0
 #define NETWORK_TYPE_WIFI 1
@@ -65,6 +84,19 @@ typedef struct NetworkMessage {
     int32_t requestId;
 } NetworkMessage;
 
+typedef struct EncryptedPacket {
+    NativeByteBuffer *buffer = nullptr;
+    int64_t keyId = 0;
+    int64_t authKeyId = 0;
+    uint8_t authKey[256];
+    uint8_t aesKeyIv[64];
+    int32_t mtProtoVersion = 2;
+    bool offloaded = false;
+    bool inFlight = false;
+    bool discarded = false;
+    bool valid = false;
+} EncryptedPacket;
+
 enum ConnectionType {
     ConnectionTypeGeneric = 1,
     ConnectionTypeDownload = 2,
@@ -105,6 +137,19 @@ enum FileLoadState {
     FileLoadStateFinished
 };
 
+enum FileUploadState {
+    FileUploadStateIdle,
+    FileUploadStateUploading,
+    FileUploadStateFailed,
+    FileUploadStateFinished
+};
+
+enum FileLoadPriority {
+    FileLoadPriorityVisible,
+    FileLoadPriorityPlaying,
+    FileLoadPriorityBackground
+};
+
 enum FileLoadFailReason {
     FileLoadFailReasonError,
     FileLoadFailReasonCanceled,
@@ -138,6 +183,7 @@ public:
 typedef std::function<void(std::string path)> onFinishedFunc;
 typedef std::function<void(FileLoadFailReason reason)> onFailedFunc;
 typedef std::function<void(float progress)> onProgressChangedFunc;
+typedef std::function<void(int64_t fileId, int32_t totalParts, std::string md5)> onUploadFinishedFunc;
 
 typedef struct ConnectiosManagerDelegate {
     virtual void onUpdate(int32_t instanceNum) = 0;
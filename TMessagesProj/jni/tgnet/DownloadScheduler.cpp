@@ -0,0 +1,177 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#include <algorithm>
+#include "DownloadScheduler.h"
+#include "ConnectionsManager.h"
+#include "FileLoadOperation.h"
+#include "FileLog.h"
+
+DownloadScheduler::DownloadScheduler(ConnectionsManager *manager) {
+    owner = manager;
+}
+
+void DownloadScheduler::addOperation(FileLoadOperation *operation) {
+    if (getState(operation) != nullptr) {
+        return;
+    }
+    OperationState state;
+    state.operation = operation;
+    state.virtualTime = virtualClock;
+    state.inFlightRequests = 0;
+    state.inFlightBytes = 0;
+    operations.push_back(state);
+}
+
+void DownloadScheduler::removeOperation(FileLoadOperation *operation) {
+    std::vector<OperationState>::iterator iter = std::find_if(operations.begin(), operations.end(), [&](OperationState &state) {
+        return state.operation == operation;
+    });
+    if (iter == operations.end()) {
+        return;
+    }
+    if (iter->inFlightRequests != 0) {
+        if (LOGS_ENABLED) DEBUG_E("download scheduler: operation %p removed with %u requests in flight", operation, iter->inFlightRequests);
+    }
+    operations.erase(iter);
+    schedule();
+}
+
+void DownloadScheduler::onRequestFinished(FileLoadOperation *operation, int32_t bytes, uint32_t connectionNum) {
+    OperationState *state = getState(operation);
+    if (state == nullptr || state->inFlightRequests == 0) {
+        return;
+    }
+    state->inFlightRequests--;
+    state->inFlightBytes -= bytes;
+    DatacenterState &datacenter = datacenters[(uint32_t) operation->datacenter_id];
+    datacenter.requests--;
+    datacenter.bytes -= bytes;
+    if (connectionNum < DOWNLOAD_CONNECTIONS_COUNT && datacenter.connectionRequests[connectionNum] != 0) {
+        datacenter.connectionRequests[connectionNum]--;
+    }
+    totalRequests--;
+    totalBytes -= bytes;
+}
+
+void DownloadScheduler::schedule() {
+    bool sent = false;
+    uint32_t preemptions = 0;
+    while (true) {
+        OperationState *next = nullptr;
+        OperationState *blocked = nullptr;
+        for (size_t a = 0; a < operations.size(); a++) {
+            OperationState &state = operations[a];
+            if (!state.operation->canSendRequest()) {
+                continue;
+            }
+            if (!hasBudget(state)) {
+                if (blocked == nullptr || isServedBefore(state, *blocked)) {
+                    blocked = &state;
+                }
+            } else if (next == nullptr || isServedBefore(state, *next)) {
+                next = &state;
+            }
+        }
+        if (blocked != nullptr && (next == nullptr || blocked->operation->priority < next->operation->priority) && preemptions < DOWNLOAD_DC_MAX_REQUESTS && preempt(*blocked)) {
+            preemptions++;
+            continue;
+        }
+        if (next == nullptr || !sendRequest(*next)) {
+            break;
+        }
+        sent = true;
+    }
+    if (sent) {
+        ConnectionsManager *manager = owner;
+        owner->scheduleTask([manager] {
+            manager->dispatchRequestQueue(0, 0);
+        });
+    }
+}
+
+DownloadScheduler::OperationState *DownloadScheduler::getState(FileLoadOperation *operation) {
+    for (size_t a = 0; a < operations.size(); a++) {
+        if (operations[a].operation == operation) {
+            return &operations[a];
+        }
+    }
+    return nullptr;
+}
+
+bool DownloadScheduler::hasBudget(OperationState &state) {
+    if (totalRequests >= DOWNLOAD_MAX_TOTAL_REQUESTS || totalBytes >= DOWNLOAD_MAX_TOTAL_IN_FLIGHT_BYTES) {
+        return false;
+    }
+    uint32_t datacenterId = (uint32_t) state.operation->datacenter_id;
+    DatacenterState &datacenter = datacenters[datacenterId];
+    return datacenter.requests < DOWNLOAD_DC_MAX_REQUESTS && datacenter.bytes < getDatacenterBytesLimit(datacenterId);
+}
+
+bool DownloadScheduler::isServedBefore(OperationState &state, OperationState &other) {
+    if (state.operation->priority != other.operation->priority) {
+        return state.operation->priority < other.operation->priority;
+    }
+    return std::max(state.virtualTime, virtualClock) < std::max(other.virtualTime, virtualClock);
+}
+
+bool DownloadScheduler::preempt(OperationState &blocked) {
+    bool globalLimit = totalRequests >= DOWNLOAD_MAX_TOTAL_REQUESTS || totalBytes >= DOWNLOAD_MAX_TOTAL_IN_FLIGHT_BYTES;
+    OperationState *victim = nullptr;
+    for (size_t a = 0; a < operations.size(); a++) {
+        OperationState &state = operations[a];
+        if (state.inFlightRequests == 0 || state.operation->priority <= blocked.operation->priority) {
+            continue;
+        }
+        if (!globalLimit && state.operation->datacenter_id != blocked.operation->datacenter_id) {
+            continue;
+        }
+        if (victim == nullptr || state.operation->priority > victim->operation->priority || (state.operation->priority == victim->operation->priority && state.virtualTime > victim->virtualTime)) {
+            victim = &state;
+        }
+    }
+    if (victim == nullptr) {
+        return false;
+    }
+    if (LOGS_ENABLED) DEBUG_D("download scheduler: preempt operation %p for %p", victim->operation, blocked.operation);
+    return victim->operation->cancelLastRequest();
+}
+
+bool DownloadScheduler::sendRequest(OperationState &state) {
+    DatacenterState &datacenter = datacenters[(uint32_t) state.operation->datacenter_id];
+    uint32_t connectionNum = 0;
+    for (uint32_t a = 1; a < DOWNLOAD_CONNECTIONS_COUNT; a++) {
+        if (datacenter.connectionRequests[a] < datacenter.connectionRequests[connectionNum]) {
+            connectionNum = a;
+        }
+    }
+    int32_t bytes = state.operation->sendNextRequest(connectionNum);
+    if (bytes == 0) {
+        return false;
+    }
+    uint64_t startTime = std::max(state.virtualTime, virtualClock);
+    virtualClock = startTime;
+    state.virtualTime = startTime + (uint64_t) bytes;
+    state.inFlightRequests++;
+    state.inFlightBytes += bytes;
+    datacenter.requests++;
+    datacenter.bytes += bytes;
+    datacenter.connectionRequests[connectionNum]++;
+    totalRequests++;
+    totalBytes += bytes;
+    return true;
+}
+
+int64_t DownloadScheduler::getDatacenterBytesLimit(uint32_t datacenterId) {
+    BandwidthEstimate estimate;
+    if (!owner->getBandwidthEstimate(datacenterId, &estimate) || estimate.bandwidth == 0 || estimate.minRtt == 0) {
+        return DOWNLOAD_MAX_IN_FLIGHT_BYTES;
+    }
+    int64_t limit = estimate.bandwidth * estimate.minRtt / 1000 * 2;
+    return std::max((int64_t) DOWNLOAD_DC_MIN_IN_FLIGHT_BYTES, std::min(limit, (int64_t) DOWNLOAD_MAX_IN_FLIGHT_BYTES));
+}
@@ -0,0 +1,59 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#ifndef DOWNLOADSCHEDULER_H
+#define DOWNLOADSCHEDULER_H
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include "Defines.h"
+
+class ConnectionsManager;
+class FileLoadOperation;
+
+class DownloadScheduler {
+
+public:
+    DownloadScheduler(ConnectionsManager *manager);
+
+    void addOperation(FileLoadOperation *operation);
+    void removeOperation(FileLoadOperation *operation);
+    void onRequestFinished(FileLoadOperation *operation, int32_t bytes, uint32_t connectionNum);
+    void schedule();
+
+private:
+    struct OperationState {
+        FileLoadOperation *operation;
+        uint64_t virtualTime;
+        uint32_t inFlightRequests;
+        int64_t inFlightBytes;
+    };
+
+    struct DatacenterState {
+        uint32_t requests = 0;
+        int64_t bytes = 0;
+        uint32_t connectionRequests[DOWNLOAD_CONNECTIONS_COUNT] = {};
+    };
+
+    OperationState *getState(FileLoadOperation *operation);
+    bool hasBudget(OperationState &state);
+    bool isServedBefore(OperationState &state, OperationState &other);
+    bool preempt(OperationState &blocked);
+    bool sendRequest(OperationState &state);
+    int64_t getDatacenterBytesLimit(uint32_t datacenterId);
+
+    ConnectionsManager *owner;
+    std::vector<OperationState> operations;
+    std::map<uint32_t, DatacenterState> datacenters;
+    uint32_t totalRequests = 0;
+    int64_t totalBytes = 0;
+    uint64_t virtualClock = 0;
+};
+
+#endif
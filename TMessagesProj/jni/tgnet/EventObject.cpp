@@ -48,3 +48,10 @@ void EventObject::onEvent(uint32_t events) {
             break;
     }
 }
+
+void EventObject::onReceived(uint8_t *data, uint32_t length) {
+    if (eventType == EventObjectTypeConnection) {
+        Connection *connection = (Connection *) eventObject;
+        connection->onReceivedRingData(data, length);
+    }
+}
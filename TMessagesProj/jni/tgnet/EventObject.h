@@ -17,10 +17,14 @@ class EventObject {
 public:
     EventObject(void *object, EventObjectType type);
     void onEvent(uint32_t events);
+    void onReceived(uint8_t *data, uint32_t length);
 
     int64_t time;
     void *eventObject;
     EventObjectType eventType;
+    EventObject *prev = nullptr;
+    EventObject *next = nullptr;
+    int32_t wheelList = -1;
 };
 
 #endif
@@ -0,0 +1,53 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#include <stdlib.h>
+#include "FileIoWorker.h"
+#include "FileLog.h"
+#include "Defines.h"
+
+FileIoWorker &FileIoWorker::getInstance() {
+    static FileIoWorker instance;
+    return instance;
+}
+
+FileIoWorker::FileIoWorker() {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&condition, NULL);
+}
+
+void FileIoWorker::post(Task &&task) {
+    pthread_mutex_lock(&mutex);
+    if (!threadStarted) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, FileIoWorker::ThreadProc, this) != 0) {
+            if (LOGS_ENABLED) DEBUG_E("can't create file io thread");
+            exit(1);
+        }
+        pthread_detach(thread);
+        threadStarted = true;
+    }
+    tasks.push_back(std::move(task));
+    pthread_mutex_unlock(&mutex);
+    pthread_cond_signal(&condition);
+}
+
+void *FileIoWorker::ThreadProc(void *data) {
+    FileIoWorker *worker = (FileIoWorker *) data;
+    while (true) {
+        pthread_mutex_lock(&worker->mutex);
+        while (worker->tasks.empty()) {
+            pthread_cond_wait(&worker->condition, &worker->mutex);
+        }
+        Task task = std::move(worker->tasks.front());
+        worker->tasks.pop_front();
+        pthread_mutex_unlock(&worker->mutex);
+        task();
+    }
+    return nullptr;
+}
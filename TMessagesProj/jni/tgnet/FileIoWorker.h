@@ -0,0 +1,34 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#ifndef FILEIOWORKER_H
+#define FILEIOWORKER_H
+
+#include <pthread.h>
+#include <deque>
+#include "TaskQueue.h"
+
+class FileIoWorker {
+
+public:
+    static FileIoWorker &getInstance();
+
+    void post(Task &&task);
+
+private:
+    FileIoWorker();
+
+    static void *ThreadProc(void *data);
+
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    std::deque<Task> tasks;
+    bool threadStarted = false;
+};
+
+#endif
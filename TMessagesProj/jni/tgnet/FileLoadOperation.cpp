@@ -8,6 +8,10 @@
 
 #include "FileLoadOperation.h"
 #include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
 #include "ApiScheme.h"
 #include "ByteArray.h"
 #include "MTProtoScheme.h"
@@ -44,6 +48,8 @@ FileLoadOperation::FileLoadOperation(int32_t dc_id, int64_t id, int64_t volume_i
             location->version = version;
         }
     }
+    pthread_mutex_init(&streamMutex, NULL);
+    pthread_cond_init(&streamCondition, NULL);
     destPath = dest;
     tempPath = temp;
     datacenter_id = dc_id;
@@ -64,6 +70,8 @@ FileLoadOperation::~FileLoadOperation() {
         ptr1 = nullptr;
     }
 #endif
+    pthread_cond_destroy(&streamCondition);
+    pthread_mutex_destroy(&streamMutex);
 }
 
 void FileLoadOperation::start() {
@@ -71,9 +79,8 @@ void FileLoadOperation::start() {
         if (state != FileLoadStateIdle) {
             return;
         }
-        currentDownloadChunkSize = totalBytesCount >= DOWNLOAD_BIG_FILE_MIN_SIZE ? DOWNLOAD_CHUNK_BIG_SIZE : DOWNLOAD_CHUNK_SIZE;
-        currentMaxDownloadRequests = totalBytesCount >= DOWNLOAD_BIG_FILE_MIN_SIZE ? DOWNLOAD_MAX_BIG_REQUESTS : DOWNLOAD_MAX_REQUESTS;
         state = FileLoadStateDownloading;
+        ConnectionsManager::getInstance(0).downloadScheduler.addOperation(this);
         if (location == nullptr) {
             onFailedLoadingFile(FileLoadFailReasonError);
             return;
@@ -95,13 +102,16 @@ void FileLoadOperation::start() {
         filePath = destPath + prefix + "." + ext;
         tempFilePath = tempPath + prefix + ".temp";
         if (key != nullptr) {
-            tempFileIvPath = tempPath + prefix + ".iv";
+            tempProgressPath = tempPath + prefix + ".iv";
+        } else {
+            tempProgressPath = tempPath + prefix + ".parts";
         }
+        downloadEndOffset = totalBytesCount > 0 ? totalBytesCount : -1;
 
         FILE *destFile = fopen(filePath.c_str(), "rb");
         if (destFile != nullptr) {
-            long len = ftell(destFile);
-            if (totalBytesCount != 0 && totalBytesCount != len) {
+            long len = !fseek(destFile, 0, SEEK_END) ? ftell(destFile) : -1L;
+            if (totalBytesCount != 0 && totalBytesCount - bytesCountPadding != len) {
                 fclose(destFile);
                 destFile = nullptr;
                 remove(filePath.c_str());
@@ -109,56 +119,33 @@ void FileLoadOperation::start() {
         }
 
         if (destFile == nullptr) {
-            tempFile = fopen(tempFilePath.c_str(), "r+b");
-            if (tempFile != nullptr) {
-                if (!fseek(tempFile, 0, SEEK_END) && (downloadedBytes = ftell(tempFile)) != -1L) {
-                    nextDownloadOffset = downloadedBytes = downloadedBytes / currentDownloadChunkSize * currentDownloadChunkSize;
-                } else {
-                    fclose(tempFile);
-                    tempFile = nullptr;
-                }
+            bool resume = false;
+            tempFileFd = open(tempFilePath.c_str(), O_RDWR);
+            pthread_mutex_lock(&streamMutex);
+            if (tempFileFd != -1) {
+                resume = restoreProgress();
             }
-
-            if (key != nullptr) {
-                if (tempFile != nullptr) {
-                    tempIvFile = fopen(tempFileIvPath.c_str(), "r+b");
-                    if (tempIvFile != nullptr) {
-                        if (fread(iv->bytes, sizeof(uint8_t), 32, tempIvFile) != 32) {
-                            fclose(tempIvFile);
-                            tempIvFile = nullptr;
-                        }
-                    }
-                }
-                if (tempIvFile == nullptr) {
-                    tempIvFile = fopen(tempFileIvPath.c_str(), "w+b");
-                    nextDownloadOffset = downloadedBytes = 0;
-                    if (tempIvFile == nullptr) {
-                        onFailedLoadingFile(FileLoadFailReasonError);
-                        return;
-                    }
-                }
-            }
-
-            if (tempFile != nullptr) {
-                if (downloadedBytes != 0) {
-                    if (!fseek(tempFile, downloadedBytes, SEEK_SET)) {
-                        if (LOGS_ENABLED) DEBUG_D("resume loading file to temp = %s final = %s from %d", tempFilePath.c_str(), filePath.c_str(), nextDownloadOffset);
-                    } else {
-                        fclose(tempFile);
-                        tempFile = nullptr;
-                    }
+            if (!resume) {
+                if (tempFileFd != -1) {
+                    close(tempFileFd);
                 }
-            }
-            if (tempFile == nullptr) {
-                nextDownloadOffset = downloadedBytes = 0;
-                tempFile = fopen(tempFilePath.c_str(), "w+b");
-                if (tempFile == nullptr) {
+                tempFileFd = open(tempFilePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+                bool reset = tempFileFd != -1 && resetProgress();
+                pthread_mutex_unlock(&streamMutex);
+                if (!reset) {
                     onFailedLoadingFile(FileLoadFailReasonError);
                     return;
                 }
                 if (LOGS_ENABLED) DEBUG_D("start loading file to temp = %s final = %s", tempFilePath.c_str(), filePath.c_str());
+            } else {
+                pthread_mutex_unlock(&streamMutex);
+                if (LOGS_ENABLED) DEBUG_D("resume loading file to temp = %s final = %s from %d, %d bytes completed", tempFilePath.c_str(), filePath.c_str(), downloadedBytes, completedBytes);
             }
-            if (totalBytesCount != 0 && downloadedBytes == totalBytesCount) {
+            if (totalBytesCount > 0 && ftruncate(tempFileFd, totalBytesCount - bytesCountPadding) != 0) {
+                if (LOGS_ENABLED) DEBUG_E("unable to preallocate temp = %s, errno %d", tempFilePath.c_str(), errno);
+            }
+            nextDownloadOffset = downloadedBytes;
+            if (isDownloadFinished()) {
                 onFinishLoadingFile();
             } else {
                 startDownloadRequest();
@@ -194,23 +181,102 @@ void FileLoadOperation::setDelegate(onFinishedFunc onFinished, onFailedFunc onFa
     onProgressChangedCallback = onProgressChanged;
 }
 
+void FileLoadOperation::setMaxDownloadRequests(uint32_t count) {
+    ConnectionsManager::getInstance(0).scheduleTask([&, count] {
+        maxDownloadRequests = count;
+        startDownloadRequest();
+    });
+}
+
+void FileLoadOperation::setPriority(FileLoadPriority value) {
+    ConnectionsManager::getInstance(0).scheduleTask([&, value] {
+        priority = value;
+        startDownloadRequest();
+    });
+}
+
+void FileLoadOperation::addHotRange(int32_t offset, int32_t length) {
+    if (offset < 0 || length <= 0 || (totalBytesCount > 0 && offset >= totalBytesCount - bytesCountPadding)) {
+        return;
+    }
+    pthread_mutex_lock(&streamMutex);
+    hotRanges.push_back(std::make_pair(offset, offset + length));
+    pthread_mutex_unlock(&streamMutex);
+    ConnectionsManager::getInstance(0).scheduleTask([] {
+        ConnectionsManager::getInstance(0).downloadScheduler.schedule();
+    });
+}
+
+void FileLoadOperation::clearHotRanges() {
+    pthread_mutex_lock(&streamMutex);
+    hotRanges.clear();
+    pthread_mutex_unlock(&streamMutex);
+}
+
+int32_t FileLoadOperation::read(uint8_t *buffer, int32_t offset, int32_t length) {
+    if (offset < 0 || length <= 0 || (totalBytesCount > 0 && offset >= totalBytesCount - bytesCountPadding)) {
+        return 0;
+    }
+    pthread_mutex_lock(&streamMutex);
+    streamReaders++;
+    bool requested = false;
+    while (state != FileLoadStateFailed && !isRangeCompleted(offset, length)) {
+        if (!requested) {
+            requested = true;
+            hotRanges.insert(hotRanges.begin(), std::make_pair(offset, offset + length));
+            ConnectionsManager::getInstance(0).scheduleTask([] {
+                ConnectionsManager::getInstance(0).downloadScheduler.schedule();
+            });
+        }
+        pthread_cond_wait(&streamCondition, &streamMutex);
+    }
+    int32_t result = -1;
+    if (state != FileLoadStateFailed) {
+        if (streamFd == -1) {
+            streamFd = open(state == FileLoadStateFinished ? filePath.c_str() : tempFilePath.c_str(), O_RDONLY);
+        }
+        if (streamFd != -1) {
+            ssize_t count;
+            do {
+                count = pread(streamFd, buffer, (size_t) length, offset);
+            } while (count < 0 && errno == EINTR);
+            result = (int32_t) count;
+        }
+    }
+    streamReaders--;
+    pthread_cond_broadcast(&streamCondition);
+    pthread_mutex_unlock(&streamMutex);
+    return result;
+}
+
 void FileLoadOperation::cleanup() {
     ConnectionsManager::getInstance(0).scheduleTask([&] {
-        if (tempFile != nullptr) {
-            fclose(tempFile);
-            tempFile = nullptr;
+        if (tempFileFd != -1) {
+            close(tempFileFd);
+            tempFileFd = -1;
         }
-        if (tempIvFile != nullptr) {
-            fclose(tempIvFile);
-            tempIvFile = nullptr;
+        if (tempProgressFd != -1) {
+            close(tempProgressFd);
+            tempProgressFd = -1;
         }
         for (size_t a = 0; a < requestInfos.size(); a++) {
             if (requestInfos[a] != nullptr && requestInfos[a]->requestToken != 0) {
                 ConnectionsManager::getInstance(0).cancelRequestInternal(requestInfos[a]->requestToken, 0, true, false);
+                ConnectionsManager::getInstance(0).downloadScheduler.onRequestFinished(this, requestInfos[a]->limit, requestInfos[a]->connectionNum);
             }
         }
         requestInfos.clear();
         delayedRequestInfos.clear();
+        ConnectionsManager::getInstance(0).downloadScheduler.removeOperation(this);
+        pthread_mutex_lock(&streamMutex);
+        while (streamReaders != 0) {
+            pthread_cond_wait(&streamCondition, &streamMutex);
+        }
+        pthread_mutex_unlock(&streamMutex);
+        if (streamFd != -1) {
+            close(streamFd);
+            streamFd = -1;
+        }
         delete this;
     });
 }
@@ -219,20 +285,23 @@ void FileLoadOperation::onFinishLoadingFile() {
     if (state != FileLoadStateDownloading) {
         return;
     }
+    pthread_mutex_lock(&streamMutex);
     state = FileLoadStateFinished;
-    if (tempIvFile != nullptr) {
-        fclose(tempIvFile);
-        tempIvFile = nullptr;
-        remove(tempFileIvPath.c_str());
-    }
-    if (tempFile != nullptr) {
-        fclose(tempFile);
-        tempFile = nullptr;
+    if (tempProgressFd != -1) {
+        close(tempProgressFd);
+        tempProgressFd = -1;
+        remove(tempProgressPath.c_str());
+    }
+    if (tempFileFd != -1) {
+        close(tempFileFd);
+        tempFileFd = -1;
         if (rename(tempFilePath.c_str(), filePath.c_str())) {
             if (LOGS_ENABLED) DEBUG_E("unable to rename temp = %s to final = %s", tempFilePath.c_str(), filePath.c_str());
             filePath = tempFilePath;
         }
     }
+    pthread_cond_broadcast(&streamCondition);
+    pthread_mutex_unlock(&streamMutex);
     if (LOGS_ENABLED) DEBUG_D("finished downloading file %s", filePath.c_str());
     if (onFinishedCallback != nullptr) {
         onFinishedCallback(filePath);
@@ -244,61 +313,231 @@ void FileLoadOperation::onFailedLoadingFile(int reason) {
     if (state == FileLoadStateFailed) {
         return;
     }
+    pthread_mutex_lock(&streamMutex);
     state = FileLoadStateFailed;
+    pthread_cond_broadcast(&streamCondition);
+    pthread_mutex_unlock(&streamMutex);
     if (onFailedCallback != nullptr) {
         onFailedCallback(FileLoadFailReasonCanceled);
     }
     cleanup();
 }
 
-void FileLoadOperation::processRequestResult(RequestInfo *requestInfo, TL_error *error, bool next) {
-    std::unique_ptr<RequestInfo> info;
-    if (!next) {
-        std::vector<std::unique_ptr<RequestInfo>>::iterator iter = std::find_if(requestInfos.begin(), requestInfos.end(), [&](std::unique_ptr<RequestInfo> &p) {
-            return p.get() == requestInfo;
-        });
-        if (iter != requestInfos.end()) {
-            info = std::move(*iter);
-            requestInfos.erase(iter);
+bool FileLoadOperation::restoreProgress() {
+    tempProgressFd = open(tempProgressPath.c_str(), O_RDWR);
+    if (tempProgressFd == -1) {
+        return false;
+    }
+    if (key != nullptr) {
+        uint8_t ivState[36];
+        int32_t offset;
+        if (pread(tempProgressFd, ivState, 36, 0) != 36) {
+            return false;
+        }
+        memcpy(&offset, ivState + 32, sizeof(int32_t));
+        if (offset < 0 || offset % DOWNLOAD_CHUNK_SIZE != 0 || (totalBytesCount > 0 && offset > totalBytesCount)) {
+            return false;
         }
+        memcpy(iv->bytes, ivState, 32);
+        downloadedBytes = completedBytes = offset;
+        return true;
     }
-    if (error == nullptr) {
-        if (!next && downloadedBytes != requestInfo->offset) {
-            if (state == FileLoadStateDownloading) {
-                delayedRequestInfos.push_back(std::move(info));
-                startDownloadRequest();
-            }
-            return;
+    int32_t chunkSize;
+    struct stat st;
+    if (pread(tempProgressFd, &chunkSize, sizeof(int32_t), 0) != sizeof(int32_t) || chunkSize != DOWNLOAD_CHUNK_SIZE || fstat(tempProgressFd, &st) != 0) {
+        return false;
+    }
+    completedParts.resize((size_t) st.st_size - sizeof(int32_t));
+    if (!completedParts.empty() && pread(tempProgressFd, &completedParts[0], completedParts.size(), sizeof(int32_t)) != (ssize_t) completedParts.size()) {
+        completedParts.clear();
+        return false;
+    }
+    completedBytes = 0;
+    for (size_t a = 0; a < completedParts.size(); a++) {
+        completedBytes += __builtin_popcount(completedParts[a]) * DOWNLOAD_CHUNK_SIZE;
+    }
+    if (totalBytesCount > 0 && completedBytes > totalBytesCount) {
+        completedBytes = totalBytesCount;
+    }
+    downloadedBytes = 0;
+    updateDownloadedBytes();
+    return true;
+}
+
+bool FileLoadOperation::resetProgress() {
+    downloadedBytes = completedBytes = 0;
+    completedParts.clear();
+    if (tempProgressFd != -1) {
+        close(tempProgressFd);
+    }
+    tempProgressFd = open(tempProgressPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (tempProgressFd == -1) {
+        return false;
+    }
+    if (key != nullptr) {
+        return saveProgress(0, 0);
+    }
+    int32_t chunkSize = DOWNLOAD_CHUNK_SIZE;
+    return pwrite(tempProgressFd, &chunkSize, sizeof(int32_t), 0) == sizeof(int32_t);
+}
+
+bool FileLoadOperation::saveProgress(int32_t offset, int32_t length) {
+    if (key != nullptr) {
+        uint8_t ivState[36];
+        memcpy(ivState, iv->bytes, 32);
+        memcpy(ivState + 32, &downloadedBytes, sizeof(int32_t));
+        return pwrite(tempProgressFd, ivState, 36, 0) == 36;
+    }
+    uint32_t first = (uint32_t) (offset / DOWNLOAD_CHUNK_SIZE) / 8;
+    uint32_t last = (uint32_t) ((offset + std::max(length, 1) - 1) / DOWNLOAD_CHUNK_SIZE) / 8;
+    size_t count = last - first + 1;
+    return pwrite(tempProgressFd, &completedParts[first], count, sizeof(int32_t) + first) == (ssize_t) count;
+}
+
+bool FileLoadOperation::isPartCompleted(int32_t offset) {
+    uint32_t index = (uint32_t) (offset / DOWNLOAD_CHUNK_SIZE);
+    return index / 8 < completedParts.size() && (completedParts[index / 8] & (1 << (index % 8))) != 0;
+}
+
+void FileLoadOperation::setPartCompleted(int32_t offset, int32_t length) {
+    uint32_t first = (uint32_t) (offset / DOWNLOAD_CHUNK_SIZE);
+    uint32_t last = (uint32_t) ((offset + std::max(length, 1) - 1) / DOWNLOAD_CHUNK_SIZE);
+    if (last / 8 >= completedParts.size()) {
+        completedParts.resize(last / 8 + 1);
+    }
+    for (uint32_t index = first; index <= last; index++) {
+        completedParts[index / 8] |= (uint8_t) (1 << (index % 8));
+    }
+}
+
+void FileLoadOperation::setDownloadEndOffset(int32_t offset) {
+    pthread_mutex_lock(&streamMutex);
+    if (downloadEndOffset < 0 || offset < downloadEndOffset) {
+        downloadEndOffset = offset;
+    }
+    if (downloadedBytes > downloadEndOffset) {
+        downloadedBytes = downloadEndOffset;
+    }
+    pthread_cond_broadcast(&streamCondition);
+    pthread_mutex_unlock(&streamMutex);
+}
+
+void FileLoadOperation::updateDownloadedBytes() {
+    while (isPartCompleted(downloadedBytes) && (downloadEndOffset < 0 || downloadedBytes < downloadEndOffset)) {
+        downloadedBytes += DOWNLOAD_CHUNK_SIZE;
+    }
+    if (downloadEndOffset >= 0 && downloadedBytes > downloadEndOffset) {
+        downloadedBytes = downloadEndOffset;
+    }
+}
+
+bool FileLoadOperation::isDownloadFinished() {
+    return downloadEndOffset >= 0 && downloadedBytes >= downloadEndOffset;
+}
+
+bool FileLoadOperation::isPartRequested(int32_t offset) {
+    for (size_t a = 0; a < requestInfos.size(); a++) {
+        if (offset >= requestInfos[a]->offset && offset < requestInfos[a]->offset + requestInfos[a]->limit) {
+            return true;
         }
+    }
+    return false;
+}
 
-        if (requestInfo->bytes == nullptr || requestInfo->bytes->limit() == 0) {
-            onFinishLoadingFile();
-            return;
+bool FileLoadOperation::isRangeCompleted(int32_t offset, int32_t length) {
+    if (state == FileLoadStateFinished) {
+        return true;
+    }
+    int32_t end = offset + length;
+    if (downloadEndOffset >= 0 && end > downloadEndOffset) {
+        end = downloadEndOffset;
+    }
+    int32_t start = std::max(offset, downloadedBytes);
+    for (int32_t a = start / DOWNLOAD_CHUNK_SIZE * DOWNLOAD_CHUNK_SIZE; a < end; a += DOWNLOAD_CHUNK_SIZE) {
+        if (!isPartCompleted(a)) {
+            return false;
         }
-        int32_t currentBytesSize = requestInfo->bytes->limit();
-        downloadedBytes += currentBytesSize;
-        bool finishedDownloading = currentBytesSize != currentDownloadChunkSize || ((totalBytesCount == downloadedBytes || downloadedBytes % currentDownloadChunkSize != 0) && (totalBytesCount <= 0 || totalBytesCount <= downloadedBytes));
+    }
+    return true;
+}
 
-        if (key != nullptr) {
-            Datacenter::aesIgeEncryption(requestInfo->bytes->bytes(), key->bytes, iv->bytes, false, true, currentBytesSize);
-            if (finishedDownloading && bytesCountPadding != 0) {
-                requestInfo->bytes->limit(currentBytesSize = (currentBytesSize - bytesCountPadding));
-            }
+bool FileLoadOperation::writePart(RequestInfo *requestInfo) {
+    int32_t offset = requestInfo->offset;
+    int32_t currentBytesSize = requestInfo->bytes->limit();
+    if (currentBytesSize < requestInfo->limit) {
+        setDownloadEndOffset(offset + currentBytesSize);
+    }
+    if (key != nullptr) {
+        Datacenter::aesIgeEncryption(requestInfo->bytes->bytes(), key->bytes, iv->bytes, false, true, currentBytesSize);
+        if (bytesCountPadding != 0 && totalBytesCount > 0 && offset + currentBytesSize >= totalBytesCount && currentBytesSize > bytesCountPadding) {
+            currentBytesSize -= bytesCountPadding;
         }
-        if (tempFile != nullptr) {
-            if (fwrite(requestInfo->bytes->bytes(), sizeof(uint8_t), currentBytesSize, tempFile) != (uint32_t) currentBytesSize) {
-                onFailedLoadingFile(FileLoadFailReasonError);
+    }
+    uint8_t *data = requestInfo->bytes->bytes();
+    int32_t written = 0;
+    while (written < currentBytesSize) {
+        ssize_t result = pwrite(tempFileFd, data + written, (size_t) (currentBytesSize - written), offset + written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            if (LOGS_ENABLED) DEBUG_E("unable to write temp = %s at %d, errno %d", tempFilePath.c_str(), offset + written, errno);
+            onFailedLoadingFile(FileLoadFailReasonError);
+            return false;
+        }
+        written += result;
+    }
+    pthread_mutex_lock(&streamMutex);
+    setPartCompleted(offset, requestInfo->limit);
+    completedBytes += currentBytesSize;
+    updateDownloadedBytes();
+    pthread_cond_broadcast(&streamCondition);
+    pthread_mutex_unlock(&streamMutex);
+    if (!saveProgress(offset, requestInfo->limit)) {
+        onFailedLoadingFile(FileLoadFailReasonError);
+        return false;
+    }
+    return true;
+}
+
+void FileLoadOperation::processRequestResult(RequestInfo *requestInfo, TL_error *error) {
+    std::unique_ptr<RequestInfo> info;
+    std::vector<std::unique_ptr<RequestInfo>>::iterator iter = std::find_if(requestInfos.begin(), requestInfos.end(), [&](std::unique_ptr<RequestInfo> &p) {
+        return p.get() == requestInfo;
+    });
+    if (iter != requestInfos.end()) {
+        info = std::move(*iter);
+        requestInfos.erase(iter);
+    }
+    if (state != FileLoadStateDownloading) {
+        return;
+    }
+    if (error == nullptr) {
+        if (requestInfo->bytes == nullptr || requestInfo->bytes->limit() == 0) {
+            setDownloadEndOffset(requestInfo->offset);
+        } else if (key != nullptr) {
+            if (downloadedBytes != requestInfo->offset) {
+                delayedRequestInfos[requestInfo->offset] = std::move(info);
+                startDownloadRequest();
                 return;
             }
-        }
-        if (tempIvFile != nullptr) {
-            if (fseek(tempIvFile, 0, SEEK_SET) || fwrite(iv->bytes, sizeof(uint8_t), 32, tempIvFile) != 32) {
-                onFailedLoadingFile(FileLoadFailReasonError);
+            if (!writePart(requestInfo)) {
                 return;
             }
+            std::map<int32_t, std::unique_ptr<RequestInfo>>::iterator delayed;
+            while (!isDownloadFinished() && (delayed = delayedRequestInfos.find(downloadedBytes)) != delayedRequestInfos.end()) {
+                info = std::move(delayed->second);
+                delayedRequestInfos.erase(delayed);
+                if (!writePart(info.get())) {
+                    return;
+                }
+            }
+        } else if (!writePart(requestInfo)) {
+            return;
         }
-        if (totalBytesCount > 0 && state == FileLoadStateDownloading) {
-            float progress = (float) downloadedBytes / (float) totalBytesCount;
+
+        if (totalBytesCount > 0) {
+            float progress = (float) completedBytes / (float) (totalBytesCount - bytesCountPadding);
             if (progress > 1.0f) {
                 progress = 1.0f;
             }
@@ -307,16 +546,7 @@ void FileLoadOperation::processRequestResult(RequestInfo *requestInfo, TL_error
             }
         }
 
-        for (std::vector<std::unique_ptr<RequestInfo>>::iterator iter = delayedRequestInfos.begin(); iter != delayedRequestInfos.end(); iter++) {
-            if (downloadedBytes == (*iter)->offset) {
-                info = std::move(*iter);
-                delayedRequestInfos.erase(iter);
-                processRequestResult(info.get(), nullptr, true);
-                break;
-            }
-        }
-
-        if (finishedDownloading) {
+        if (isDownloadFinished()) {
             onFinishLoadingFile();
         } else {
             startDownloadRequest();
@@ -337,8 +567,13 @@ void FileLoadOperation::processRequestResult(RequestInfo *requestInfo, TL_error
             }*/
             onFailedLoadingFile(FileLoadFailReasonError);
         } else if (error->text.find(offsetInvalid) != std::string::npos) {
-            if (downloadedBytes % currentDownloadChunkSize == 0) {
-                onFinishLoadingFile();
+            if (requestInfo->offset % DOWNLOAD_CHUNK_SIZE == 0) {
+                setDownloadEndOffset(requestInfo->offset);
+                if (isDownloadFinished()) {
+                    onFinishLoadingFile();
+                } else {
+                    startDownloadRequest();
+                }
             } else {
                 onFailedLoadingFile(FileLoadFailReasonError);
             }
@@ -351,40 +586,150 @@ void FileLoadOperation::processRequestResult(RequestInfo *requestInfo, TL_error
 }
 
 void FileLoadOperation::startDownloadRequest() {
-    if (state != FileLoadStateDownloading || (totalBytesCount > 0 && nextDownloadOffset >= totalBytesCount) || ((requestInfos.size() + delayedRequestInfos.size()) >= currentMaxDownloadRequests)) {
+    if (state != FileLoadStateDownloading) {
         return;
     }
-    int32_t count = 1;
-    if (totalBytesCount > 0) {
-        count = currentMaxDownloadRequests - requestInfos.size();
+    updateDownloadParameters();
+    ConnectionsManager::getInstance(0).downloadScheduler.schedule();
+}
+
+bool FileLoadOperation::canSendRequest() {
+    if (state != FileLoadStateDownloading) {
+        return false;
+    }
+    uint32_t maxRequests = maxDownloadRequests != 0 ? maxDownloadRequests : currentMaxDownloadRequests;
+    if (requestInfos.size() + delayedRequestInfos.size() >= maxRequests) {
+        return false;
+    }
+    if (downloadEndOffset < 0) {
+        return requestInfos.empty();
     }
+    return getNextRequestOffset(nullptr) != -1;
+}
 
-    for (int32_t a = 0; a < count; a++) {
-        if (totalBytesCount > 0 && nextDownloadOffset >= totalBytesCount) {
-            break;
+int32_t FileLoadOperation::getNextRequestOffset(int32_t *maxSize) {
+    if (key == nullptr && downloadEndOffset >= 0) {
+        pthread_mutex_lock(&streamMutex);
+        std::vector<std::pair<int32_t, int32_t>>::iterator iter = hotRanges.begin();
+        while (iter != hotRanges.end()) {
+            int32_t end = std::min(iter->second, downloadEndOffset);
+            bool completed = true;
+            for (int32_t offset = iter->first / DOWNLOAD_CHUNK_SIZE * DOWNLOAD_CHUNK_SIZE; offset < end; offset += DOWNLOAD_CHUNK_SIZE) {
+                if (isPartCompleted(offset)) {
+                    continue;
+                }
+                completed = false;
+                if (!isPartRequested(offset)) {
+                    pthread_mutex_unlock(&streamMutex);
+                    if (maxSize != nullptr) {
+                        *maxSize = end - offset;
+                    }
+                    return offset;
+                }
+            }
+            if (completed) {
+                iter = hotRanges.erase(iter);
+            } else {
+                iter++;
+            }
+        }
+        pthread_mutex_unlock(&streamMutex);
+    }
+    while ((downloadEndOffset < 0 || nextDownloadOffset < downloadEndOffset) && (isPartCompleted(nextDownloadOffset) || isPartRequested(nextDownloadOffset))) {
+        nextDownloadOffset += DOWNLOAD_CHUNK_SIZE;
+    }
+    if (downloadEndOffset >= 0 && nextDownloadOffset >= downloadEndOffset) {
+        return -1;
+    }
+    if (maxSize != nullptr) {
+        *maxSize = downloadEndOffset >= 0 ? downloadEndOffset - nextDownloadOffset : currentDownloadChunkSize;
+    }
+    return nextDownloadOffset;
+}
+
+int32_t FileLoadOperation::sendNextRequest(uint32_t connectionNum) {
+    int32_t maxSize = 0;
+    int32_t offset = getNextRequestOffset(&maxSize);
+    if (offset < 0) {
+        return 0;
+    }
+    int32_t chunkSize = getRequestChunkSize(offset, maxSize);
+
+    RequestInfo *requestInfo = new RequestInfo();
+    requestInfos.push_back(std::unique_ptr<RequestInfo>(requestInfo));
+
+    TL_upload_getFile *request = new TL_upload_getFile();
+    request->location = location.get();
+    requestInfo->offset = request->offset = offset;
+    requestInfo->limit = request->limit = chunkSize;
+    requestInfo->connectionNum = connectionNum;
+
+    requestInfo->requestToken = ConnectionsManager::getInstance(0).sendRequest(request, [&, requestInfo](TLObject *response, TL_error *error, int32_t connectionType) {
+        requestInfo->requestToken = 0;
+        ConnectionsManager::getInstance(0).downloadScheduler.onRequestFinished(this, requestInfo->limit, requestInfo->connectionNum);
+        if (response != nullptr) {
+            TL_upload_file *res = (TL_upload_file *) response;
+            requestInfo->bytes = res->bytes;
+            res->bytes = nullptr;
         }
-        bool isLast = totalBytesCount <= 0 || a == count - 1 || (totalBytesCount > 0 && (nextDownloadOffset + currentDownloadChunkSize) >= totalBytesCount);
+        processRequestResult(requestInfo, error);
+    }, nullptr, (isForceRequest ? RequestFlagForceDownload : 0) | RequestFlagFailOnServerErrors, datacenter_id, (ConnectionType) (ConnectionTypeDownload | (connectionNum << 16)), false);
+    if (requestInfo->requestToken == 0) {
+        requestInfos.pop_back();
+        return 0;
+    }
+    return chunkSize;
+}
 
-        RequestInfo *requestInfo = new RequestInfo();
-        requestInfos.push_back(std::unique_ptr<RequestInfo>(requestInfo));
+bool FileLoadOperation::cancelLastRequest() {
+    for (size_t a = requestInfos.size(); a > 0; a--) {
+        RequestInfo *requestInfo = requestInfos[a - 1].get();
+        if (requestInfo->requestToken == 0 || !ConnectionsManager::getInstance(0).cancelRequestInternal(requestInfo->requestToken, 0, true, false)) {
+            continue;
+        }
+        ConnectionsManager::getInstance(0).downloadScheduler.onRequestFinished(this, requestInfo->limit, requestInfo->connectionNum);
+        if (requestInfo->offset < nextDownloadOffset) {
+            nextDownloadOffset = requestInfo->offset;
+        }
+        requestInfos.erase(requestInfos.begin() + (a - 1));
+        return true;
+    }
+    return false;
+}
 
-        TL_upload_getFile *request = new TL_upload_getFile();
-        request->location = location.get();
-        requestInfo->offset = request->offset = nextDownloadOffset;
-        request->limit = currentDownloadChunkSize;
-        nextDownloadOffset += currentDownloadChunkSize;
+void FileLoadOperation::updateDownloadParameters() {
+    bool bigFile = totalBytesCount >= DOWNLOAD_BIG_FILE_MIN_SIZE;
+    BandwidthEstimate estimate;
+    if (!ConnectionsManager::getInstance(0).getBandwidthEstimate((uint32_t) datacenter_id, &estimate) || estimate.bandwidth == 0 || estimate.minRtt == 0) {
+        currentDownloadChunkSize = bigFile ? DOWNLOAD_CHUNK_BIG_SIZE : DOWNLOAD_CHUNK_SIZE;
+        currentMaxDownloadRequests = bigFile ? DOWNLOAD_MAX_BIG_REQUESTS : DOWNLOAD_MAX_REQUESTS;
+        return;
+    }
+    int64_t bdp = estimate.bandwidth * estimate.minRtt / 1000;
+    int32_t chunkSize = DOWNLOAD_CHUNK_SIZE;
+    while (chunkSize < DOWNLOAD_CHUNK_MAX_SIZE && chunkSize * 2 <= bdp / 4) {
+        chunkSize *= 2;
+    }
+    int64_t window = bdp * 2 / chunkSize;
+    window = std::min(window, (int64_t) (DOWNLOAD_MAX_IN_FLIGHT_BYTES / chunkSize));
+    window = std::max((int64_t) 2, std::min(window, (int64_t) DOWNLOAD_MAX_WINDOW));
+    currentDownloadChunkSize = chunkSize;
+    currentMaxDownloadRequests = (uint32_t) window;
+}
 
-        requestInfo->requestToken = ConnectionsManager::getInstance(0).sendRequest(request, [&, requestInfo](TLObject *response, TL_error *error, int32_t connectionType) {
-            requestInfo->requestToken = 0;
-            if (response != nullptr) {
-                TL_upload_file *res = (TL_upload_file *) response;
-                requestInfo->bytes = res->bytes;
-                res->bytes = nullptr;
-            }
-            processRequestResult(requestInfo, error, false);
-        }, nullptr, (isForceRequest ? RequestFlagForceDownload : 0) | RequestFlagFailOnServerErrors, datacenter_id, requestsCount % 2 == 0 ? ConnectionTypeDownload : (ConnectionType) (ConnectionTypeDownload | (1 << 16)), isLast);
-        requestsCount++;
+int32_t FileLoadOperation::getRequestChunkSize(int32_t offset, int32_t maxSize) {
+    int32_t chunkSize = currentDownloadChunkSize;
+    while (chunkSize > DOWNLOAD_CHUNK_SIZE) {
+        bool overlaps = false;
+        for (int32_t a = DOWNLOAD_CHUNK_SIZE; a < chunkSize && !overlaps; a += DOWNLOAD_CHUNK_SIZE) {
+            overlaps = isPartCompleted(offset + a) || isPartRequested(offset + a);
+        }
+        if (offset % chunkSize == 0 && !overlaps && chunkSize / 2 < maxSize) {
+            break;
+        }
+        chunkSize /= 2;
     }
+    return chunkSize;
 }
 
 FileLoadOperation::RequestInfo::~RequestInfo() {
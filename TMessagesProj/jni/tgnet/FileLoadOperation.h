@@ -10,6 +10,9 @@
 #define FILELOADOPERATION_H
 
 #include <vector>
+#include <map>
+#include <string>
+#include <pthread.h>
 #include "Defines.h"
 
 #ifdef ANDROID
@@ -30,6 +33,11 @@ public:
     void start();
     void cancel();
     void setDelegate(onFinishedFunc onFinished, onFailedFunc onFailed, onProgressChangedFunc onProgressChanged);
+    void setMaxDownloadRequests(uint32_t count);
+    void setPriority(FileLoadPriority value);
+    void addHotRange(int32_t offset, int32_t length);
+    void clearHotRanges();
+    int32_t read(uint8_t *buffer, int32_t offset, int32_t length);
 
 #ifdef ANDROID
     jobject ptr1 = nullptr;
@@ -42,6 +50,8 @@ private:
     public:
         int32_t requestToken = 0;
         int32_t offset = 0;
+        int32_t limit = 0;
+        uint32_t connectionNum = 0;
         NativeByteBuffer *bytes = nullptr;
 
         ~RequestInfo();
@@ -50,33 +60,60 @@ private:
     void cleanup();
     void onFinishLoadingFile();
     void startDownloadRequest();
-    void processRequestResult(RequestInfo *requestInfo, TL_error *error, bool next);
+    bool canSendRequest();
+    int32_t sendNextRequest(uint32_t connectionNum);
+    bool cancelLastRequest();
+    void processRequestResult(RequestInfo *requestInfo, TL_error *error);
     void onFailedLoadingFile(int reason);
+    bool writePart(RequestInfo *requestInfo);
+    bool restoreProgress();
+    bool resetProgress();
+    bool saveProgress(int32_t offset, int32_t length);
+    bool isPartCompleted(int32_t offset);
+    void setPartCompleted(int32_t offset, int32_t length);
+    void setDownloadEndOffset(int32_t offset);
+    void updateDownloadedBytes();
+    bool isDownloadFinished();
+    bool isPartRequested(int32_t offset);
+    bool isRangeCompleted(int32_t offset, int32_t length);
+    int32_t getNextRequestOffset(int32_t *maxSize);
+    void updateDownloadParameters();
+    int32_t getRequestChunkSize(int32_t offset, int32_t maxSize);
 
     int32_t datacenter_id;
     std::unique_ptr<InputFileLocation> location;
     FileLoadState state = FileLoadStateIdle;
+    FileLoadPriority priority = FileLoadPriorityBackground;
     int32_t downloadedBytes = 0;
+    int32_t completedBytes = 0;
+    int32_t downloadEndOffset = -1;
     int32_t totalBytesCount = 0;
     int32_t bytesCountPadding = 0;
     std::unique_ptr<ByteArray> key;
     std::unique_ptr<ByteArray> iv;
     int32_t currentDownloadChunkSize = 0;
     uint32_t currentMaxDownloadRequests = 0;
-    int32_t requestsCount = 0;
+    uint32_t maxDownloadRequests = 0;
 
     int32_t nextDownloadOffset = 0;
     std::vector<std::unique_ptr<RequestInfo>> requestInfos;
-    std::vector<std::unique_ptr<RequestInfo>> delayedRequestInfos;
+    std::map<int32_t, std::unique_ptr<RequestInfo>> delayedRequestInfos;
+    std::vector<uint8_t> completedParts;
+    std::vector<std::pair<int32_t, int32_t>> hotRanges;
+
+    pthread_mutex_t streamMutex;
+    pthread_cond_t streamCondition;
+    uint32_t streamReaders = 0;
+    int streamFd = -1;
 
     std::string ext;
 
     std::string filePath;
     std::string tempFilePath;
-    std::string tempFileIvPath;
+    std::string tempProgressPath;
 
-    FILE *tempFile = nullptr;
-    FILE *tempIvFile = nullptr;
+    int tempFileFd = -1;
+    int tempProgressFd = -1;
 
     std::string destPath;
     std::string tempPath;
@@ -86,6 +123,8 @@ private:
     onFinishedFunc onFinishedCallback = nullptr;
     onFailedFunc onFailedCallback = nullptr;
     onProgressChangedFunc onProgressChangedCallback = nullptr;
+
+    friend class DownloadScheduler;
 };
 
 #endif
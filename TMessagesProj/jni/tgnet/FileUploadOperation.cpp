@@ -0,0 +1,476 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#include "FileUploadOperation.h"
+#include <algorithm>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <openssl/md5.h>
+#include <openssl/rand.h>
+#include "ApiScheme.h"
+#include "ByteArray.h"
+#include "MTProtoScheme.h"
+#include "FileLog.h"
+#include "ConnectionsManager.h"
+#include "FileIoWorker.h"
+
+#define UPLOAD_PROGRESS_HEADER_SIZE 28
+
+FileUploadOperation::FileUploadOperation(std::string path, std::string temp) {
+    if (!temp.empty() && temp.find_last_of('/') != temp.size() - 1) {
+        temp += "/";
+    }
+    filePath = path;
+    tempPath = temp;
+}
+
+FileUploadOperation::~FileUploadOperation() {
+    if (fileFd != -1) {
+        close(fileFd);
+        fileFd = -1;
+    }
+    if (progressFd != -1) {
+        close(progressFd);
+        progressFd = -1;
+    }
+#ifdef ANDROID
+    if (ptr1 != nullptr) {
+        jniEnv[0]->DeleteGlobalRef(ptr1);
+        ptr1 = nullptr;
+    }
+#endif
+}
+
+void FileUploadOperation::start() {
+    ConnectionsManager::getInstance(0).scheduleTask([&] {
+        if (state != FileUploadStateIdle) {
+            return;
+        }
+        state = FileUploadStateUploading;
+        struct stat st;
+        fileFd = open(filePath.c_str(), O_RDONLY);
+        if (fileFd == -1 || fstat(fileFd, &st) != 0 || st.st_size <= 0) {
+            if (LOGS_ENABLED) DEBUG_E("unable to open file for upload %s, errno %d", filePath.c_str(), errno);
+            onFailedUploadingFile(FileLoadFailReasonError);
+            return;
+        }
+        totalBytesCount = st.st_size;
+        isBigFile = totalBytesCount > UPLOAD_BIG_FILE_MIN_SIZE;
+        uploadChunkSize = UPLOAD_CHUNK_SIZE;
+        while (uploadChunkSize < UPLOAD_CHUNK_MAX_SIZE && (totalBytesCount + uploadChunkSize - 1) / uploadChunkSize > UPLOAD_MAX_PARTS) {
+            uploadChunkSize *= 2;
+        }
+        totalPartsCount = (int32_t) ((totalBytesCount + uploadChunkSize - 1) / uploadChunkSize);
+        if (totalPartsCount > UPLOAD_MAX_PARTS) {
+            if (LOGS_ENABLED) DEBUG_E("file is too big for upload %s, %" PRId64 " bytes", filePath.c_str(), totalBytesCount);
+            onFailedUploadingFile(FileLoadFailReasonError);
+            return;
+        }
+
+        progressPath = tempPath + to_string_uint64((uint64_t) std::hash<std::string>()(filePath)) + ".upload";
+        if (restoreProgress((int64_t) st.st_mtime)) {
+            if (LOGS_ENABLED) DEBUG_D("resume uploading file %s, %d of %d parts completed", filePath.c_str(), completedPartsCount, totalPartsCount);
+        } else if (resetProgress((int64_t) st.st_mtime)) {
+            if (LOGS_ENABLED) DEBUG_D("start uploading file %s, %d parts of %d bytes", filePath.c_str(), totalPartsCount, uploadChunkSize);
+        } else {
+            onFailedUploadingFile(FileLoadFailReasonError);
+            return;
+        }
+
+        currentMaxRequests = UPLOAD_CONNECTIONS_COUNT;
+        windowStartTime = ConnectionsManager::getInstance(0).getCurrentTimeMonotonicMillis();
+        if (isBigFile) {
+            md5Finished = true;
+        } else {
+            MD5_Init(&md5Context);
+        }
+        if (completedPartsCount == totalPartsCount && md5Finished) {
+            onFinishUploadingFile();
+        } else {
+            startUploadRequest();
+        }
+    });
+}
+
+void FileUploadOperation::cancel() {
+    ConnectionsManager::getInstance(0).scheduleTask([&] {
+        if (state == FileUploadStateFinished || state == FileUploadStateFailed) {
+            return;
+        }
+        onFailedUploadingFile(FileLoadFailReasonCanceled);
+    });
+}
+
+void FileUploadOperation::setDelegate(onUploadFinishedFunc onFinished, onFailedFunc onFailed, onProgressChangedFunc onProgressChanged) {
+    onFinishedCallback = onFinished;
+    onFailedCallback = onFailed;
+    onProgressChangedCallback = onProgressChanged;
+}
+
+void FileUploadOperation::cleanup() {
+    ConnectionsManager::getInstance(0).scheduleTask([&] {
+        workersCancelled = true;
+        for (size_t a = 0; a < partInfos.size(); a++) {
+            if (partInfos[a]->requestToken != 0) {
+                ConnectionsManager::getInstance(0).cancelRequestInternal(partInfos[a]->requestToken, 0, true, false);
+            }
+        }
+        cleanupPending = true;
+        if (workerTasksCount == 0) {
+            delete this;
+        }
+    });
+}
+
+bool FileUploadOperation::releaseWorkerTask() {
+    workerTasksCount--;
+    if (cleanupPending && workerTasksCount == 0) {
+        delete this;
+        return true;
+    }
+    return false;
+}
+
+void FileUploadOperation::onFinishUploadingFile() {
+    if (state != FileUploadStateUploading) {
+        return;
+    }
+    state = FileUploadStateFinished;
+    if (progressFd != -1) {
+        close(progressFd);
+        progressFd = -1;
+        remove(progressPath.c_str());
+    }
+    if (LOGS_ENABLED) DEBUG_D("finished uploading file %s", filePath.c_str());
+    if (onFinishedCallback != nullptr) {
+        onFinishedCallback(fileId, totalPartsCount, md5);
+    }
+    cleanup();
+}
+
+void FileUploadOperation::onFailedUploadingFile(FileLoadFailReason reason) {
+    if (state == FileUploadStateFailed || state == FileUploadStateFinished) {
+        return;
+    }
+    state = FileUploadStateFailed;
+    if (onFailedCallback != nullptr) {
+        onFailedCallback(reason);
+    }
+    cleanup();
+}
+
+bool FileUploadOperation::restoreProgress(int64_t modificationTime) {
+    progressFd = open(progressPath.c_str(), O_RDWR);
+    if (progressFd == -1) {
+        return false;
+    }
+    uint8_t header[UPLOAD_PROGRESS_HEADER_SIZE];
+    int64_t savedFileId;
+    int64_t savedSize;
+    int64_t savedTime;
+    int32_t savedChunkSize;
+    struct stat st;
+    if (pread(progressFd, header, UPLOAD_PROGRESS_HEADER_SIZE, 0) != UPLOAD_PROGRESS_HEADER_SIZE || fstat(progressFd, &st) != 0) {
+        return false;
+    }
+    memcpy(&savedFileId, header, sizeof(int64_t));
+    memcpy(&savedSize, header + 8, sizeof(int64_t));
+    memcpy(&savedTime, header + 16, sizeof(int64_t));
+    memcpy(&savedChunkSize, header + 24, sizeof(int32_t));
+    if (savedFileId == 0 || savedSize != totalBytesCount || savedTime != modificationTime || savedChunkSize != uploadChunkSize) {
+        return false;
+    }
+    completedParts.resize((size_t) st.st_size - UPLOAD_PROGRESS_HEADER_SIZE);
+    if (!completedParts.empty() && pread(progressFd, &completedParts[0], completedParts.size(), UPLOAD_PROGRESS_HEADER_SIZE) != (ssize_t) completedParts.size()) {
+        completedParts.clear();
+        return false;
+    }
+    fileId = savedFileId;
+    completedPartsCount = 0;
+    uploadedBytes = 0;
+    for (int32_t a = 0; a < totalPartsCount; a++) {
+        if (isPartCompleted(a)) {
+            completedPartsCount++;
+            uploadedBytes += getPartSize(a);
+        }
+    }
+    return true;
+}
+
+bool FileUploadOperation::resetProgress(int64_t modificationTime) {
+    completedParts.clear();
+    completedPartsCount = 0;
+    uploadedBytes = 0;
+    fileId = 0;
+    while (fileId == 0) {
+        RAND_bytes((uint8_t *) &fileId, sizeof(int64_t));
+    }
+    if (progressFd != -1) {
+        close(progressFd);
+    }
+    progressFd = open(progressPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (progressFd == -1) {
+        if (LOGS_ENABLED) DEBUG_E("unable to create upload progress %s, errno %d", progressPath.c_str(), errno);
+        return false;
+    }
+    uint8_t header[UPLOAD_PROGRESS_HEADER_SIZE];
+    memcpy(header, &fileId, sizeof(int64_t));
+    memcpy(header + 8, &totalBytesCount, sizeof(int64_t));
+    memcpy(header + 16, &modificationTime, sizeof(int64_t));
+    memcpy(header + 24, &uploadChunkSize, sizeof(int32_t));
+    return pwrite(progressFd, header, UPLOAD_PROGRESS_HEADER_SIZE, 0) == UPLOAD_PROGRESS_HEADER_SIZE;
+}
+
+bool FileUploadOperation::saveProgress(int32_t partNum) {
+    uint32_t index = (uint32_t) partNum / 8;
+    return pwrite(progressFd, &completedParts[index], 1, UPLOAD_PROGRESS_HEADER_SIZE + index) == 1;
+}
+
+bool FileUploadOperation::isPartCompleted(int32_t partNum) {
+    uint32_t index = (uint32_t) partNum;
+    return index / 8 < completedParts.size() && (completedParts[index / 8] & (1 << (index % 8))) != 0;
+}
+
+void FileUploadOperation::setPartCompleted(int32_t partNum) {
+    uint32_t index = (uint32_t) partNum;
+    if (index / 8 >= completedParts.size()) {
+        completedParts.resize(index / 8 + 1);
+    }
+    completedParts[index / 8] |= (uint8_t) (1 << (index % 8));
+}
+
+int32_t FileUploadOperation::getPartSize(int32_t partNum) {
+    return (int32_t) std::min((int64_t) uploadChunkSize, totalBytesCount - (int64_t) partNum * uploadChunkSize);
+}
+
+bool FileUploadOperation::hashFileRange(int fd, int64_t end) {
+    if (md5Offset >= end) {
+        return true;
+    }
+    uint8_t *buffer = new uint8_t[UPLOAD_MD5_BLOCK_SIZE];
+    while (md5Offset < end && !workersCancelled) {
+        ssize_t result = pread(fd, buffer, (size_t) std::min((int64_t) UPLOAD_MD5_BLOCK_SIZE, end - md5Offset), md5Offset);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        MD5_Update(&md5Context, buffer, (size_t) result);
+        md5Offset += result;
+    }
+    delete[] buffer;
+    return md5Offset == end;
+}
+
+void FileUploadOperation::finishMd5() {
+    md5Requested = true;
+    workerTasksCount++;
+    int fd = fileFd;
+    int64_t size = totalBytesCount;
+    FileIoWorker::getInstance().post([this, fd, size] {
+        std::string checksum;
+        if (!md5Failed && hashFileRange(fd, size)) {
+            static const char *hex = "0123456789abcdef";
+            uint8_t digest[MD5_DIGEST_LENGTH];
+            MD5_Final(digest, &md5Context);
+            for (int32_t a = 0; a < MD5_DIGEST_LENGTH; a++) {
+                checksum += hex[digest[a] >> 4];
+                checksum += hex[digest[a] & 0x0f];
+            }
+        }
+        ConnectionsManager::getInstance(0).scheduleTask([this, checksum] {
+            if (releaseWorkerTask() || state != FileUploadStateUploading) {
+                return;
+            }
+            if (checksum.empty()) {
+                if (LOGS_ENABLED) DEBUG_E("unable to read file for md5 %s", filePath.c_str());
+                onFailedUploadingFile(FileLoadFailReasonError);
+                return;
+            }
+            md5 = checksum;
+            md5Finished = true;
+            if (completedPartsCount == totalPartsCount) {
+                onFinishUploadingFile();
+            }
+        });
+    });
+}
+
+void FileUploadOperation::startUploadRequest() {
+    if (state != FileUploadStateUploading) {
+        return;
+    }
+    while (partInfos.size() < currentMaxRequests) {
+        while (nextPartNum < totalPartsCount && isPartCompleted(nextPartNum)) {
+            nextPartNum++;
+        }
+        if (nextPartNum >= totalPartsCount) {
+            break;
+        }
+        PartInfo *partInfo = new PartInfo();
+        partInfo->partNum = nextPartNum++;
+        partInfos.push_back(std::unique_ptr<PartInfo>(partInfo));
+        readPart(partInfo);
+    }
+    if (!md5Requested && !isBigFile && nextPartNum >= totalPartsCount) {
+        finishMd5();
+    }
+}
+
+void FileUploadOperation::readPart(PartInfo *partInfo) {
+    workerTasksCount++;
+    int fd = fileFd;
+    int64_t offset = (int64_t) partInfo->partNum * uploadChunkSize;
+    int32_t size = getPartSize(partInfo->partNum);
+    bool hashPart = !isBigFile;
+    FileIoWorker::getInstance().post([this, partInfo, fd, offset, size, hashPart] {
+        ByteArray *bytes = new ByteArray((uint32_t) size);
+        int32_t read = 0;
+        while (read < size && !workersCancelled) {
+            ssize_t result = pread(fd, bytes->bytes + read, (size_t) (size - read), offset + read);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                break;
+            }
+            read += result;
+        }
+        if (read != size) {
+            delete bytes;
+            bytes = nullptr;
+        } else if (hashPart && !md5Failed) {
+            // parts are queued in increasing order on a single thread, so only parts skipped on resume are read again
+            if (hashFileRange(fd, offset)) {
+                MD5_Update(&md5Context, bytes->bytes, (size_t) size);
+                md5Offset += size;
+            } else {
+                md5Failed = true;
+            }
+        }
+        ConnectionsManager::getInstance(0).scheduleTask([this, partInfo, bytes] {
+            if (releaseWorkerTask() || state != FileUploadStateUploading) {
+                if (bytes != nullptr) {
+                    delete bytes;
+                }
+                return;
+            }
+            if (bytes == nullptr) {
+                if (LOGS_ENABLED) DEBUG_E("unable to read part %d of %s", partInfo->partNum, filePath.c_str());
+                onFailedUploadingFile(FileLoadFailReasonError);
+                return;
+            }
+            partInfo->bytes.reset(bytes);
+            sendPart(partInfo);
+        });
+    });
+}
+
+void FileUploadOperation::sendPart(PartInfo *partInfo) {
+    TLObject *request;
+    if (isBigFile) {
+        TL_upload_saveBigFilePart *saveBigFilePart = new TL_upload_saveBigFilePart();
+        saveBigFilePart->file_id = fileId;
+        saveBigFilePart->file_part = partInfo->partNum;
+        saveBigFilePart->file_total_parts = totalPartsCount;
+        saveBigFilePart->bytes = std::move(partInfo->bytes);
+        request = saveBigFilePart;
+    } else {
+        TL_upload_saveFilePart *saveFilePart = new TL_upload_saveFilePart();
+        saveFilePart->file_id = fileId;
+        saveFilePart->file_part = partInfo->partNum;
+        saveFilePart->bytes = std::move(partInfo->bytes);
+        request = saveFilePart;
+    }
+    uint32_t connectionNum = 0;
+    for (uint32_t a = 1; a < UPLOAD_CONNECTIONS_COUNT; a++) {
+        if (connectionRequests[a] < connectionRequests[connectionNum]) {
+            connectionNum = a;
+        }
+    }
+    partInfo->connectionNum = connectionNum;
+    connectionRequests[connectionNum]++;
+    partInfo->requestToken = ConnectionsManager::getInstance(0).sendRequest(request, [&, partInfo](TLObject *response, TL_error *error, int32_t networkType) {
+        partInfo->requestToken = 0;
+        processPartResult(partInfo, response, error);
+    }, nullptr, RequestFlagFailOnServerErrors, DEFAULT_DATACENTER_ID, (ConnectionType) (ConnectionTypeUpload | (connectionNum << 16)), true);
+    if (partInfo->requestToken == 0) {
+        onFailedUploadingFile(FileLoadFailReasonError);
+    }
+}
+
+void FileUploadOperation::processPartResult(PartInfo *partInfo, TLObject *response, TL_error *error) {
+    if (connectionRequests[partInfo->connectionNum] != 0) {
+        connectionRequests[partInfo->connectionNum]--;
+    }
+    int32_t partNum = partInfo->partNum;
+    std::vector<std::unique_ptr<PartInfo>>::iterator iter = std::find_if(partInfos.begin(), partInfos.end(), [&](std::unique_ptr<PartInfo> &p) {
+        return p.get() == partInfo;
+    });
+    if (iter != partInfos.end()) {
+        partInfos.erase(iter);
+    }
+    if (state != FileUploadStateUploading) {
+        return;
+    }
+    if (error != nullptr || dynamic_cast<TL_boolTrue *>(response) == nullptr) {
+        static std::string retryLimit = "RETRY_LIMIT";
+        if (LOGS_ENABLED) DEBUG_E("failed to upload part %d of %s", partNum, filePath.c_str());
+        onFailedUploadingFile(error != nullptr && error->text.find(retryLimit) != std::string::npos ? FileLoadFailReasonRetryLimit : FileLoadFailReasonError);
+        return;
+    }
+    int32_t size = getPartSize(partNum);
+    setPartCompleted(partNum);
+    completedPartsCount++;
+    uploadedBytes += size;
+    if (!saveProgress(partNum)) {
+        onFailedUploadingFile(FileLoadFailReasonError);
+        return;
+    }
+    if (onProgressChangedCallback != nullptr) {
+        onProgressChangedCallback(std::min(1.0f, (float) uploadedBytes / (float) totalBytesCount));
+    }
+    updateWindow(size);
+    if (completedPartsCount == totalPartsCount) {
+        if (md5Finished) {
+            onFinishUploadingFile();
+        }
+    } else {
+        startUploadRequest();
+    }
+}
+
+void FileUploadOperation::updateWindow(int32_t bytes) {
+    windowBytes += bytes;
+    if (++windowParts < currentMaxRequests) {
+        return;
+    }
+    int64_t now = ConnectionsManager::getInstance(0).getCurrentTimeMonotonicMillis();
+    int64_t elapsed = now - windowStartTime;
+    if (elapsed > 0) {
+        int64_t rate = windowBytes * 1000 / elapsed;
+        if (rate > bestRate + bestRate / 8) {
+            bestRate = rate;
+            if (currentMaxRequests < UPLOAD_MAX_REQUESTS) {
+                currentMaxRequests++;
+            }
+        } else if (rate < bestRate - bestRate / 4) {
+            bestRate = rate;
+            if (currentMaxRequests > UPLOAD_MIN_REQUESTS) {
+                currentMaxRequests--;
+            }
+        }
+    }
+    windowStartTime = now;
+    windowBytes = 0;
+    windowParts = 0;
+}
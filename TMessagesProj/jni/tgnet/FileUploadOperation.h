@@ -0,0 +1,109 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#ifndef FILEUPLOADOPERATION_H
+#define FILEUPLOADOPERATION_H
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <openssl/md5.h>
+#include "Defines.h"
+
+#ifdef ANDROID
+#include <jni.h>
+#endif
+
+class ByteArray;
+
+class FileUploadOperation {
+
+public:
+    FileUploadOperation(std::string path, std::string temp);
+    ~FileUploadOperation();
+
+    void start();
+    void cancel();
+    void setDelegate(onUploadFinishedFunc onFinished, onFailedFunc onFailed, onProgressChangedFunc onProgressChanged);
+
+#ifdef ANDROID
+    jobject ptr1 = nullptr;
+#endif
+
+private:
+
+    class PartInfo {
+
+    public:
+        int32_t partNum = 0;
+        int32_t requestToken = 0;
+        uint32_t connectionNum = 0;
+        std::unique_ptr<ByteArray> bytes;
+    };
+
+    void cleanup();
+    void onFinishUploadingFile();
+    void onFailedUploadingFile(FileLoadFailReason reason);
+    void startUploadRequest();
+    void readPart(PartInfo *partInfo);
+    void sendPart(PartInfo *partInfo);
+    void processPartResult(PartInfo *partInfo, TLObject *response, TL_error *error);
+    bool releaseWorkerTask();
+    bool hashFileRange(int fd, int64_t end);
+    void finishMd5();
+    void updateWindow(int32_t bytes);
+    bool restoreProgress(int64_t modificationTime);
+    bool resetProgress(int64_t modificationTime);
+    bool saveProgress(int32_t partNum);
+    bool isPartCompleted(int32_t partNum);
+    void setPartCompleted(int32_t partNum);
+    int32_t getPartSize(int32_t partNum);
+
+    FileUploadState state = FileUploadStateIdle;
+    int64_t fileId = 0;
+    int64_t totalBytesCount = 0;
+    int64_t uploadedBytes = 0;
+    int32_t uploadChunkSize = 0;
+    int32_t totalPartsCount = 0;
+    int32_t nextPartNum = 0;
+    int32_t completedPartsCount = 0;
+    bool isBigFile = false;
+
+    uint32_t currentMaxRequests = UPLOAD_MIN_REQUESTS;
+    int64_t windowStartTime = 0;
+    int64_t windowBytes = 0;
+    uint32_t windowParts = 0;
+    int64_t bestRate = 0;
+
+    std::vector<std::unique_ptr<PartInfo>> partInfos;
+    std::vector<uint8_t> completedParts;
+    uint32_t connectionRequests[UPLOAD_CONNECTIONS_COUNT] = {};
+
+    std::string md5;
+    bool md5Finished = false;
+    bool md5Requested = false;
+    MD5_CTX md5Context;
+    int64_t md5Offset = 0;
+    bool md5Failed = false;
+    std::atomic<bool> workersCancelled{false};
+    uint32_t workerTasksCount = 0;
+    bool cleanupPending = false;
+
+    std::string filePath;
+    std::string tempPath;
+    std::string progressPath;
+
+    int fileFd = -1;
+    int progressFd = -1;
+
+    onUploadFinishedFunc onFinishedCallback = nullptr;
+    onFailedFunc onFailedCallback = nullptr;
+    onProgressChangedFunc onProgressChangedCallback = nullptr;
+};
+
+#endif
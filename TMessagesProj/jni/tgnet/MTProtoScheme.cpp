@@ -16,71 +16,93 @@
 #include "BuffersStorage.h"
 #include "ConnectionsManager.h"
 
+#define TL_CLASS_STORE_TABLE_SIZE 64
+
+template <class T>
+static TLObject *createTLObject() {
+    return new T();
+}
+
+struct TLClassStoreEntry {
+    uint32_t constructor;
+    TLObject *(*create)();
+};
+
+static const TLClassStoreEntry classStoreEntries[] = {
+    {TL_msgs_ack::constructor, createTLObject<TL_msgs_ack>},
+    {TL_msg_container::constructor, createTLObject<TL_msg_container>},
+    {TL_pong::constructor, createTLObject<TL_pong>},
+    {TL_new_session_created::constructor, createTLObject<TL_new_session_created>},
+    {MsgsStateInfo::constructor, createTLObject<MsgsStateInfo>},
+    {TL_bad_msg_notification::constructor, createTLObject<TL_bad_msg_notification>},
+    {TL_bad_server_salt::constructor, createTLObject<TL_bad_server_salt>},
+    {TL_msg_detailed_info::constructor, createTLObject<TL_msg_detailed_info>},
+    {TL_msg_new_detailed_info::constructor, createTLObject<TL_msg_new_detailed_info>},
+    {TL_gzip_packed::constructor, createTLObject<TL_gzip_packed>},
+    {TL_error::constructor, createTLObject<TL_error>},
+    {TL_rpc_error::constructor, createTLObject<TL_rpc_error>},
+    {TL_rpc_req_error::constructor, createTLObject<TL_rpc_req_error>},
+    {TL_future_salts::constructor, createTLObject<TL_future_salts>},
+    {TL_destroy_session_ok::constructor, createTLObject<TL_destroy_session_ok>},
+    {TL_destroy_session_none::constructor, createTLObject<TL_destroy_session_none>},
+    {TL_updatesTooLong::constructor, createTLObject<TL_updatesTooLong>}
+};
+
+class TLClassStoreTable {
+
+public:
+    TLClassStoreTable() {
+        for (const TLClassStoreEntry &entry : classStoreEntries) {
+            uint32_t slot = getSlot(entry.constructor);
+            while (slots[slot] != nullptr) {
+                slot = (slot + 1) & (TL_CLASS_STORE_TABLE_SIZE - 1);
+            }
+            slots[slot] = &entry;
+        }
+    }
+
+    const TLClassStoreEntry *find(uint32_t constructor) const {
+        uint32_t slot = getSlot(constructor);
+        while (slots[slot] != nullptr) {
+            if (slots[slot]->constructor == constructor) {
+                return slots[slot];
+            }
+            slot = (slot + 1) & (TL_CLASS_STORE_TABLE_SIZE - 1);
+        }
+        return nullptr;
+    }
+
+private:
+    static uint32_t getSlot(uint32_t constructor) {
+        return (constructor * 0x9e3779b1U) >> 26;
+    }
+
+    const TLClassStoreEntry *slots[TL_CLASS_STORE_TABLE_SIZE] = {};
+};
+
 TLObject *TLClassStore::TLdeserialize(NativeByteBuffer *stream, uint32_t bytes, uint32_t constructor, int32_t instanceNum, bool &error) {
-    TLObject *object = nullptr;
-    switch (constructor) {
-        case TL_msgs_ack::constructor:
-            object = new TL_msgs_ack();
-            break;
-        case TL_msg_container::constructor:
-            object = new TL_msg_container();
-            break;
-        case TL_pong::constructor:
-            object = new TL_pong();
-            break;
-        case TL_new_session_created::constructor:
-            object = new TL_new_session_created();
-            break;
-        case MsgsStateInfo::constructor:
-            object = new MsgsStateInfo();
-            break;
-        case TL_rpc_result::constructor:
-            object = new TL_rpc_result();
-            ((TL_rpc_result *) object)->readParamsEx(stream, bytes, instanceNum, error);
-            return object;
-        case TL_bad_msg_notification::constructor:
-            object = new TL_bad_msg_notification();
-            break;
-        case TL_bad_server_salt::constructor:
-            object = new TL_bad_server_salt();
-            break;
-        case TL_msg_detailed_info::constructor:
-            object = new TL_msg_detailed_info();
-            break;
-        case TL_msg_new_detailed_info::constructor:
-            object = new TL_msg_new_detailed_info();
-            break;
-        case TL_gzip_packed::constructor:
-            object = new TL_gzip_packed();
-            break;
-        case TL_error::constructor:
-            object = new TL_error();
-            break;
-        case TL_rpc_error::constructor:
-            object = new TL_rpc_error();
-            break;
-        case TL_rpc_req_error::constructor:
-            object = new TL_rpc_req_error();
-            break;
-        case TL_future_salts::constructor:
-            object = new TL_future_salts();
-            break;
-        case TL_destroy_session_ok::constructor:
-            object = new TL_destroy_session_ok();
-            break;
-        case TL_destroy_session_none::constructor:
-            object = new TL_destroy_session_none();
-            break;
-        case TL_updatesTooLong::constructor:
-            object = new TL_updatesTooLong();
-            break;
-        default:
-            return nullptr;
+    if (constructor == TL_rpc_result::constructor) {
+        TL_rpc_result *object = new TL_rpc_result();
+        object->readParamsEx(stream, bytes, instanceNum, error);
+        return object;
     }
+    static const TLClassStoreTable table;
+    const TLClassStoreEntry *entry = table.find(constructor);
+    if (entry == nullptr) {
+        return nullptr;
+    }
+    TLObject *object = entry->create();
     object->readParams(stream, instanceNum, error);
     return object;
 }
 
+RpcError *TLClassStore::asRpcError(TLObject *object) {
+    if (object->objectConstructor == TL_rpc_error::constructor || object->objectConstructor == TL_rpc_req_error::constructor) {
+        return (RpcError *) object;
+    }
+    return nullptr;
+}
+
 TL_api_request::~TL_api_request() {
     if (request != nullptr) {
         request->reuse();
@@ -103,6 +125,10 @@ void TL_api_request::serializeToStream(NativeByteBuffer *stream) {
     stream->writeBytes(request);
 }
 
+uint32_t TL_api_request::getObjectSize() {
+    return request->limit();
+}
+
 void TL_api_response::readParamsEx(NativeByteBuffer *stream, uint32_t bytes, bool &error) {
     response = std::unique_ptr<NativeByteBuffer>(new NativeByteBuffer(stream->bytes() + stream->position() - 4, bytes));
     stream->skip((uint32_t) (bytes - 4));
@@ -560,6 +586,7 @@ void TL_msgs_all_info::readParams(NativeByteBuffer *stream, int32_t instanceNum,
 
 void TL_rpc_result::readParamsEx(NativeByteBuffer *stream, uint32_t bytes, int32_t instanceNum, bool &error) {
     req_msg_id = stream->readInt64(&error);
+    resultLength = bytes - 12;
     ConnectionsManager &connectionsManager = ConnectionsManager::getInstance(instanceNum);
     TLObject *object = connectionsManager.TLdeserialize(connectionsManager.getRequestWithMessageId(req_msg_id), bytes - 12, stream);
     if (object != nullptr) {
@@ -639,6 +666,10 @@ void TL_msgs_ack::serializeToStream(NativeByteBuffer *stream) {
     }
 }
 
+uint32_t TL_msgs_ack::getObjectSize() {
+    return 12 + (uint32_t) msg_ids.size() * 8;
+}
+
 TL_msg_container *TL_msg_container::TLdeserialize(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error) {
     if (TL_msg_container::constructor != constructor) {
         error = true;
@@ -671,6 +702,15 @@ void TL_msg_container::serializeToStream(NativeByteBuffer *stream) {
     }
 }
 
+uint32_t TL_msg_container::getObjectSize() {
+    uint32_t size = 8;
+    size_t count = messages.size();
+    for (uint32_t a = 0; a < count; a++) {
+        size += messages[a]->getObjectSize();
+    }
+    return size;
+}
+
 TL_message *TL_message::TLdeserialize(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error) {
     if (TL_message::constructor != constructor) {
         error = true;
@@ -706,6 +746,10 @@ void TL_message::serializeToStream(NativeByteBuffer *stream) {
     }
 }
 
+uint32_t TL_message::getObjectSize() {
+    return 16 + (uint32_t) bytes;
+}
+
 TL_msg_resend_req *TL_msg_resend_req::TLdeserialize(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error) {
     if (TL_msg_resend_req::constructor != constructor) {
         error = true;
@@ -744,6 +788,10 @@ void TL_msg_resend_req::serializeToStream(NativeByteBuffer *stream) {
     }
 }
 
+uint32_t TL_msg_resend_req::getObjectSize() {
+    return 12 + (uint32_t) msg_ids.size() * 8;
+}
+
 void MsgsStateInfo::readParams(NativeByteBuffer *stream, int32_t instanceNum, bool &error) {
     req_msg_id = stream->readInt64(&error);
     info = stream->readString(&error);
@@ -878,6 +926,10 @@ void TL_ping_delay_disconnect::serializeToStream(NativeByteBuffer *stream) {
     stream->writeInt32(disconnect_delay);
 }
 
+uint32_t TL_ping_delay_disconnect::getObjectSize() {
+    return 16;
+}
+
 TLObject *TL_destroy_session::deserializeResponse(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error) {
     return DestroySessionRes::TLdeserialize(stream, constructor, instanceNum, error);
 }
@@ -903,6 +955,10 @@ void TL_gzip_packed::serializeToStream(NativeByteBuffer *stream) {
     stream->writeByteArray(packed_data_to_send);
 }
 
+uint32_t TL_gzip_packed::getObjectSize() {
+    return 4 + NativeByteBuffer::getByteArraySize(packed_data_to_send->limit());
+}
+
 TL_error *TL_error::TLdeserialize(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error) {
     if (TL_error::constructor != constructor) {
         error = true;
@@ -935,18 +991,30 @@ void TL_invokeAfterMsg::serializeToStream(NativeByteBuffer *stream) {
     }
 }
 
+uint32_t TL_invokeAfterMsg::getObjectSize() {
+    return 12 + (outgoingQuery != nullptr ? outgoingQuery->getObjectSize() : query->getObjectSize());
+}
+
 void invokeWithLayer::serializeToStream(NativeByteBuffer *stream) {
     stream->writeInt32(constructor);
     stream->writeInt32(layer);
     query->serializeToStream(stream);
 }
 
+uint32_t invokeWithLayer::getObjectSize() {
+    return 8 + query->getObjectSize();
+}
+
 void TL_inputClientProxy::serializeToStream(NativeByteBuffer *stream) {
     stream->writeInt32(constructor);
     stream->writeString(address);
     stream->writeInt32(port);
 }
 
+uint32_t TL_inputClientProxy::getObjectSize() {
+    return 8 + NativeByteBuffer::getByteArraySize((uint32_t) address.length());
+}
+
 void initConnection::serializeToStream(NativeByteBuffer *stream) {
     stream->writeInt32(constructor);
     stream->writeInt32(flags);
@@ -963,6 +1031,20 @@ void initConnection::serializeToStream(NativeByteBuffer *stream) {
     query->serializeToStream(stream);
 }
 
+uint32_t initConnection::getObjectSize() {
+    uint32_t size = 12;
+    size += NativeByteBuffer::getByteArraySize((uint32_t) device_model.length());
+    size += NativeByteBuffer::getByteArraySize((uint32_t) system_version.length());
+    size += NativeByteBuffer::getByteArraySize((uint32_t) app_version.length());
+    size += NativeByteBuffer::getByteArraySize((uint32_t) system_lang_code.length());
+    size += NativeByteBuffer::getByteArraySize((uint32_t) lang_pack.length());
+    size += NativeByteBuffer::getByteArraySize((uint32_t) lang_code.length());
+    if ((flags & 1) != 0) {
+        size += proxy->getObjectSize();
+    }
+    return size + query->getObjectSize();
+}
+
 IpPort *IpPort::TLdeserialize(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error) {
     IpPort *result = nullptr;
     switch (constructor) {
@@ -17,11 +17,13 @@
 
 class ByteArray;
 class NativeByteBuffer;
+class RpcError;
 
 class TLClassStore {
 
 public:
     static TLObject *TLdeserialize(NativeByteBuffer *stream, uint32_t bytes, uint32_t constructor, int32_t instanceNum, bool &error);
+    static RpcError *asRpcError(TLObject *object);
 
 };
 
@@ -34,6 +36,7 @@ public:
     bool isNeedLayer();
     TLObject *deserializeResponse(NativeByteBuffer *stream, uint32_t bytes, bool &error);
     void serializeToStream(NativeByteBuffer *stream);
+    uint32_t getObjectSize();
 };
 
 class TL_api_response : public TLObject {
@@ -311,6 +314,7 @@ public:
     static TL_message *TLdeserialize(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error);
     void readParams(NativeByteBuffer *stream, int32_t instanceNum, bool &error);
     void serializeToStream(NativeByteBuffer *stream);
+    uint32_t getObjectSize();
 };
 
 class TL_dh_gen_retry : public Set_client_DH_params_answer {
@@ -433,6 +437,7 @@ public:
     static const uint32_t constructor = 0xf35c6d01;
 
     int64_t req_msg_id;
+    uint32_t resultLength = 0;
     std::unique_ptr<TLObject> result;
 
     void readParamsEx(NativeByteBuffer *stream, uint32_t bytes, int32_t instanceNum, bool &error);
@@ -484,6 +489,7 @@ public:
     static TL_msgs_ack *TLdeserialize(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error);
     void readParams(NativeByteBuffer *stream, int32_t instanceNum, bool &error);
     void serializeToStream(NativeByteBuffer *stream);
+    uint32_t getObjectSize();
 };
 
 class TL_msg_container : public TLObject {
@@ -496,6 +502,7 @@ public:
     static TL_msg_container *TLdeserialize(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error);
     void readParams(NativeByteBuffer *stream, int32_t instanceNum, bool &error);
     void serializeToStream(NativeByteBuffer *stream);
+    uint32_t getObjectSize();
 };
 
 class TL_msg_resend_req : public TLObject {
@@ -508,6 +515,7 @@ public:
     static TL_msg_resend_req *TLdeserialize(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error);
     void readParams(NativeByteBuffer *stream, int32_t instanceNum, bool &error);
     void serializeToStream(NativeByteBuffer *stream);
+    uint32_t getObjectSize();
 };
 
 class MsgsStateInfo : public TLObject {
@@ -669,6 +677,7 @@ public:
 
     TLObject *deserializeResponse(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error);
     void serializeToStream(NativeByteBuffer *stream);
+    uint32_t getObjectSize();
 };
 
 class TL_destroy_session : public TLObject {
@@ -694,6 +703,7 @@ public:
     ~TL_gzip_packed();
     void readParams(NativeByteBuffer *stream, int32_t instanceNum, bool &error);
     void serializeToStream(NativeByteBuffer *stream);
+    uint32_t getObjectSize();
 };
 
 class TL_error : public TLObject {
@@ -719,6 +729,7 @@ public:
     std::unique_ptr<TLObject> query;
 
     void serializeToStream(NativeByteBuffer *stream);
+    uint32_t getObjectSize();
 };
 
 class invokeWithLayer : public TLObject {
@@ -730,6 +741,7 @@ public:
     std::unique_ptr<TLObject> query;
 
     void serializeToStream(NativeByteBuffer *stream);
+    uint32_t getObjectSize();
 };
 
 class TL_inputClientProxy : public TLObject {
@@ -741,6 +753,7 @@ public:
     int32_t port;
 
     void serializeToStream(NativeByteBuffer *stream);
+    uint32_t getObjectSize();
 };
 
 class initConnection : public TLObject {
@@ -760,6 +773,7 @@ public:
     std::unique_ptr<TLObject> query;
 
     void serializeToStream(NativeByteBuffer *stream);
+    uint32_t getObjectSize();
 };
 
 class IpPort : public TLObject {
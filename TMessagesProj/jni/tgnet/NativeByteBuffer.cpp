@@ -13,32 +13,41 @@
 #include "ByteArray.h"
 #include "ConnectionsManager.h"
 #include "BuffersStorage.h"
+#include "SlabAllocator.h"
+
+#define NATIVE_BYTE_BUFFER_MIN_SLICE_SIZE (16 * 1024)
 
 NativeByteBuffer::NativeByteBuffer(uint32_t size) {
-#ifdef ANDROID
-    if (jclass_ByteBuffer != nullptr) {
-        JNIEnv *env = 0;
-        if (javaVm->GetEnv((void **) &env, JNI_VERSION_1_6) != JNI_OK) {
-            if (LOGS_ENABLED) DEBUG_E("can't get jnienv");
-            exit(1);
-        }
-        javaByteBuffer = env->CallStaticObjectMethod(jclass_ByteBuffer, jclass_ByteBuffer_allocateDirect, size);
-        if (javaByteBuffer == nullptr) {
-            if (LOGS_ENABLED) DEBUG_E("can't create javaByteBuffer");
-            exit(1);
-        }
-        jobject globalRef = env->NewGlobalRef(javaByteBuffer);
-        env->DeleteLocalRef(javaByteBuffer);
-        javaByteBuffer = globalRef;
-        buffer = (uint8_t *) env->GetDirectBufferAddress(javaByteBuffer);
+    if (SlabAllocator::canAllocate(size)) {
+        buffer = SlabAllocator::getInstance().allocate(size);
         bufferOwner = false;
+        slabAllocated = true;
     } else {
+#ifdef ANDROID
+        if (jclass_ByteBuffer != nullptr) {
+            JNIEnv *env = 0;
+            if (javaVm->GetEnv((void **) &env, JNI_VERSION_1_6) != JNI_OK) {
+                if (LOGS_ENABLED) DEBUG_E("can't get jnienv");
+                exit(1);
+            }
+            javaByteBuffer = env->CallStaticObjectMethod(jclass_ByteBuffer, jclass_ByteBuffer_allocateDirect, size);
+            if (javaByteBuffer == nullptr) {
+                if (LOGS_ENABLED) DEBUG_E("can't create javaByteBuffer");
+                exit(1);
+            }
+            jobject globalRef = env->NewGlobalRef(javaByteBuffer);
+            env->DeleteLocalRef(javaByteBuffer);
+            javaByteBuffer = globalRef;
+            buffer = (uint8_t *) env->GetDirectBufferAddress(javaByteBuffer);
+            bufferOwner = false;
+        } else {
 #endif
-        buffer = new uint8_t[size];
-        bufferOwner = true;
+            buffer = new uint8_t[size];
+            bufferOwner = true;
 #ifdef ANDROID
-    }
+        }
 #endif
+    }
     if (buffer == nullptr) {
         if (LOGS_ENABLED) DEBUG_E("can't allocate NativeByteBuffer buffer");
         exit(1);
@@ -68,7 +77,14 @@ NativeByteBuffer::~NativeByteBuffer() {
         javaByteBuffer = nullptr;
     }
 #endif
-    if (bufferOwner && !sliced && buffer != nullptr) {
+    if (sliceOwner != nullptr) {
+        sliceOwner->releaseReference();
+        sliceOwner = nullptr;
+    }
+    if (slabAllocated) {
+        SlabAllocator::getInstance().release(buffer, _capacity);
+        buffer = nullptr;
+    } else if (bufferOwner && !sliced && buffer != nullptr) {
         delete[] buffer;
         buffer = nullptr;
     }
@@ -360,6 +376,11 @@ void NativeByteBuffer::writeByteArray(uint8_t *b, uint32_t offset, uint32_t leng
     }
 }
 
+uint32_t NativeByteBuffer::getByteArraySize(uint32_t length) {
+    uint32_t size = length + (length <= 253 ? 1 : 4);
+    return (size + 3) & ~3U;
+}
+
 void NativeByteBuffer::writeByteArray(uint8_t *b, uint32_t length, bool *error) {
     writeByteArray(b, 0, length, error);
 }
@@ -658,8 +679,13 @@ NativeByteBuffer *NativeByteBuffer::readByteBuffer(bool copy, bool *error) {
     }
     NativeByteBuffer *result = nullptr;
     if (copy) {
-        result = BuffersStorage::getInstance().getFreeBuffer(l);
-        memcpy(result->buffer, buffer + _position, sizeof(uint8_t) * l);
+        if (l >= NATIVE_BYTE_BUFFER_MIN_SLICE_SIZE) {
+            result = createSlice(_position, l);
+        }
+        if (result == nullptr) {
+            result = BuffersStorage::getInstance().getFreeBuffer(l);
+            memcpy(result->buffer, buffer + _position, sizeof(uint8_t) * l);
+        }
     } else {
         result = new NativeByteBuffer(buffer + _position, l);
     }
@@ -676,11 +702,38 @@ double NativeByteBuffer::readDouble(bool *error) {
 
 void NativeByteBuffer::reuse() {
     if (sliced) {
+        if (sliceOwner != nullptr) {
+            delete this;
+        }
+        return;
+    }
+    releaseReference();
+}
+
+void NativeByteBuffer::releaseReference() {
+    if (references.fetch_sub(1, std::memory_order_acq_rel) != 1) {
         return;
     }
+    references.store(1, std::memory_order_relaxed);
+    slicesAllowed = false;
     BuffersStorage::getInstance().reuseFreeBuffer(this);
 }
 
+void NativeByteBuffer::setSlicesAllowed(bool value) {
+    slicesAllowed = value;
+}
+
+NativeByteBuffer *NativeByteBuffer::createSlice(uint32_t offset, uint32_t length) {
+    NativeByteBuffer *owner = sliced ? sliceOwner : this;
+    if (!slicesAllowed || owner == nullptr || offset + length > _limit) {
+        return nullptr;
+    }
+    NativeByteBuffer *result = new NativeByteBuffer(buffer + offset, length);
+    result->sliceOwner = owner;
+    owner->references.fetch_add(1, std::memory_order_relaxed);
+    return result;
+}
+
 #ifdef ANDROID
 jobject NativeByteBuffer::getJavaByteBuffer() {
     if (javaByteBuffer == nullptr && javaVm != nullptr) {
@@ -689,7 +742,12 @@ jobject NativeByteBuffer::getJavaByteBuffer() {
 		    if (LOGS_ENABLED) DEBUG_E("can't get jnienv");
             exit(1);
 	    }
-        javaByteBuffer = env->NewDirectByteBuffer(buffer, _capacity);
+        if (slabAllocated) {
+            javaByteBuffer = SlabAllocator::getInstance().getJavaByteBuffer(buffer, _capacity);
+        }
+        if (javaByteBuffer == nullptr) {
+            javaByteBuffer = env->NewDirectByteBuffer(buffer, _capacity);
+        }
         if (javaByteBuffer == nullptr) {
             if (LOGS_ENABLED) DEBUG_E("can't allocate NativeByteBuffer buffer");
             exit(1);
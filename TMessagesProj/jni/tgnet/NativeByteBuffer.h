@@ -11,6 +11,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <atomic>
 
 #ifdef ANDROID
 #include <jni.h>
@@ -69,6 +70,7 @@ public:
     void writeByteArray(NativeByteBuffer *b);
     void writeByteArray(ByteArray *b);
     void writeDouble(double d);
+    static uint32_t getByteArraySize(uint32_t length);
 
     uint32_t readUint32(bool *error);
     uint64_t readUint64(bool *error);
@@ -85,12 +87,15 @@ public:
     double readDouble(bool *error);
 
     void reuse();
+    void setSlicesAllowed(bool value);
+    NativeByteBuffer *createSlice(uint32_t offset, uint32_t length);
 #ifdef ANDROID
     jobject getJavaByteBuffer();
 #endif
 
 private:
     void writeBytesInternal(uint8_t *b, uint32_t offset, uint32_t length);
+    void releaseReference();
 
     uint8_t *buffer = nullptr;
     bool calculateSizeOnly = false;
@@ -99,6 +104,10 @@ private:
     uint32_t _limit = 0;
     uint32_t _capacity = 0;
     bool bufferOwner = true;
+    bool slabAllocated = false;
+    bool slicesAllowed = false;
+    NativeByteBuffer *sliceOwner = nullptr;
+    std::atomic<uint32_t> references{1};
 #ifdef ANDROID
     jobject javaByteBuffer = nullptr;
 #endif
@@ -0,0 +1,584 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include "NetworkReactor.h"
+#include "ConnectionsManager.h"
+#include "NativeByteBuffer.h"
+#include "EventObject.h"
+#include "FileLog.h"
+
+static pthread_mutex_t sharedReactorsMutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<NetworkReactor *> sharedReactors;
+static uint32_t sharedReactorsCount = 0;
+static bool useIoUring = false;
+
+#define IO_URING_ENTRIES 256
+#define IO_URING_RECV_BUFFERS_COUNT 32
+#define IO_URING_RECV_BUFFER_SIZE (64 * 1024)
+#define IO_URING_KIND_POLL 1
+#define IO_URING_KIND_READ_POLL 2
+#define IO_URING_KIND_READ 3
+
+NetworkReactor::NetworkReactor() {
+    int flags;
+#ifdef USE_IO_URING
+    pthread_mutex_lock(&sharedReactorsMutex);
+    bool ioUring = useIoUring;
+    pthread_mutex_unlock(&sharedReactorsMutex);
+    if (!ioUring || !setupIoUring()) {
+#endif
+        if ((epolFd = epoll_create(128)) == -1) {
+            if (LOGS_ENABLED) DEBUG_E("unable to create epoll instance");
+            exit(1);
+        }
+        if ((flags = fcntl(epolFd, F_GETFD, NULL)) < 0) {
+            if (LOGS_ENABLED) DEBUG_W("fcntl(%d, F_GETFD)", epolFd);
+        }
+        if (!(flags & FD_CLOEXEC)) {
+            if (fcntl(epolFd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+                if (LOGS_ENABLED) DEBUG_W("fcntl(%d, F_SETFD)", epolFd);
+            }
+        }
+#ifdef USE_IO_URING
+    }
+#endif
+
+    if ((epollEvents = new epoll_event[128]) == nullptr) {
+        if (LOGS_ENABLED) DEBUG_E("unable to allocate epoll events");
+        exit(1);
+    }
+
+    eventFd = eventfd(0, EFD_NONBLOCK);
+    if (eventFd != -1) {
+        struct epoll_event event = {0};
+        event.data.ptr = new EventObject(&eventFd, EventObjectTypeEvent);
+        event.events = EPOLLIN | EPOLLET;
+        if (control(EPOLL_CTL_ADD, eventFd, &event) == -1) {
+            eventFd = -1;
+            FileLog::e("unable to add eventfd");
+        }
+    }
+
+    if (eventFd == -1) {
+        pipeFd = new int[2];
+        if (pipe(pipeFd) != 0) {
+            if (LOGS_ENABLED) DEBUG_E("unable to create pipe");
+            exit(1);
+        }
+        flags = fcntl(pipeFd[0], F_GETFL);
+        if (flags == -1) {
+            if (LOGS_ENABLED) DEBUG_E("fcntl get pipefds[0] failed");
+            exit(1);
+        }
+        if (fcntl(pipeFd[0], F_SETFL, flags | O_NONBLOCK) == -1) {
+            if (LOGS_ENABLED) DEBUG_E("fcntl set pipefds[0] failed");
+            exit(1);
+        }
+
+        flags = fcntl(pipeFd[1], F_GETFL);
+        if (flags == -1) {
+            if (LOGS_ENABLED) DEBUG_E("fcntl get pipefds[1] failed");
+            exit(1);
+        }
+        if (fcntl(pipeFd[1], F_SETFL, flags | O_NONBLOCK) == -1) {
+            if (LOGS_ENABLED) DEBUG_E("fcntl set pipefds[1] failed");
+            exit(1);
+        }
+
+        EventObject *eventObject = new EventObject(pipeFd, EventObjectTypePipe);
+
+        epoll_event eventMask = {};
+        eventMask.events = EPOLLIN;
+        eventMask.data.ptr = eventObject;
+        if (control(EPOLL_CTL_ADD, pipeFd[0], &eventMask) != 0) {
+            if (LOGS_ENABLED) DEBUG_E("can't add pipe to epoll");
+            exit(1);
+        }
+    }
+
+    networkBuffer = new NativeByteBuffer((uint32_t) READ_BUFFER_SIZE);
+    if (networkBuffer == nullptr) {
+        if (LOGS_ENABLED) DEBUG_E("unable to allocate read buffer");
+        exit(1);
+    }
+
+    pthread_mutex_init(&mutex, NULL);
+}
+
+NetworkReactor *NetworkReactor::obtain(int32_t instanceNum) {
+    pthread_mutex_lock(&sharedReactorsMutex);
+    NetworkReactor *reactor;
+    if (sharedReactorsCount == 0) {
+        reactor = new NetworkReactor();
+    } else {
+        uint32_t index = (uint32_t) instanceNum % sharedReactorsCount;
+        if (sharedReactors.size() <= index) {
+            sharedReactors.resize(index + 1, nullptr);
+        }
+        if (sharedReactors[index] == nullptr) {
+            sharedReactors[index] = new NetworkReactor();
+        }
+        reactor = sharedReactors[index];
+    }
+    pthread_mutex_unlock(&sharedReactorsMutex);
+    return reactor;
+}
+
+void NetworkReactor::setSharedCount(uint32_t count) {
+    pthread_mutex_lock(&sharedReactorsMutex);
+    sharedReactorsCount = count;
+    pthread_mutex_unlock(&sharedReactorsMutex);
+}
+
+void NetworkReactor::setUseIoUring(bool value) {
+    pthread_mutex_lock(&sharedReactorsMutex);
+    useIoUring = value;
+    pthread_mutex_unlock(&sharedReactorsMutex);
+}
+
+void NetworkReactor::attach(ConnectionsManager *manager) {
+    pthread_mutex_lock(&mutex);
+    pendingManagers.push_back(manager);
+    bool startThread = !threadStarted;
+    threadStarted = true;
+    pthread_mutex_unlock(&mutex);
+    if (startThread) {
+        pthread_create(&networkThread, NULL, (NetworkReactor::ThreadProc), this);
+    } else {
+        wakeup();
+    }
+}
+
+void NetworkReactor::wakeup() {
+    if (pipeFd == nullptr) {
+        eventfd_write(eventFd, 1);
+    } else {
+        char ch = 'x';
+        write(pipeFd[1], &ch, 1);
+    }
+}
+
+int NetworkReactor::control(int op, int fd, struct epoll_event *event) {
+#ifdef USE_IO_URING
+    if (ringFd != -1) {
+        std::map<int, PollEntry>::iterator iter = pollEntries.find(fd);
+        if (op == EPOLL_CTL_ADD) {
+            if (iter != pollEntries.end()) {
+                errno = EEXIST;
+                return -1;
+            }
+            PollEntry &entry = pollEntries[fd];
+            entry.eventObject = (EventObject *) event->data.ptr;
+            entry.events = event->events;
+            entry.armedEvents = 0;
+            entry.pollUserData = 0;
+            entry.readUserData = 0;
+            entry.readSlot = -1;
+            entry.readArmed = false;
+            if (entry.eventObject->eventType == EventObjectTypeConnection && !freeRecvSlots.empty()) {
+                entry.readSlot = freeRecvSlots.back();
+                freeRecvSlots.pop_back();
+            }
+            if ((entry.readSlot >= 0 && (entry.events & EPOLLIN) && !armRead(fd, entry)) || (getPollMask(entry) != 0 && !armPoll(fd, entry))) {
+                releaseEntry(entry);
+                pollEntries.erase(fd);
+                errno = ENOMEM;
+                return -1;
+            }
+            return 0;
+        }
+        if (iter == pollEntries.end()) {
+            errno = ENOENT;
+            return -1;
+        }
+        PollEntry &entry = iter->second;
+        if (op == EPOLL_CTL_DEL) {
+            releaseEntry(entry);
+            pollEntries.erase(iter);
+            return 0;
+        }
+        entry.eventObject = (EventObject *) event->data.ptr;
+        entry.events = event->events;
+        uint32_t mask = getPollMask(entry);
+        if (entry.armedEvents != 0 && (mask & ~entry.armedEvents) != 0) {
+            cancelRequest(entry.pollUserData);
+            entry.armedEvents = 0;
+        }
+        if ((mask != 0 && entry.armedEvents == 0 && !armPoll(fd, entry)) || (entry.readSlot >= 0 && (entry.events & EPOLLIN) && !entry.readArmed && !armRead(fd, entry))) {
+            errno = ENOMEM;
+            return -1;
+        }
+        return 0;
+    }
+#endif
+    return epoll_ctl(epolFd, op, fd, event);
+}
+
+void *NetworkReactor::ThreadProc(void *data) {
+    if (LOGS_ENABLED) DEBUG_D("network thread started");
+    NetworkReactor *reactor = (NetworkReactor *) (data);
+    while (true) {
+        reactor->attachPendingManagers();
+        reactor->select();
+    }
+    return nullptr;
+}
+
+void NetworkReactor::attachPendingManagers() {
+    pthread_mutex_lock(&mutex);
+    if (pendingManagers.empty()) {
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    std::vector<ConnectionsManager *> attached;
+    attached.swap(pendingManagers);
+    pthread_mutex_unlock(&mutex);
+    for (std::vector<ConnectionsManager *>::iterator iter = attached.begin(); iter != attached.end(); iter++) {
+        ConnectionsManager *manager = *iter;
+#ifdef ANDROID
+        javaVm->AttachCurrentThread(&jniEnv[manager->instanceNum], NULL);
+#endif
+        managers.push_back(manager);
+        manager->onNetworkThreadAttached();
+    }
+}
+
+void NetworkReactor::select() {
+    size_t count = managers.size();
+    int timeout = count == 0 ? 1000 : INT32_MAX;
+    for (size_t a = 0; a < count; a++) {
+        managers[a]->checkPendingTasks();
+        timeout = std::min(timeout, managers[a]->callEvents(managers[a]->getCurrentTimeMonotonicMillis()));
+        managers[a]->flushSockets();
+    }
+#ifdef USE_IO_URING
+    int eventsCount = ringFd != -1 ? selectIoUring(timeout) : epoll_wait(epolFd, epollEvents, 128, timeout);
+#else
+    int eventsCount = epoll_wait(epolFd, epollEvents, 128, timeout);
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &timeSpecMonotonic);
+    int64_t now = (int64_t) timeSpecMonotonic.tv_sec * 1000 + (int64_t) timeSpecMonotonic.tv_nsec / 1000000;
+    for (size_t a = 0; a < count; a++) {
+        managers[a]->checkPendingTasks();
+        managers[a]->callEvents(now);
+    }
+    for (int32_t a = 0; a < eventsCount; a++) {
+        EventObject *eventObject = (EventObject *) epollEvents[a].data.ptr;
+#ifdef USE_IO_URING
+        if (ringFd != -1 && ringReads[a] != nullptr) {
+            eventObject->onReceived(ringReads[a], ringReadLengths[a]);
+            continue;
+        }
+#endif
+        eventObject->onEvent(epollEvents[a].events);
+    }
+    for (size_t a = 0; a < count; a++) {
+        managers[a]->onSelectFinished(now);
+    }
+#ifdef USE_IO_URING
+    if (ringFd != -1) {
+        rearmPolls();
+    }
+#endif
+}
+
+#ifdef USE_IO_URING
+
+bool NetworkReactor::setupIoUring() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int) syscall(__NR_io_uring_setup, IO_URING_ENTRIES, &params);
+    if (fd < 0) {
+        if (LOGS_ENABLED) DEBUG_D("io_uring unavailable, errno %d, using epoll", errno);
+        return false;
+    }
+    if ((params.features & IORING_FEAT_NODROP) == 0) {
+        if (LOGS_ENABLED) DEBUG_D("io_uring may drop completions, using epoll");
+        close(fd);
+        return false;
+    }
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap) {
+        sqSize = cqSize = std::max(sqSize, cqSize);
+    }
+    size_t sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqRing = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    void *cqRing = singleMmap ? sqRing : mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqesRing = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqesRing == MAP_FAILED) {
+        if (LOGS_ENABLED) DEBUG_E("unable to map io_uring rings, errno %d, using epoll", errno);
+        if (sqRing != MAP_FAILED) {
+            munmap(sqRing, sqSize);
+        }
+        if (!singleMmap && cqRing != MAP_FAILED) {
+            munmap(cqRing, cqSize);
+        }
+        if (sqesRing != MAP_FAILED) {
+            munmap(sqesRing, sqesSize);
+        }
+        close(fd);
+        return false;
+    }
+    sqEntries = params.sq_entries;
+    sqHead = (uint32_t *) ((uint8_t *) sqRing + params.sq_off.head);
+    sqTail = (uint32_t *) ((uint8_t *) sqRing + params.sq_off.tail);
+    sqMask = (uint32_t *) ((uint8_t *) sqRing + params.sq_off.ring_mask);
+    sqArray = (uint32_t *) ((uint8_t *) sqRing + params.sq_off.array);
+    sqLocalTail = *sqTail;
+    sqes = (struct io_uring_sqe *) sqesRing;
+    cqHead = (uint32_t *) ((uint8_t *) cqRing + params.cq_off.head);
+    cqTail = (uint32_t *) ((uint8_t *) cqRing + params.cq_off.tail);
+    cqMask = (uint32_t *) ((uint8_t *) cqRing + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) ((uint8_t *) cqRing + params.cq_off.cqes);
+    ringFd = fd;
+    setupRecvBuffers();
+    if (LOGS_ENABLED) DEBUG_D("using io_uring with %u entries and %u registered receive buffers", sqEntries, (uint32_t) freeRecvSlots.size());
+    return true;
+}
+
+void NetworkReactor::setupRecvBuffers() {
+    size_t size = (size_t) IO_URING_RECV_BUFFERS_COUNT * IO_URING_RECV_BUFFER_SIZE;
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        if (LOGS_ENABLED) DEBUG_E("unable to allocate io_uring receive buffers");
+        return;
+    }
+    struct iovec iovecs[IO_URING_RECV_BUFFERS_COUNT];
+    for (int32_t a = 0; a < IO_URING_RECV_BUFFERS_COUNT; a++) {
+        iovecs[a].iov_base = (uint8_t *) memory + (size_t) a * IO_URING_RECV_BUFFER_SIZE;
+        iovecs[a].iov_len = IO_URING_RECV_BUFFER_SIZE;
+    }
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, iovecs, IO_URING_RECV_BUFFERS_COUNT) != 0) {
+        if (LOGS_ENABLED) DEBUG_E("unable to register io_uring receive buffers, errno %d, polling sockets instead", errno);
+        munmap(memory, size);
+        return;
+    }
+    recvBuffers = (uint8_t *) memory;
+    for (int32_t a = IO_URING_RECV_BUFFERS_COUNT - 1; a >= 0; a--) {
+        freeRecvSlots.push_back(a);
+    }
+}
+
+bool NetworkReactor::hasSqes(uint32_t count) {
+    return sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) + count <= sqEntries;
+}
+
+struct io_uring_sqe *NetworkReactor::getSqe() {
+    uint32_t index = sqLocalTail & *sqMask;
+    sqArray[index] = index;
+    sqLocalTail++;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+void NetworkReactor::submitRing(uint32_t minComplete, uint32_t flags) {
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    uint32_t toSubmit = sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (toSubmit == 0 && minComplete == 0) {
+        return;
+    }
+    if (syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0) < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+        if (LOGS_ENABLED) DEBUG_E("io_uring_enter failed, errno %d", errno);
+    }
+}
+
+uint64_t NetworkReactor::nextUserData(int fd, uint32_t kind) {
+    if (++ringGeneration == 0) {
+        ringGeneration = 1;
+    }
+    return ((uint64_t) ringGeneration << 32) | ((uint64_t) kind << 30) | ((uint32_t) fd & 0x3fffffff);
+}
+
+uint32_t NetworkReactor::getPollMask(PollEntry &entry) {
+    uint32_t mask = entry.events & ~EPOLLET;
+    if (entry.readSlot >= 0) {
+        mask &= ~EPOLLIN;
+        if ((mask & EPOLLOUT) == 0) {
+            return 0;
+        }
+    }
+    return mask;
+}
+
+bool NetworkReactor::armPoll(int fd, PollEntry &entry) {
+    if (!hasSqes(1)) {
+        if (LOGS_ENABLED) DEBUG_E("io_uring submission queue is full");
+        return false;
+    }
+    struct io_uring_sqe *sqe = getSqe();
+    entry.pollUserData = nextUserData(fd, IO_URING_KIND_POLL);
+    entry.armedEvents = getPollMask(entry);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll_events = (uint16_t) entry.armedEvents;
+    sqe->user_data = entry.pollUserData;
+    return true;
+}
+
+bool NetworkReactor::armRead(int fd, PollEntry &entry) {
+    if (!hasSqes(2)) {
+        if (LOGS_ENABLED) DEBUG_E("io_uring submission queue is full");
+        return false;
+    }
+    entry.readUserData = nextUserData(fd, IO_URING_KIND_READ);
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll_events = (uint16_t) (EPOLLIN | EPOLLRDHUP);
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = (entry.readUserData & ~(3ULL << 30)) | ((uint64_t) IO_URING_KIND_READ_POLL << 30);
+    sqe = getSqe();
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) (recvBuffers + (size_t) entry.readSlot * IO_URING_RECV_BUFFER_SIZE);
+    sqe->len = IO_URING_RECV_BUFFER_SIZE;
+    sqe->buf_index = (uint16_t) entry.readSlot;
+    sqe->user_data = entry.readUserData;
+    entry.readArmed = true;
+    return true;
+}
+
+void NetworkReactor::cancelRequest(uint64_t userData) {
+    if (!hasSqes(1)) {
+        if (LOGS_ENABLED) DEBUG_E("io_uring submission queue is full");
+        return;
+    }
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = userData;
+    sqe->user_data = 0;
+}
+
+void NetworkReactor::releaseEntry(PollEntry &entry) {
+    if (entry.armedEvents != 0) {
+        cancelRequest(entry.pollUserData);
+        entry.armedEvents = 0;
+    }
+    if (entry.readSlot < 0) {
+        return;
+    }
+    if (entry.readArmed) {
+        cancelRequest((entry.readUserData & ~(3ULL << 30)) | ((uint64_t) IO_URING_KIND_READ_POLL << 30));
+        orphanReads[entry.readUserData] = entry.readSlot;
+        entry.readArmed = false;
+    } else {
+        freeRecvSlots.push_back(entry.readSlot);
+    }
+    entry.readSlot = -1;
+}
+
+int NetworkReactor::selectIoUring(int timeout) {
+    submitRing(0, 0);
+    if (*cqHead == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE) && timeout > 0 && hasSqes(1)) {
+        ringTimeout.tv_sec = timeout / 1000;
+        ringTimeout.tv_nsec = (long long) (timeout % 1000) * 1000000;
+        struct io_uring_sqe *sqe = getSqe();
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t) (uintptr_t) &ringTimeout;
+        sqe->len = 1;
+        sqe->off = 1;
+        sqe->user_data = 0;
+        submitRing(1, IORING_ENTER_GETEVENTS);
+    }
+    int eventsCount = 0;
+    uint32_t head = *cqHead;
+    uint32_t tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail && eventsCount < 128) {
+        struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+        head++;
+        uint32_t kind = (uint32_t) (cqe->user_data >> 30) & 3;
+        if (cqe->user_data == 0 || kind == IO_URING_KIND_READ_POLL) {
+            continue;
+        }
+        if (kind == IO_URING_KIND_READ) {
+            std::map<uint64_t, int32_t>::iterator orphan = orphanReads.find(cqe->user_data);
+            if (orphan != orphanReads.end()) {
+                freeRecvSlots.push_back(orphan->second);
+                orphanReads.erase(orphan);
+                continue;
+            }
+        }
+        int fd = (int) (cqe->user_data & 0x3fffffff);
+        std::map<int, PollEntry>::iterator iter = pollEntries.find(fd);
+        if (iter == pollEntries.end()) {
+            continue;
+        }
+        PollEntry &entry = iter->second;
+        uint32_t events;
+        ringReads[eventsCount] = nullptr;
+        if (kind == IO_URING_KIND_READ) {
+            if (entry.readUserData != cqe->user_data) {
+                continue;
+            }
+            entry.readArmed = false;
+            rearmFds.push_back(fd);
+            if (cqe->res == -EAGAIN || cqe->res == -EINTR) {
+                continue;
+            }
+            if (cqe->res > 0) {
+                events = EPOLLIN;
+                ringReads[eventsCount] = recvBuffers + (size_t) entry.readSlot * IO_URING_RECV_BUFFER_SIZE;
+                ringReadLengths[eventsCount] = (uint32_t) cqe->res;
+            } else {
+                events = cqe->res == 0 ? (uint32_t) EPOLLRDHUP : (uint32_t) (EPOLLERR | EPOLLHUP);
+            }
+        } else {
+            if (entry.pollUserData != cqe->user_data) {
+                continue;
+            }
+            entry.armedEvents = 0;
+            rearmFds.push_back(fd);
+            if (cqe->res == -ECANCELED) {
+                continue;
+            }
+            events = cqe->res < 0 ? (uint32_t) (EPOLLERR | EPOLLHUP) : (uint32_t) cqe->res & (entry.events | EPOLLERR | EPOLLHUP);
+            if (events == 0) {
+                continue;
+            }
+        }
+        epollEvents[eventsCount].events = events;
+        epollEvents[eventsCount].data.ptr = entry.eventObject;
+        eventsCount++;
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    return eventsCount;
+}
+
+void NetworkReactor::rearmPolls() {
+    for (size_t a = 0; a < rearmFds.size(); a++) {
+        std::map<int, PollEntry>::iterator iter = pollEntries.find(rearmFds[a]);
+        if (iter == pollEntries.end()) {
+            continue;
+        }
+        PollEntry &entry = iter->second;
+        if (entry.readSlot >= 0 && (entry.events & EPOLLIN) && !entry.readArmed && !armRead(iter->first, entry)) {
+            if (LOGS_ENABLED) DEBUG_E("unable to rearm read for fd %d", iter->first);
+        }
+        if (entry.armedEvents == 0 && getPollMask(entry) != 0 && !armPoll(iter->first, entry)) {
+            if (LOGS_ENABLED) DEBUG_E("unable to rearm poll for fd %d", iter->first);
+        }
+    }
+    rearmFds.clear();
+}
+
+#endif
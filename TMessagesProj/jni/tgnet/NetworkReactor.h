@@ -0,0 +1,116 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#ifndef NETWORKREACTOR_H
+#define NETWORKREACTOR_H
+
+#include <pthread.h>
+#include <vector>
+#include <map>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include "Defines.h"
+
+#if !defined(ANDROID) && defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define USE_IO_URING
+#endif
+#endif
+
+class ConnectionsManager;
+class NativeByteBuffer;
+class EventObject;
+
+class NetworkReactor {
+
+public:
+    static NetworkReactor *obtain(int32_t instanceNum);
+    static void setSharedCount(uint32_t count);
+    static void setUseIoUring(bool value);
+
+    void attach(ConnectionsManager *manager);
+    void wakeup();
+    int control(int op, int fd, struct epoll_event *event);
+
+    int epolFd = -1;
+    NativeByteBuffer *networkBuffer;
+
+private:
+    NetworkReactor();
+
+    static void *ThreadProc(void *data);
+    void attachPendingManagers();
+    void select();
+
+#ifdef USE_IO_URING
+    struct PollEntry {
+        EventObject *eventObject;
+        uint32_t events;
+        uint32_t armedEvents;
+        uint64_t pollUserData;
+        uint64_t readUserData;
+        int32_t readSlot;
+        bool readArmed;
+    };
+
+    struct RingTimeout {
+        int64_t tv_sec;
+        long long tv_nsec;
+    };
+
+    bool setupIoUring();
+    void setupRecvBuffers();
+    bool hasSqes(uint32_t count);
+    struct io_uring_sqe *getSqe();
+    void submitRing(uint32_t minComplete, uint32_t flags);
+    uint64_t nextUserData(int fd, uint32_t kind);
+    uint32_t getPollMask(PollEntry &entry);
+    bool armPoll(int fd, PollEntry &entry);
+    bool armRead(int fd, PollEntry &entry);
+    void cancelRequest(uint64_t userData);
+    void releaseEntry(PollEntry &entry);
+    int selectIoUring(int timeout);
+    void rearmPolls();
+
+    int ringFd = -1;
+    uint32_t sqEntries;
+    uint32_t sqLocalTail;
+    uint32_t *sqHead;
+    uint32_t *sqTail;
+    uint32_t *sqMask;
+    uint32_t *sqArray;
+    struct io_uring_sqe *sqes;
+    uint32_t *cqHead;
+    uint32_t *cqTail;
+    uint32_t *cqMask;
+    struct io_uring_cqe *cqes;
+    RingTimeout ringTimeout;
+    uint32_t ringGeneration = 0;
+    std::map<int, PollEntry> pollEntries;
+    std::vector<int> rearmFds;
+    uint8_t *recvBuffers = nullptr;
+    std::vector<int32_t> freeRecvSlots;
+    std::map<uint64_t, int32_t> orphanReads;
+    uint8_t *ringReads[128];
+    uint32_t ringReadLengths[128];
+#endif
+
+    int eventFd;
+    int *pipeFd = nullptr;
+    struct epoll_event *epollEvents;
+    timespec timeSpecMonotonic;
+
+    pthread_t networkThread;
+    pthread_mutex_t mutex;
+    bool threadStarted = false;
+    std::vector<ConnectionsManager *> pendingManagers;
+    std::vector<ConnectionsManager *> managers;
+};
+
+#endif
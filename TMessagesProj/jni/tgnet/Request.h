@@ -46,6 +46,7 @@ public:
     int32_t serializedLength = 0;
     int32_t startTime = 0;
     int64_t startTimeMillis = 0;
+    uint64_t deliveredBytesAtStart = 0;
     int32_t minStartTime = 0;
     int32_t lastResendTime = 0;
     int32_t instanceNum = 0;
@@ -55,6 +56,9 @@ public:
     onCompleteFunc onCompleteRequestCallback;
     onQuickAckFunc onQuickAckCallback;
     onWriteToSocketFunc onWriteToSocketCallback;
+    requestsIter listIterator;
+    bool running = false;
+    uint32_t runningDatacenterId = 0;
 
     void addRespondMessageId(int64_t id);
     bool respondsToMessageId(int64_t id);
@@ -75,6 +79,9 @@ public:
 
 private:
     std::vector<int64_t> respondsToMessageIds;
+    std::vector<int64_t> indexedMessageIds;
+
+    friend class ConnectionsManager;
 };
 
 #endif
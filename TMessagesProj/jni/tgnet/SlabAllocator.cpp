@@ -0,0 +1,180 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#include <stdlib.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include "SlabAllocator.h"
+#include "FileLog.h"
+#include "ConnectionsManager.h"
+
+SlabAllocator &SlabAllocator::getInstance() {
+    static SlabAllocator instance;
+    return instance;
+}
+
+SlabAllocator::SlabAllocator() {
+    pthread_mutex_init(&mutex, NULL);
+}
+
+bool SlabAllocator::canAllocate(uint32_t size) {
+    return size != 0 && size <= SLAB_MAX_ALLOCATION_SIZE;
+}
+
+uint32_t SlabAllocator::getChunkSize(uint32_t size) {
+    if (size <= 128) {
+        return (size + 15) & ~15U;
+    }
+    uint32_t step = 1U << (31 - __builtin_clz(size - 1) - 3);
+    return (size + step - 1) & ~(step - 1);
+}
+
+uint8_t *SlabAllocator::allocate(uint32_t size) {
+    uint32_t chunkSize = getChunkSize(size);
+    uint8_t *data;
+    pthread_mutex_lock(&mutex);
+    std::unordered_map<uint32_t, std::vector<uint8_t *>>::iterator iter = freeChunks.find(chunkSize);
+    if (iter != freeChunks.end() && !iter->second.empty()) {
+        data = iter->second.back();
+        iter->second.pop_back();
+    } else {
+        if (SLAB_SIZE - currentOffset < chunkSize) {
+            createSlab();
+        }
+        data = currentSlab + currentOffset;
+        currentOffset += chunkSize;
+    }
+    std::map<uint8_t *, Slab>::iterator slab = findSlab(data);
+    if (slab->second.usedBytes == 0 && slab->first != currentSlab) {
+        idleSlabsCount--;
+    }
+    slab->second.usedBytes += chunkSize;
+    pthread_mutex_unlock(&mutex);
+    return data;
+}
+
+void SlabAllocator::release(uint8_t *data, uint32_t size) {
+    uint32_t chunkSize = getChunkSize(size);
+    pthread_mutex_lock(&mutex);
+    freeChunks[chunkSize].push_back(data);
+    std::map<uint8_t *, Slab>::iterator slab = findSlab(data);
+    slab->second.usedBytes -= chunkSize;
+    if (slab->second.usedBytes == 0 && slab->first != currentSlab && ++idleSlabsCount > SLAB_MAX_IDLE_COUNT) {
+        freeSlab(slab);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+#ifdef ANDROID
+jobject SlabAllocator::getJavaByteBuffer(uint8_t *data, uint32_t size) {
+    pthread_mutex_lock(&mutex);
+    std::map<uint8_t *, Slab>::iterator slab = findSlab(data);
+    jobject javaBuffer = slab->second.javaBuffer;
+    uint32_t offset = (uint32_t) (data - slab->first);
+    pthread_mutex_unlock(&mutex);
+    if (javaBuffer == nullptr) {
+        return nullptr;
+    }
+    JNIEnv *env = 0;
+    if (javaVm->GetEnv((void **) &env, JNI_VERSION_1_6) != JNI_OK) {
+        if (LOGS_ENABLED) DEBUG_E("can't get jnienv");
+        exit(1);
+    }
+    jobject duplicate = env->CallObjectMethod(javaBuffer, jclass_ByteBuffer_duplicate);
+    if (duplicate == nullptr) {
+        return nullptr;
+    }
+    env->DeleteLocalRef(env->CallObjectMethod(duplicate, jclass_Buffer_limit, (jint) (offset + size)));
+    env->DeleteLocalRef(env->CallObjectMethod(duplicate, jclass_Buffer_position, (jint) offset));
+    jobject slice = env->CallObjectMethod(duplicate, jclass_ByteBuffer_slice);
+    env->DeleteLocalRef(duplicate);
+    return slice;
+}
+#endif
+
+std::map<uint8_t *, SlabAllocator::Slab>::iterator SlabAllocator::findSlab(uint8_t *data) {
+    std::map<uint8_t *, Slab>::iterator iter = slabs.upper_bound(data);
+    return --iter;
+}
+
+void SlabAllocator::createSlab() {
+    while (currentSlab != nullptr && SLAB_SIZE - currentOffset >= 16) {
+        uint32_t tail = SLAB_SIZE - currentOffset;
+        uint32_t chunkSize;
+        if (tail <= 128) {
+            chunkSize = tail & ~15U;
+        } else {
+            chunkSize = tail & ~((1U << (31 - __builtin_clz(tail) - 3)) - 1);
+        }
+        freeChunks[chunkSize].push_back(currentSlab + currentOffset);
+        currentOffset += chunkSize;
+    }
+    if (currentSlab != nullptr && slabs[currentSlab].usedBytes == 0) {
+        idleSlabsCount++;
+    }
+    Slab info;
+    uint8_t *slab = nullptr;
+#ifdef ANDROID
+    if (jclass_ByteBuffer != nullptr) {
+        JNIEnv *env = 0;
+        if (javaVm->GetEnv((void **) &env, JNI_VERSION_1_6) != JNI_OK) {
+            if (LOGS_ENABLED) DEBUG_E("can't get jnienv");
+            exit(1);
+        }
+        jobject javaSlab = env->CallStaticObjectMethod(jclass_ByteBuffer, jclass_ByteBuffer_allocateDirect, SLAB_SIZE);
+        if (javaSlab == nullptr) {
+            if (LOGS_ENABLED) DEBUG_E("can't create java slab");
+            exit(1);
+        }
+        info.javaBuffer = env->NewGlobalRef(javaSlab);
+        env->DeleteLocalRef(javaSlab);
+        slab = (uint8_t *) env->GetDirectBufferAddress(info.javaBuffer);
+    } else {
+#endif
+        void *memory = mmap(nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory != MAP_FAILED) {
+            slab = (uint8_t *) memory;
+        }
+#ifdef ANDROID
+    }
+#endif
+    if (slab == nullptr) {
+        if (LOGS_ENABLED) DEBUG_E("can't allocate slab");
+        exit(1);
+    }
+    slabs[slab] = info;
+    currentSlab = slab;
+    currentOffset = 0;
+}
+
+void SlabAllocator::freeSlab(std::map<uint8_t *, Slab>::iterator iter) {
+    uint8_t *start = iter->first;
+    uint8_t *end = start + SLAB_SIZE;
+    for (std::unordered_map<uint32_t, std::vector<uint8_t *>>::iterator chunks = freeChunks.begin(); chunks != freeChunks.end(); chunks++) {
+        std::vector<uint8_t *> &list = chunks->second;
+        list.erase(std::remove_if(list.begin(), list.end(), [&](uint8_t *chunk) {
+            return chunk >= start && chunk < end;
+        }), list.end());
+    }
+#ifdef ANDROID
+    if (iter->second.javaBuffer != nullptr) {
+        JNIEnv *env = 0;
+        if (javaVm->GetEnv((void **) &env, JNI_VERSION_1_6) != JNI_OK) {
+            if (LOGS_ENABLED) DEBUG_E("can't get jnienv");
+            exit(1);
+        }
+        env->DeleteGlobalRef(iter->second.javaBuffer);
+    } else {
+#endif
+        munmap(start, SLAB_SIZE);
+#ifdef ANDROID
+    }
+#endif
+    slabs.erase(iter);
+    idleSlabsCount--;
+}
@@ -0,0 +1,60 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#ifndef SLABALLOCATOR_H
+#define SLABALLOCATOR_H
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <pthread.h>
+
+#ifdef ANDROID
+#include <jni.h>
+#endif
+
+#define SLAB_SIZE (2 * 1024 * 1024)
+#define SLAB_MAX_ALLOCATION_SIZE (256 * 1024 + 200)
+#define SLAB_MAX_IDLE_COUNT 2
+
+class SlabAllocator {
+
+public:
+    static SlabAllocator &getInstance();
+    static bool canAllocate(uint32_t size);
+
+    uint8_t *allocate(uint32_t size);
+    void release(uint8_t *data, uint32_t size);
+#ifdef ANDROID
+    jobject getJavaByteBuffer(uint8_t *data, uint32_t size);
+#endif
+
+private:
+    struct Slab {
+        uint32_t usedBytes = 0;
+#ifdef ANDROID
+        jobject javaBuffer = nullptr;
+#endif
+    };
+
+    SlabAllocator();
+    static uint32_t getChunkSize(uint32_t size);
+    std::map<uint8_t *, Slab>::iterator findSlab(uint8_t *data);
+    void createSlab();
+    void freeSlab(std::map<uint8_t *, Slab>::iterator iter);
+
+    pthread_mutex_t mutex;
+    uint8_t *currentSlab = nullptr;
+    uint32_t currentOffset = SLAB_SIZE;
+    uint32_t idleSlabsCount = 0;
+    std::map<uint8_t *, Slab> slabs;
+    std::unordered_map<uint32_t, std::vector<uint8_t *>> freeChunks;
+};
+
+#endif
@@ -6,11 +6,124 @@
  * Copyright Nikolai Kudashov, 2015-2018.
  */
 
+#include <atomic>
+#include <new>
+#include <vector>
 #include "TLObject.h"
 #include "NativeByteBuffer.h"
 
+#define TL_OBJECT_ARENA_BLOCK_SIZE (16 * 1024)
+#define TL_OBJECT_ARENA_CACHED_BLOCKS 4
+#define TL_OBJECT_HEADER_SIZE 16
+
+struct TLObjectArenaBlock;
+
+struct TLObjectArena {
+    uint32_t depth = 0;
+    std::vector<TLObjectArenaBlock *> blocks;
+    std::vector<TLObjectArenaBlock *> freeBlocks;
+    ~TLObjectArena();
+};
+
+struct alignas(TL_OBJECT_HEADER_SIZE) TLObjectArenaBlock {
+    std::atomic<uint32_t> references;
+    uint32_t offset;
+};
+
+struct alignas(TL_OBJECT_HEADER_SIZE) TLObjectHeader {
+    TLObjectArenaBlock *block;
+};
+
 thread_local NativeByteBuffer *sizeCalculatorBuffer = new NativeByteBuffer(true);
 
+static TLObjectArena &getArena() {
+    thread_local static TLObjectArena arena;
+    return arena;
+}
+
+static uint8_t *getBlockData(TLObjectArenaBlock *block) {
+    return (uint8_t *) block + sizeof(TLObjectArenaBlock);
+}
+
+static void recycleBlock(TLObjectArena &arena, TLObjectArenaBlock *block) {
+    if (arena.freeBlocks.size() < TL_OBJECT_ARENA_CACHED_BLOCKS) {
+        arena.freeBlocks.push_back(block);
+    } else {
+        block->~TLObjectArenaBlock();
+        ::operator delete(block);
+    }
+}
+
+static void releaseBlock(TLObjectArenaBlock *block) {
+    if (block->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        recycleBlock(getArena(), block);
+    }
+}
+
+TLObjectArena::~TLObjectArena() {
+    for (TLObjectArenaBlock *block : freeBlocks) {
+        block->~TLObjectArenaBlock();
+        ::operator delete(block);
+    }
+    freeBlocks.clear();
+}
+
+TLObjectArenaScope::TLObjectArenaScope() {
+    getArena().depth++;
+}
+
+TLObjectArenaScope::~TLObjectArenaScope() {
+    TLObjectArena &arena = getArena();
+    if (--arena.depth != 0) {
+        return;
+    }
+    std::vector<TLObjectArenaBlock *> blocks;
+    blocks.swap(arena.blocks);
+    for (TLObjectArenaBlock *block : blocks) {
+        releaseBlock(block);
+    }
+}
+
+void *TLObject::operator new(size_t size) {
+    size_t length = (TL_OBJECT_HEADER_SIZE + size + TL_OBJECT_HEADER_SIZE - 1) & ~(size_t) (TL_OBJECT_HEADER_SIZE - 1);
+    TLObjectArena &arena = getArena();
+    TLObjectHeader *header;
+    if (arena.depth != 0 && length <= TL_OBJECT_ARENA_BLOCK_SIZE - sizeof(TLObjectArenaBlock)) {
+        TLObjectArenaBlock *block = arena.blocks.empty() ? nullptr : arena.blocks.back();
+        if (block == nullptr || block->offset + length > TL_OBJECT_ARENA_BLOCK_SIZE - sizeof(TLObjectArenaBlock)) {
+            if (!arena.freeBlocks.empty()) {
+                block = arena.freeBlocks.back();
+                arena.freeBlocks.pop_back();
+            } else {
+                block = new (::operator new(TL_OBJECT_ARENA_BLOCK_SIZE)) TLObjectArenaBlock();
+            }
+            block->references.store(1, std::memory_order_relaxed);
+            block->offset = 0;
+            arena.blocks.push_back(block);
+        }
+        header = (TLObjectHeader *) (getBlockData(block) + block->offset);
+        header->block = block;
+        block->offset += length;
+        block->references.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        header = (TLObjectHeader *) ::operator new(length);
+        header->block = nullptr;
+    }
+    return (uint8_t *) header + TL_OBJECT_HEADER_SIZE;
+}
+
+void TLObject::operator delete(void *ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    TLObjectHeader *header = (TLObjectHeader *) ((uint8_t *) ptr - TL_OBJECT_HEADER_SIZE);
+    if (header->block == nullptr) {
+        ::operator delete(header);
+    } else {
+        releaseBlock(header->block);
+    }
+}
+
 TLObject::~TLObject() {
 
 }
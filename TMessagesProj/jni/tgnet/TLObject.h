@@ -10,6 +10,7 @@
 #define TLOBJECT_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include "Defines.h"
 
 class NativeByteBuffer;
@@ -21,10 +22,21 @@ public:
     virtual void readParams(NativeByteBuffer *stream, int32_t instanceNum, bool &error);
     virtual void serializeToStream(NativeByteBuffer *stream);
     virtual TLObject *deserializeResponse(NativeByteBuffer *stream, uint32_t constructor, int32_t instanceNum, bool &error);
-    uint32_t getObjectSize();
+    virtual uint32_t getObjectSize();
     virtual bool isNeedLayer();
 
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr);
+
     fillParamsFunc initFunc;
+    uint32_t objectConstructor = 0;
+};
+
+class TLObjectArenaScope {
+
+public:
+    TLObjectArenaScope();
+    ~TLObjectArenaScope();
 };
 
 #endif
@@ -0,0 +1,92 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#include <sched.h>
+#include "TaskQueue.h"
+
+TaskQueue::TaskQueue() {
+    cells = new Cell[TASK_QUEUE_CAPACITY];
+    for (size_t a = 0; a < TASK_QUEUE_CAPACITY; a++) {
+        cells[a].sequence.store(a, std::memory_order_relaxed);
+    }
+    pthread_mutex_init(&overflowMutex, NULL);
+}
+
+TaskQueue::~TaskQueue() {
+    delete[] cells;
+    pthread_mutex_destroy(&overflowMutex);
+}
+
+bool TaskQueue::push(Task &&task) {
+    if (overflowCount.load(std::memory_order_acquire) != 0 || !tryPush(task)) {
+        pthread_mutex_lock(&overflowMutex);
+        overflowTasks.push_back(std::move(task));
+        overflowCount.fetch_add(1, std::memory_order_release);
+        pthread_mutex_unlock(&overflowMutex);
+    }
+    return !wakeupPending.exchange(true, std::memory_order_acq_rel);
+}
+
+void TaskQueue::drain() {
+    wakeupPending.exchange(false, std::memory_order_acq_rel);
+    Task task;
+    while (true) {
+        while (tryPop(task)) {
+            task();
+            task.reset();
+        }
+        if (overflowCount.load(std::memory_order_acquire) == 0) {
+            return;
+        }
+        if (tail.load(std::memory_order_acquire) != head) {
+            sched_yield();
+            continue;
+        }
+        std::vector<Task> tasks;
+        pthread_mutex_lock(&overflowMutex);
+        tasks.swap(overflowTasks);
+        overflowCount.store(0, std::memory_order_release);
+        pthread_mutex_unlock(&overflowMutex);
+        for (std::vector<Task>::iterator iter = tasks.begin(); iter != tasks.end(); iter++) {
+            (*iter)();
+        }
+    }
+}
+
+bool TaskQueue::tryPush(Task &task) {
+    size_t position = tail.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+        cell = &cells[position & (TASK_QUEUE_CAPACITY - 1)];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) position;
+        if (diff == 0) {
+            if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            position = tail.load(std::memory_order_relaxed);
+        }
+    }
+    cell->task = std::move(task);
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool TaskQueue::tryPop(Task &task) {
+    Cell *cell = &cells[head & (TASK_QUEUE_CAPACITY - 1)];
+    if (cell->sequence.load(std::memory_order_acquire) != head + 1) {
+        return false;
+    }
+    task = std::move(cell->task);
+    cell->sequence.store(head + TASK_QUEUE_CAPACITY, std::memory_order_release);
+    head++;
+    return true;
+}
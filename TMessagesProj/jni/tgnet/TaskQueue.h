@@ -0,0 +1,162 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#ifndef TASKQUEUE_H
+#define TASKQUEUE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <pthread.h>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define TASK_INLINE_SIZE 64
+#define TASK_QUEUE_CAPACITY 1024
+
+class Task {
+
+public:
+    Task() = default;
+
+    template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F &&function) {
+        typedef typename std::decay<F>::type Function;
+        construct<Function>(std::forward<F>(function), std::integral_constant<bool, sizeof(Function) <= TASK_INLINE_SIZE && alignof(Function) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible<Function>::value>());
+    }
+
+    Task(Task &&other) noexcept {
+        moveFrom(other);
+    }
+
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task() {
+        reset();
+    }
+
+    void operator()() {
+        operations->invoke(storage);
+    }
+
+    explicit operator bool() const {
+        return operations != nullptr;
+    }
+
+    void reset() {
+        if (operations != nullptr) {
+            operations->destroy(storage);
+            operations = nullptr;
+        }
+    }
+
+private:
+    struct Operations {
+        void (*invoke)(void *storage);
+        void (*move)(void *to, void *from);
+        void (*destroy)(void *storage);
+    };
+
+    template <typename Function>
+    struct InlineOperations {
+        static void invoke(void *storage) {
+            (*reinterpret_cast<Function *>(storage))();
+        }
+        static void move(void *to, void *from) {
+            new (to) Function(std::move(*reinterpret_cast<Function *>(from)));
+            reinterpret_cast<Function *>(from)->~Function();
+        }
+        static void destroy(void *storage) {
+            reinterpret_cast<Function *>(storage)->~Function();
+        }
+        static const Operations table;
+    };
+
+    template <typename Function>
+    struct HeapOperations {
+        static void invoke(void *storage) {
+            (**reinterpret_cast<Function **>(storage))();
+        }
+        static void move(void *to, void *from) {
+            *reinterpret_cast<Function **>(to) = *reinterpret_cast<Function **>(from);
+        }
+        static void destroy(void *storage) {
+            delete *reinterpret_cast<Function **>(storage);
+        }
+        static const Operations table;
+    };
+
+    template <typename Function, typename F>
+    void construct(F &&function, std::true_type) {
+        new (storage) Function(std::forward<F>(function));
+        operations = &InlineOperations<Function>::table;
+    }
+
+    template <typename Function, typename F>
+    void construct(F &&function, std::false_type) {
+        *reinterpret_cast<Function **>(storage) = new Function(std::forward<F>(function));
+        operations = &HeapOperations<Function>::table;
+    }
+
+    void moveFrom(Task &other) {
+        operations = other.operations;
+        if (operations != nullptr) {
+            operations->move(storage, other.storage);
+            other.operations = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) uint8_t storage[TASK_INLINE_SIZE];
+    const Operations *operations = nullptr;
+};
+
+template <typename Function>
+const Task::Operations Task::InlineOperations<Function>::table = {&InlineOperations<Function>::invoke, &InlineOperations<Function>::move, &InlineOperations<Function>::destroy};
+
+template <typename Function>
+const Task::Operations Task::HeapOperations<Function>::table = {&HeapOperations<Function>::invoke, &HeapOperations<Function>::move, &HeapOperations<Function>::destroy};
+
+class TaskQueue {
+
+public:
+    TaskQueue();
+    ~TaskQueue();
+
+    bool push(Task &&task);
+    void drain();
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Task task;
+    };
+
+    bool tryPush(Task &task);
+    bool tryPop(Task &task);
+
+    Cell *cells;
+    std::atomic<size_t> tail{0};
+    size_t head = 0;
+    std::atomic<bool> wakeupPending{false};
+    std::atomic<uint32_t> overflowCount{0};
+    pthread_mutex_t overflowMutex;
+    std::vector<Task> overflowTasks;
+};
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include "TimerWheel.h"
+#include "EventObject.h"
+
+/*
+ * Level N slot covers 64^N ms. An event is kept on the lowest level whose parent block
+ * it shares with baseTime, so every stored event is later than baseTime and lower levels
+ * always expire before higher ones. Slots of a level are cascaded down when baseTime
+ * enters them, events more than 64^4 ms ahead wait in the overflow list.
+ */
+
+TimerWheel::TimerWheel() {
+    memset(lists, 0, sizeof(lists));
+    memset(occupied, 0, sizeof(occupied));
+}
+
+void TimerWheel::add(EventObject *eventObject) {
+    if (eventObject->wheelList != -1) {
+        remove(eventObject);
+    }
+    place(eventObject);
+}
+
+void TimerWheel::remove(EventObject *eventObject) {
+    int32_t list = eventObject->wheelList;
+    if (list == -1) {
+        return;
+    }
+    if (eventObject->next == eventObject) {
+        lists[list] = nullptr;
+        if (list < ListOverflow) {
+            occupied[list >> TIMER_WHEEL_SLOT_BITS] &= ~(1ULL << (list & (TIMER_WHEEL_SLOTS - 1)));
+        }
+    } else {
+        eventObject->prev->next = eventObject->next;
+        eventObject->next->prev = eventObject->prev;
+        if (lists[list] == eventObject) {
+            lists[list] = eventObject->next;
+        }
+    }
+    eventObject->next = nullptr;
+    eventObject->prev = nullptr;
+    eventObject->wheelList = -1;
+}
+
+void TimerWheel::advance(int64_t now) {
+    while (baseTime <= now) {
+        if (isEmpty()) {
+            baseTime = now + 1;
+            return;
+        }
+        int64_t limit = std::min(now, baseTime | (TIMER_WHEEL_SLOTS - 1));
+        int32_t first = (int32_t) (baseTime & (TIMER_WHEEL_SLOTS - 1));
+        int32_t last = (int32_t) (limit & (TIMER_WHEEL_SLOTS - 1));
+        uint64_t mask = occupied[0] & (~0ULL << first);
+        if (last != TIMER_WHEEL_SLOTS - 1) {
+            mask &= (1ULL << (last + 1)) - 1;
+        }
+        while (mask != 0) {
+            int32_t slot = __builtin_ctzll(mask);
+            mask &= mask - 1;
+            EventObject *eventObject = detach(slot);
+            while (eventObject != nullptr) {
+                EventObject *next = eventObject->next;
+                link(eventObject, ListExpired);
+                eventObject = next;
+            }
+        }
+        if (limit == now) {
+            baseTime = now + 1;
+        } else {
+            baseTime = std::min(nextBoundary(), now + 1);
+        }
+        cascade();
+    }
+}
+
+EventObject *TimerWheel::popExpired() {
+    EventObject *eventObject = lists[ListExpired];
+    if (eventObject != nullptr) {
+        remove(eventObject);
+    }
+    return eventObject;
+}
+
+int64_t TimerWheel::getNextTime() {
+    if (lists[ListExpired] != nullptr) {
+        return baseTime - 1;
+    }
+    if (occupied[0] != 0) {
+        return (baseTime & ~(int64_t) (TIMER_WHEEL_SLOTS - 1)) | __builtin_ctzll(occupied[0]);
+    }
+    EventObject *head = nullptr;
+    for (int32_t level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if (occupied[level] != 0) {
+            head = lists[level * TIMER_WHEEL_SLOTS + __builtin_ctzll(occupied[level])];
+            break;
+        }
+    }
+    if (head == nullptr) {
+        head = lists[ListOverflow];
+        if (head == nullptr) {
+            return -1;
+        }
+    }
+    int64_t time = head->time;
+    for (EventObject *eventObject = head->next; eventObject != head; eventObject = eventObject->next) {
+        if (eventObject->time < time) {
+            time = eventObject->time;
+        }
+    }
+    return time;
+}
+
+bool TimerWheel::isEmpty() {
+    for (int32_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        if (occupied[level] != 0) {
+            return false;
+        }
+    }
+    return lists[ListOverflow] == nullptr;
+}
+
+void TimerWheel::place(EventObject *eventObject) {
+    int64_t time = eventObject->time;
+    if (time < baseTime) {
+        link(eventObject, ListExpired);
+        return;
+    }
+    for (int32_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        int32_t shift = TIMER_WHEEL_SLOT_BITS * level;
+        if ((time >> (shift + TIMER_WHEEL_SLOT_BITS)) == (baseTime >> (shift + TIMER_WHEEL_SLOT_BITS))) {
+            link(eventObject, level * TIMER_WHEEL_SLOTS + (int32_t) ((time >> shift) & (TIMER_WHEEL_SLOTS - 1)));
+            return;
+        }
+    }
+    link(eventObject, ListOverflow);
+}
+
+void TimerWheel::link(EventObject *eventObject, int32_t list) {
+    EventObject *head = lists[list];
+    if (head == nullptr) {
+        eventObject->next = eventObject;
+        eventObject->prev = eventObject;
+        lists[list] = eventObject;
+        if (list < ListOverflow) {
+            occupied[list >> TIMER_WHEEL_SLOT_BITS] |= 1ULL << (list & (TIMER_WHEEL_SLOTS - 1));
+        }
+    } else {
+        eventObject->prev = head->prev;
+        eventObject->next = head;
+        head->prev->next = eventObject;
+        head->prev = eventObject;
+    }
+    eventObject->wheelList = list;
+}
+
+EventObject *TimerWheel::detach(int32_t list) {
+    EventObject *head = lists[list];
+    if (head == nullptr) {
+        return nullptr;
+    }
+    head->prev->next = nullptr;
+    lists[list] = nullptr;
+    if (list < ListOverflow) {
+        occupied[list >> TIMER_WHEEL_SLOT_BITS] &= ~(1ULL << (list & (TIMER_WHEEL_SLOTS - 1)));
+    }
+    return head;
+}
+
+void TimerWheel::cascade() {
+    for (int32_t level = TIMER_WHEEL_LEVELS; level > 0; level--) {
+        int32_t shift = TIMER_WHEEL_SLOT_BITS * level;
+        if ((baseTime & ((1LL << shift) - 1)) != 0) {
+            continue;
+        }
+        int32_t list = level == TIMER_WHEEL_LEVELS ? ListOverflow : level * TIMER_WHEEL_SLOTS + (int32_t) ((baseTime >> shift) & (TIMER_WHEEL_SLOTS - 1));
+        EventObject *eventObject = detach(list);
+        while (eventObject != nullptr) {
+            EventObject *next = eventObject->next;
+            place(eventObject);
+            eventObject = next;
+        }
+    }
+}
+
+int64_t TimerWheel::nextBoundary() {
+    for (int32_t level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        int32_t shift = TIMER_WHEEL_SLOT_BITS * level;
+        int32_t index = (int32_t) ((baseTime >> shift) & (TIMER_WHEEL_SLOTS - 1));
+        uint64_t mask = index == TIMER_WHEEL_SLOTS - 1 ? 0 : occupied[level] & (~0ULL << (index + 1));
+        if (mask != 0) {
+            return ((baseTime >> (shift + TIMER_WHEEL_SLOT_BITS)) << (shift + TIMER_WHEEL_SLOT_BITS)) | ((int64_t) __builtin_ctzll(mask) << shift);
+        }
+    }
+    int32_t shift = TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS;
+    return ((baseTime >> shift) + 1) << shift;
+}
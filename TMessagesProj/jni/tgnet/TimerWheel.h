@@ -0,0 +1,50 @@
+/*
+ * This is the source code of tgnet library v. 1.1
+ * It is licensed under GNU GPL v. 2 or later.
+ * You should have received a copy of the license in this archive (see LICENSE).
+ *
+ * Copyright Nikolai Kudashov, 2015-2018.
+ */
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdint.h>
+
+class EventObject;
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+class TimerWheel {
+
+public:
+    TimerWheel();
+
+    void add(EventObject *eventObject);
+    void remove(EventObject *eventObject);
+    void advance(int64_t now);
+    EventObject *popExpired();
+    int64_t getNextTime();
+    bool isEmpty();
+
+private:
+    enum {
+        ListOverflow = TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS,
+        ListExpired,
+        ListsCount
+    };
+
+    void place(EventObject *eventObject);
+    void link(EventObject *eventObject, int32_t list);
+    EventObject *detach(int32_t list);
+    void cascade();
+    int64_t nextBoundary();
+
+    int64_t baseTime = 0;
+    EventObject *lists[ListsCount];
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+};
+
+#endif